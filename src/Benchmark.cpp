@@ -0,0 +1,145 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "world/World.h"
+#include "world/Visibility.h"
+#include "gameplay/Unit.h"
+#include "core/JobSystem.h"
+
+#include <fstream>
+
+namespace {
+class BenchmarkTimer {
+public:
+    BenchmarkTimer() : start_{std::chrono::steady_clock::now()} {}
+
+    double elapsedMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Units are spawned and ordered in groups, like armies, rather than scattered across the map.
+const int GROUP_SIZE = 50;
+const float GROUP_RADIUS = 40.0f;
+}
+
+int runBenchmark(const BenchmarkSettings& settings) {
+    Vector<Pair<String, double>> timings;
+    auto record = [&timings](const String& phase, const BenchmarkTimer& timer) {
+        timings.emplace_back(phase, timer.elapsedMs());
+        std::cout << "Benchmark: " << phase << " took " << timings.back().second << " ms" << std::endl;
+    };
+
+    // Keep the same site density as the default world preset (800 sites over 2400x2400).
+    float world_extent = std::sqrt(float(settings.num_sites) * 7200.0f);
+
+    JobSystem jobs;
+    std::cout << "Benchmark: Using " << jobs.workerCount() << " worker threads" << std::endl;
+
+    BenchmarkTimer map_timer;
+    World world{settings.num_sites, Vec2{0.0f, 0.0f}, Vec2{world_extent, world_extent}, jobs};
+    record("map_generation", map_timer);
+
+    BenchmarkTimer states_timer;
+    world.fillStates(settings.num_players);
+    record("fill_states", states_timer);
+
+    BenchmarkTimer spawn_timer;
+    Visibility visibility{world.map(), (u32)settings.num_players};
+    UnitStore units;
+    units.setPathfinder(&world.pathfinder());
+    units.setVisibility(&visibility);
+    units.setBounds(world.map().boundsMin(), world.map().boundsMax());
+    {
+        std::mt19937 rng{1234};
+        std::uniform_real_distribution<float> position_dist{0.0f, world_extent};
+        std::uniform_real_distribution<float> offset_dist{-GROUP_RADIUS, GROUP_RADIUS};
+        units.reserve((u32)settings.num_units);
+        Vec2 group_centre;
+        for (int i = 0; i < settings.num_units; ++i) {
+            if (i % GROUP_SIZE == 0) {
+                group_centre = {position_dist(rng), position_dist(rng)};
+            }
+            UnitTypeId type = i % 4 == 0 ? UnitTypeId::Tank : UnitTypeId::Squad;
+            Vec2 offset{offset_dist(rng), offset_dist(rng)};
+            units.create(type, group_centre + offset, u32(i / GROUP_SIZE % settings.num_players));
+        }
+    }
+    record("spawn_units", spawn_timer);
+
+    OrderPool::get().reserve((u32)settings.num_units);
+    MEMORY_FRAME();
+    BenchmarkTimer orders_timer;
+    {
+        MEMORY_SCOPE(MemoryTag::Orders);
+        std::mt19937 rng{5678};
+        std::uniform_real_distribution<float> position_dist{0.0f, world_extent};
+        // Send each group somewhere, then gather all of each player's units at a rally point.
+        Vector<Vector<UnitId>> player_units(settings.num_players);
+        Vec2 target;
+        for (UnitId unit = 0; unit < units.size(); ++unit) {
+            if (unit % GROUP_SIZE == 0) {
+                target = {position_dist(rng), position_dist(rng)};
+            }
+            units.addOrder(unit, Order::moveTo(target), false);
+            player_units[units.owner(unit)].push_back(unit);
+        }
+        for (auto& group : player_units) {
+            units.addGroupOrder(group, Order::moveTo({position_dist(rng), position_dist(rng)}), true);
+        }
+    }
+    record("issue_orders", orders_timer);
+    std::cout << "Benchmark: issuing orders ran " << world.pathfinder().searchCount() << " path searches for "
+              << units.size() << " units" << std::endl;
+    MEMORY_FRAME();
+#ifdef DIPLOMACY_MEMORY_TRACKING
+    std::cout << "Benchmark: issuing orders made "
+              << MemoryTracker::get().tagStats(MemoryTag::Orders).allocations_last_frame
+              << " order allocations" << std::endl;
+#endif
+
+    BenchmarkTimer tick_timer;
+    const float dt = 1.0f / 60.0f;
+    for (int tick = 0; tick < settings.num_ticks; ++tick) {
+        PROFILE_FRAME();
+        PROFILE_SCOPE("Tick");
+        MEMORY_FRAME();
+        visibility.clearChanges();
+        units.tick(dt, jobs);
+    }
+    record("tick_units", tick_timer);
+
+    std::ofstream out{settings.output};
+    if (!out) {
+        std::cerr << "Benchmark: Unable to open " << settings.output << " for writing." << std::endl;
+        return 1;
+    }
+    out << "{\"sites\":" << world.mapSites().size()
+        << ",\"players\":" << settings.num_players
+        << ",\"units\":" << settings.num_units
+        << ",\"workers\":" << jobs.workerCount()
+        << ",\"ticks\":" << settings.num_ticks
+        << ",\"timings_ms\":{";
+    for (size_t i = 0; i < timings.size(); ++i) {
+        out << (i > 0 ? "," : "") << '"' << timings[i].first << "\":" << timings[i].second;
+    }
+    out << "},\"tick_average_ms\":" << (settings.num_ticks > 0 ? timings.back().second / settings.num_ticks : 0.0);
+    out << ",\"path_searches\":" << world.pathfinder().searchCount()
+        << ",\"path_cache_hits\":" << world.pathfinder().cacheHitCount()
+        << ",\"flow_fields\":" << world.pathfinder().flowFieldCount();
+    // Runs with the same settings should always produce the same checksum, whatever the worker count.
+    out << ",\"unit_checksum\":" << units.checksum();
+#ifdef DIPLOMACY_MEMORY_TRACKING
+    out << ",\"memory\":";
+    MemoryTracker::get().writeJson(out);
+#endif
+    out << "}\n";
+    std::cout << "Benchmark: Wrote results to " << settings.output << std::endl;
+
+#ifdef DIPLOMACY_PROFILER
+    Profiler::get().writeChromeTrace(settings.output + ".trace.json");
+#endif
+    return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Headless benchmark. Generates a world, spawns units and ticks them with orders, then writes the
+// phase timings (and memory statistics when allocation tracking is enabled) to a JSON file.
+struct BenchmarkSettings {
+    BenchmarkSettings() : num_sites{100000}, num_players{8}, num_units{5000}, num_ticks{600}, output{"benchmark.json"} {}
+
+    int num_sites;
+    int num_players;
+    int num_units;
+    int num_ticks;
+    String output;
+};
+
+int runBenchmark(const BenchmarkSettings& settings);
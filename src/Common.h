@@ -17,10 +17,16 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <map>
 #include <queue>
+#include <set>
 #include <unordered_set>
 #include <unordered_map>
 #include <utility>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
 
 using String = std::string;
 
@@ -39,6 +45,14 @@ using HashSet = std::unordered_set<T>;
 template <typename K, typename V>
 using HashMap = std::unordered_map<K, V>;
 
+// Iterate in key order. Used in the simulation, where iteration order must not depend on
+// pointer values or the standard library's hashing.
+template <typename T, typename Compare = std::less<T>>
+using OrderedSet = std::set<T, Compare>;
+
+template <typename K, typename V, typename Compare = std::less<K>>
+using OrderedMap = std::map<K, V, Compare>;
+
 template <typename T>
 using UniquePtr = std::unique_ptr<T>;
 
@@ -62,10 +76,14 @@ using Vec2 = glm::vec2;
 using Vec3i = glm::ivec3;
 using Vec3 = glm::vec3;
 
+using i8 = std::int8_t;
 using i16 = std::int16_t;
 using i32 = std::int32_t;
+using i64 = std::int64_t;
+using u8 = std::uint8_t;
 using u16 = std::uint16_t;
 using u32 = std::uint32_t;
+using u64 = std::uint64_t;
 using f32 = float;
 using f64 = double;
 using uint = u32;
@@ -282,4 +300,27 @@ inline float vecDistance(const Vec2& a, const Vec2& b) {
 
 inline bool vecEqual(const Vec2& a, const Vec2& b, const float eps = std::numeric_limits<float>::epsilon()) {
     return glm::isNull(a - b, eps);
-}
\ No newline at end of file
+}
+
+// Hashing. Stable across runs and platforms, for checksums of the simulation state.
+inline u64 hashMix(u64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline u64 hashCombine(u64 seed, u64 value) {
+    return hashMix(seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+}
+
+inline u64 hashFloat(float f) {
+    u32 bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Instrumentation.
+#include "core/Profiler.h"
+#include "core/MemoryTracker.h"
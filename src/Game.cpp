@@ -2,7 +2,7 @@
 #include "Game.h"
 #include "MenuGameState.h"
 
-Game::Game() {}
+Game::Game() : jobs_{make_unique<JobSystem>()} {}
 
 int Game::run(Vec2i window_size) {
 
@@ -23,42 +23,62 @@ int Game::run(Vec2i window_size) {
   sf::Time dt_time;
   float dt = 1.0f / 60.0f;
   while (window_->isOpen()) {
-    sf::Event event;
-    while (window_->pollEvent(event)) {
-      ImGui::SFML::ProcessEvent(event);
-      if (event.type == sf::Event::KeyPressed) {
-        current_state_->handleKey(dt, event.key, true);
-      }
-      if (event.type == sf::Event::KeyReleased) {
-        current_state_->handleKey(dt, event.key, false);
-      }
-      if (event.type == sf::Event::MouseMoved) {
-        current_state_->handleMouseMoved(dt, event.mouseMove);
-      }
-      if (event.type == sf::Event::MouseButtonPressed) {
-        current_state_->handleMouseButton(dt, event.mouseButton, MouseButtonState::Pressed);
-      }
-      if (event.type == sf::Event::MouseButtonReleased) {
-        current_state_->handleMouseButton(dt, event.mouseButton, MouseButtonState::Released);
-      }
-      if (event.type == sf::Event::MouseWheelScrolled) {
-        current_state_->handleMouseScroll(dt, event.mouseWheelScroll);
-      }
-      if (event.type == sf::Event::Closed) {
-        window_->close();
+    PROFILE_FRAME();
+    MEMORY_FRAME();
+    PROFILE_SCOPE("Frame");
+
+    // Events.
+    {
+      PROFILE_SCOPE("Events");
+      sf::Event event;
+      while (window_->pollEvent(event)) {
+        ImGui::SFML::ProcessEvent(event);
+        if (event.type == sf::Event::KeyPressed) {
+          current_state_->handleKey(dt, event.key, true);
+        }
+        if (event.type == sf::Event::KeyReleased) {
+          current_state_->handleKey(dt, event.key, false);
+        }
+        if (event.type == sf::Event::MouseMoved) {
+          current_state_->handleMouseMoved(dt, event.mouseMove);
+        }
+        if (event.type == sf::Event::MouseButtonPressed) {
+          current_state_->handleMouseButton(dt, event.mouseButton, MouseButtonState::Pressed);
+        }
+        if (event.type == sf::Event::MouseButtonReleased) {
+          current_state_->handleMouseButton(dt, event.mouseButton, MouseButtonState::Released);
+        }
+        if (event.type == sf::Event::MouseWheelScrolled) {
+          current_state_->handleMouseScroll(dt, event.mouseWheelScroll);
+        }
+        if (event.type == sf::Event::Closed) {
+          window_->close();
+        }
       }
+      ImGui::SFML::Update(*window_, dt_time);
     }
-    ImGui::SFML::Update(*window_, dt_time);
 
     // Update.
-    current_state_->tick(dt);
+    {
+      PROFILE_SCOPE("Tick");
+      current_state_->tick(dt);
+    }
 
     // Draw.
-    window_->setView(current_state_->viewport());
-    window_->clear(sf::Color::Black);
-    current_state_->draw(window_.get());
-    ImGui::SFML::Render(*window_);
-    window_->display();
+    {
+      PROFILE_SCOPE("Draw");
+      window_->setView(current_state_->viewport());
+      window_->clear(sf::Color::Black);
+      current_state_->draw(window_.get());
+    }
+    {
+      PROFILE_SCOPE("ImGui");
+      ImGui::SFML::Render(*window_);
+    }
+    {
+      PROFILE_SCOPE("Display");
+      window_->display();
+    }
 
     // Update frame timer.
     dt_time = delta_clock.restart();
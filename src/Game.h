@@ -1,6 +1,7 @@
 #pragma once
 
 #include "GameState.h"
+#include "core/JobSystem.h"
 
 class Game {
 public:
@@ -14,6 +15,10 @@ public:
     return screen_size_;
   }
 
+  JobSystem& jobs() {
+    return *jobs_;
+  }
+
   template <typename S>
   void switchTo() {
     current_state_ = make_unique<S>(this);
@@ -24,6 +29,8 @@ public:
   }
 
 private:
+  UniquePtr<JobSystem> jobs_;
+
   Vec2i screen_size_;
   UniquePtr<sf::RenderWindow> window_;
 
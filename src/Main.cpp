@@ -1,7 +1,48 @@
 #include "Common.h"
 #include "Game.h"
+#include "Benchmark.h"
+#include "Replay.h"
+
+int main(int argc, char** argv) {
+    // Usage: Diplomacy --benchmark [--sites N] [--units N] [--ticks N] [--players N] [--out file.json]
+    if (argc > 1 && String(argv[1]) == "--benchmark") {
+        BenchmarkSettings settings;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            String option = argv[i];
+            if (option == "--sites") {
+                settings.num_sites = std::stoi(argv[i + 1]);
+            } else if (option == "--units") {
+                settings.num_units = std::stoi(argv[i + 1]);
+            } else if (option == "--ticks") {
+                settings.num_ticks = std::stoi(argv[i + 1]);
+            } else if (option == "--players") {
+                settings.num_players = std::stoi(argv[i + 1]);
+            } else if (option == "--out") {
+                settings.output = argv[i + 1];
+            } else {
+                std::cerr << "Unknown benchmark option " << option << std::endl;
+                return 1;
+            }
+        }
+        return runBenchmark(settings);
+    }
+
+    // Usage: Diplomacy --replay file.replay [--out file.json]
+    if (argc > 2 && String(argv[1]) == "--replay") {
+        ReplaySettings settings;
+        settings.input = argv[2];
+        for (int i = 3; i + 1 < argc; i += 2) {
+            String option = argv[i];
+            if (option == "--out") {
+                settings.output = argv[i + 1];
+            } else {
+                std::cerr << "Unknown replay option " << option << std::endl;
+                return 1;
+            }
+        }
+        return runReplay(settings);
+    }
 
-int main() {
     Game game;
     return game.run({1280, 800});
 };
@@ -5,35 +5,70 @@
 //#define DEBUG_GUI
 
 const int BOUNDARY_SIZE = 100;
-
-MainGameState::MainGameState(Game* game) : GameState(game), camera_movement_speed_{0.0f, 0.0f}, show_orders_{false}, interaction_pending_{InteractionMode::Unit} 
+const int MAX_TICKS_PER_FRAME = 4;
+const char* const REPLAY_FILE = "last_match.replay";
+const char* const AUTOSAVE_FILE = "autosave.snapshot";
+const char* const QUICKSAVE_FILE = "quicksave.snapshot";
+const char* const TERRAIN_CACHE_FILE = "map.terrain";
+const u64 AUTOSAVE_INTERVAL_TICKS = u64(60.0f / Simulation::TICK_DT);
+
+MainGameState::MainGameState(Game* game) : GameState(game), camera_movement_speed_{0.0f, 0.0f}, interaction_pending_{InteractionMode::Unit}, dragging_{false}, sim_accumulator_{0.0f}, last_autosave_tick_{0}, local_player_{0}, show_orders_{false}, last_order_accepted_{0}, last_order_size_{0} 
 {
   const int world_size_preset = 1;
   const int num_players = 8;
 
+  SimulationSettings settings;
+  settings.num_players = num_players;
   switch (world_size_preset)
   {
-    case 0: world_ = make_unique<World>(400, Vec2{ 0.0f, 0.0f }, Vec2{ 1800.0f, 1800.0f }); break;
-    case 1: world_ = make_unique<World>(800, Vec2{ 0.0f, 0.0f }, Vec2{ 2400.0f, 2400.0f }); break;
-    case 2: world_ = make_unique<World>(1600, Vec2{ 0.0f, 0.0f }, Vec2{ 4800.0f, 2400.0f }); break;
+    case 0: settings.num_sites = 400; settings.max = Vec2{ 1800.0f, 1800.0f }; break;
+    case 1: settings.num_sites = 800; settings.max = Vec2{ 2400.0f, 2400.0f }; break;
+    case 2: settings.num_sites = 1600; settings.max = Vec2{ 4800.0f, 2400.0f }; break;
+  }
+  sim_ = make_unique<Simulation>(settings, game_->jobs(), TERRAIN_CACHE_FILE);
+
+  // Record the match, so it can be replayed.
+  command_log_ = make_unique<CommandLog>(settings);
+  sim_->setRecorder(command_log_.get());
+
+  // Start each player with a unit in the middle of their state. The label anchor is used rather
+  // than the midpoint, which can be outside of a state with an awkward shape.
+  u32 player_index = 0;
+  for (auto& state_pair : sim_->world().states()) {
+    MEMORY_SCOPE(MemoryTag::Units);
+    sim_->createUnit(player_index++, UnitTypeId::Squad, state_pair.second->labelAnchor());
   }
+  createPlayers();
+
+  // Set up viewport.
+  target_centre_ = {0.0f, 0.0f};
+  viewport_.setCenter({0.0f, 0.0f});
+  target_size_ = game_->screenSize();
+  render_context_.font.loadFromFile("../LiberationSans-Regular.ttf");
+  render_context_.viewer = local_player_;
+  render_context_.world = &sim_->world();
+  render_context_.visibility = &sim_->visibility();
+}
 
-  // Create states and set up players to take ownership of states.
-  world_->fillStates(num_players);
-  auto states = world_->states();
-  for (auto state_pair : states) {
-    // Set up units.
-    Vector<SharedPtr<Unit>> units;
-    units.emplace_back(std::make_shared<Squad>(state_pair.second->midpoint()));
-    units_.insert(units_.end(), units.begin(), units.end());
+MainGameState::~MainGameState() {
+  saveReplay();
+}
+
+void MainGameState::createPlayers() {
+  // Set up players to take ownership of states, and of the units they start with.
+  players_.clear();
+  for (auto& state_pair : sim_->world().states()) {
+    u32 player_index = (u32)players_.size();
+    Vector<UnitId> units;
+    for (UnitId unit = 0; unit < sim_->units().size(); ++unit) {
+      if (sim_->units().owner(unit) == player_index) {
+        units.push_back(unit);
+      }
+    }
 
     // Create player.
     WeakPtr<State> state = state_pair.second;
-    Vector<WeakPtr<Unit>> units_weak;
-    for (auto& ptr : units) {
-      units_weak.push_back(WeakPtr<Unit>(ptr));
-    }
-    players_.emplace_back(std::make_shared<Player>(String("Player ") + std::to_string(state_pair.first), state, units_weak));
+    players_.emplace_back(std::make_shared<Player>(String("Player ") + std::to_string(state_pair.first), state, units));
 
     // Name state.
     //state_pair.second->setName(String("State ") + std::to_string(state_pair.first));
@@ -41,17 +76,47 @@ MainGameState::MainGameState(Game* game) : GameState(game), camera_movement_spee
 
   // Set up local controller.
   local_controller_ = make_unique<LocalController>();
-  local_controller_->possess(players_[0].get());
+  local_controller_->possess(players_[local_player_].get());
+
+  // Set up AI controllers for everyone else.
+  ai_ = make_unique<AIScheduler>(game_->jobs());
+  for (u32 player = 0; player < players_.size(); ++player) {
+    if (player != local_player_) {
+      auto controller = make_unique<AIController>(player, sim_->world().map());
+      controller->possess(players_[player].get());
+      ai_->add(std::move(controller));
+    }
+  }
+}
 
-  // Set up viewport.
-  target_centre_ = {0.0f, 0.0f};
-  viewport_.setCenter({0.0f, 0.0f});
-  target_size_ = game_->screenSize();
-  render_context_.font.loadFromFile("../LiberationSans-Regular.ttf");
-  render_context_.world = world_.get();
+void MainGameState::saveReplay() {
+  if (!command_log_) {
+    return;
+  }
+  // End with a checksum, so that replays can check they reached the same state.
+  command_log_->record(sim_->tickCount(), Command::checksumOf(sim_->checksum()));
+  command_log_->save(REPLAY_FILE);
 }
 
-MainGameState::~MainGameState() {
+void MainGameState::loadGame(const String& path) {
+  auto sim = loadSnapshot(path, game_->jobs(), TERRAIN_CACHE_FILE);
+  if (!sim) {
+    return;
+  }
+
+  // Replays start from a new game, so recording stops here.
+  saveReplay();
+  command_log_.reset();
+  snapshot_writer_.wait();
+  ai_.reset();
+
+  sim_ = std::move(sim);
+  sim_accumulator_ = 0.0f;
+  interaction_state_ = InteractionState{};
+  interaction_pending_ = InteractionState{InteractionMode::Unit};
+  createPlayers();
+  render_context_.world = &sim_->world();
+  render_context_.visibility = &sim_->visibility();
 }
 
 void MainGameState::tick(float dt) {
@@ -62,27 +127,44 @@ void MainGameState::tick(float dt) {
   Vec2 current_size = fromSFML(viewport_.getSize());
   viewport_.setSize(toSFML(damp(current_size, target_size_, 0.4f, 0.1f, dt)));
 
-  // Update units.
-  for (auto& unit : units_) {
-    unit->tick(dt);
+  // Step the simulation in fixed ticks, so that it plays out the same on every machine. Drop time
+  // rather than fall further behind if a frame was very long.
+  sim_accumulator_ = std::min(sim_accumulator_ + dt, MAX_TICKS_PER_FRAME * Simulation::TICK_DT);
+  while (sim_accumulator_ >= Simulation::TICK_DT) {
+    ai_->tick(*sim_);
+    sim_->tick();
+    sim_accumulator_ -= Simulation::TICK_DT;
+
+    // Autosave in the background. If the last save is somehow still going, try again next tick.
+    if (sim_->tickCount() >= last_autosave_tick_ + AUTOSAVE_INTERVAL_TICKS &&
+        snapshot_writer_.save(*sim_, AUTOSAVE_FILE)) {
+      last_autosave_tick_ = sim_->tickCount();
+    }
   }
 }
 
 void MainGameState::draw(sf::RenderWindow* window) {
+  MEMORY_SCOPE(MemoryTag::Render);
 	render_context_.window = window;
+  Vec2 view_centre = fromSFML(viewport_.getCenter());
+  Vec2 view_size = fromSFML(viewport_.getSize());
+  render_context_.view_min = view_centre - view_size * 0.5f;
+  render_context_.view_max = view_centre + view_size * 0.5f;
+  render_context_.pixels_per_unit = game_->screenSize().x / view_size.x;
 
   // Draw world.
-  world_->draw(render_context_);
+  sim_->world().draw(render_context_);
 
   // Print interaction state.
   ImGui::SetNextWindowPos(ImVec2(0, 0));
   ImGui::SetNextWindowSize(ImVec2(400, 150));
   ImGui::Begin("Interaction State");
+  ImGui::Text("Tick: %llu (checksum %016llx)", (unsigned long long)sim_->tickCount(), (unsigned long long)sim_->checksum());
   ImGui::Text("Pending Mode: %d", (int)interaction_pending_.mode);
   switch (interaction_pending_.mode)
   {
   case InteractionMode::Unit:
-	  ImGui::Text("- Selected unit: %p", interaction_pending_.selected_unit);
+	  ImGui::Text("- Selected units: %d", (int)interaction_pending_.selected_units.size());
 	  break;
   case InteractionMode::Site:
 	  ImGui::Text("- Selected tile: %p", interaction_pending_.selected_site);
@@ -95,7 +177,10 @@ void MainGameState::draw(sf::RenderWindow* window) {
   switch (interaction_state_.mode)
   {
   case InteractionMode::Unit:
-	  ImGui::Text("- Selected unit: %p", interaction_state_.selected_unit);
+	  ImGui::Text("- Selected units: %d", (int)interaction_state_.selected_units.size());
+	  if (last_order_accepted_ < last_order_size_) {
+		  ImGui::Text("- Last order accepted by %d of %d units", (int)last_order_accepted_, (int)last_order_size_);
+	  }
 	  break;
   case InteractionMode::Site:
 	  ImGui::Text("- Selected tile: %p", interaction_state_.selected_site);
@@ -106,6 +191,13 @@ void MainGameState::draw(sf::RenderWindow* window) {
   }
   ImGui::End();
 
+#ifdef DIPLOMACY_PROFILER
+  Profiler::get().drawOverlay({400.0f, 0.0f}, {600.0f, 250.0f});
+#endif
+#ifdef DIPLOMACY_MEMORY_TRACKING
+  MemoryTracker::get().drawOverlay({0.0f, 150.0f}, {400.0f, 250.0f});
+#endif
+
   // Highlight based on pending state.
   switch (interaction_pending_.mode) {
     case InteractionMode::Unit:
@@ -121,8 +213,8 @@ void MainGameState::draw(sf::RenderWindow* window) {
 			selected_color = site.owning_state->colour();
 			selected_color.a = 120;
 		}
-        world_->drawTile(render_context_, site, selected_color);
-		world_->drawBorder(render_context_, Map::unorderedBoundaries({&site}), selected_edge_color);
+        sim_->world().drawTile(render_context_, site, selected_color);
+		sim_->world().drawBorder(render_context_, Map::unorderedBoundaries({&site}), selected_edge_color);
 
 #ifdef DEBUG_GUI
         ImGui::SetNextWindowPos(ImVec2(0, 250));
@@ -175,8 +267,8 @@ void MainGameState::draw(sf::RenderWindow* window) {
 
 		  sf::Color selected_color(20, 50, 120, 180);
 		  sf::Color selected_edge_color(20, 50, 120, 200);
-		  world_->drawTile(render_context_, site, selected_color);
-		  world_->drawTileEdge(render_context_, site, selected_edge_color);
+		  sim_->world().drawTile(render_context_, site, selected_color);
+		  sim_->world().drawTileEdge(render_context_, site, selected_edge_color);
 
 #ifdef DEBUG_GUI
 		  ImGui::SetNextWindowPos(ImVec2(0, 250));
@@ -221,15 +313,12 @@ void MainGameState::draw(sf::RenderWindow* window) {
   }
 
   // Draw units.
-  for (auto& unit : units_) {
-    unit->draw(render_context_);
-  }
+  sim_->units().draw(render_context_);
+  drawSelection();
 
   // Draw overlays.
   if (show_orders_) {
-    for (auto& unit : units_) {
-      unit->drawOrderOverlay(render_context_);
-    }
+    sim_->units().drawOrderOverlay(render_context_);
   }
 }
 
@@ -239,7 +328,15 @@ void MainGameState::handleKey(float dt, sf::Event::KeyEvent& e, bool pressed) {
   }
   if (pressed)
   {
-	  if (e.code == sf::Keyboard::LControl || e.code == sf::Keyboard::RControl)
+	  if (e.code == sf::Keyboard::F5)
+	  {
+		  snapshot_writer_.save(*sim_, QUICKSAVE_FILE);
+	  }
+	  else if (e.code == sf::Keyboard::F9)
+	  {
+		  loadGame(QUICKSAVE_FILE);
+	  }
+	  else if (e.code == sf::Keyboard::LControl || e.code == sf::Keyboard::RControl)
 	  {
 		  interaction_pending_ = InteractionState{InteractionMode::Site};
 	  }
@@ -264,7 +361,7 @@ void MainGameState::handleMouseMoved(float dt, sf::Event::MouseMoveEvent &e) {
   auto find_nearest_site = [&]() -> Map::Site* {
     float nearest_distance_sq = std::numeric_limits<float>::infinity();
     Map::Site* nearest_site = nullptr;
-    for (auto &site : world_->mapSites()) {
+    for (auto &site : sim_->world().mapSites()) {
       float distance = glm::distance2(proj_mouse_position, site.centre);
       if (distance < nearest_distance_sq) {
         nearest_distance_sq = distance;
@@ -326,20 +423,85 @@ void MainGameState::handleMouseMoved(float dt, sf::Event::MouseMoveEvent &e) {
 
 void MainGameState::handleMouseButton(float dt, sf::Event::MouseButtonEvent &e, MouseButtonState state) {
   if (state == MouseButtonState::Pressed) {
-    // Save pending interaction.
+    // Save pending interaction. Units are selected once the mouse is released, in case this is a drag.
     if (e.button == sf::Mouse::Left) {
-      interaction_state_ = interaction_pending_;
+      if (interaction_pending_.mode == InteractionMode::Unit) {
+        dragging_ = true;
+        drag_start_ = game_->mapScreenToWorld({e.x, e.y});
+      } else {
+        interaction_state_ = interaction_pending_;
+      }
     } else if (e.button == sf::Mouse::Right) {
       // Do action.
       switch (interaction_state_.mode) {
         case InteractionMode::Unit: {
-          interaction_state_.selected_unit->addOrder(
-              make_unique<MoveOrder>(game_->mapScreenToWorld(last_mouse_position_)),
-              show_orders_);
+          if (!interaction_state_.selected_units.empty()) {
+            last_order_size_ = (u32)interaction_state_.selected_units.size();
+            last_order_accepted_ = sim_->orderUnits(local_player_, interaction_state_.selected_units,
+                Order::moveTo(game_->mapScreenToWorld(last_mouse_position_)),
+                show_orders_);
+          }
         } break;
       }
     }
+  } else if (state == MouseButtonState::Released) {
+    if (e.button == sf::Mouse::Left && dragging_) {
+      dragging_ = false;
+      selectUnits(drag_start_, game_->mapScreenToWorld({e.x, e.y}));
+    }
+  }
+}
+
+void MainGameState::selectUnits(const Vec2& start, const Vec2& end) {
+  const float min_drag_size = 4.0f;
+  InteractionState selection{InteractionMode::Unit};
+
+  // Convert the drag threshold from pixels to world units.
+  float world_per_pixel = viewport_.getSize().x / float(game_->screenSize().x);
+  Vec2 min = glm::min(start, end), max = glm::max(start, end);
+  if (std::max(max.x - min.x, max.y - min.y) < min_drag_size * world_per_pixel) {
+    // Click: pick the unit under the cursor.
+    UnitId unit = sim_->units().pick(end);
+    if (unit != INVALID_UNIT && sim_->units().owner(unit) == local_player_) {
+      selection.selected_units.push_back(unit);
+    }
+  } else {
+    // Drag: select every unit of ours inside the box.
+    sim_->units().queryRect(min, max, selection.selected_units);
+    auto& selected = selection.selected_units;
+    selected.erase(std::remove_if(selected.begin(), selected.end(),
+                                  [this](UnitId unit) { return sim_->units().owner(unit) != local_player_; }),
+                   selected.end());
+  }
+  interaction_state_ = selection;
+}
+
+void MainGameState::drawSelection() {
+  const sf::Color selection_colour{120, 255, 120, 220};
+  const float selection_radius = 8.0f;
+  const int selection_segments = 8;
+  Vector<sf::Vertex> vertices;
+  if (interaction_state_.mode == InteractionMode::Unit) {
+    for (UnitId unit : interaction_state_.selected_units) {
+      Vec2 centre = sim_->units().position(unit);
+      for (int s = 0; s < selection_segments; ++s) {
+        float a0 = 2.0f * PI * float(s) / selection_segments;
+        float a1 = 2.0f * PI * float(s + 1) / selection_segments;
+        vertices.emplace_back(toSFML(centre + Vec2{cos(a0), sin(a0)} * selection_radius), selection_colour);
+        vertices.emplace_back(toSFML(centre + Vec2{cos(a1), sin(a1)} * selection_radius), selection_colour);
+      }
+    }
+  }
+  if (dragging_) {
+    Vec2 a = drag_start_;
+    Vec2 b = game_->mapScreenToWorld(last_mouse_position_);
+    Vec2 corners[4] = {a, Vec2{b.x, a.y}, b, Vec2{a.x, b.y}};
+    for (int c = 0; c < 4; ++c) {
+      vertices.emplace_back(toSFML(corners[c]), selection_colour);
+      vertices.emplace_back(toSFML(corners[(c + 1) % 4]), selection_colour);
+    }
   }
+  render_context_.window->draw(vertices.data(), vertices.size(), sf::Lines);
 }
 
 void MainGameState::handleMouseScroll(float dt, sf::Event::MouseWheelScrollEvent &e) {
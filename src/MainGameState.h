@@ -3,10 +3,11 @@
 #include "GameState.h"
 
 #include "world/Map.h"
-#include "world/World.h"
 #include "player/Player.h"
-#include "gameplay/Squad.h"
+#include "gameplay/Simulation.h"
+#include "gameplay/Snapshot.h"
 #include "player/LocalController.h"
+#include "player/AIController.h"
 
 enum class InteractionMode {
   None,
@@ -17,10 +18,10 @@ enum class InteractionMode {
 
 struct InteractionState {
   InteractionState() : InteractionState(InteractionMode::None) {}
-  InteractionState(InteractionMode mode) : mode{mode}, selected_unit{nullptr}, selected_site{nullptr}, selected_state{nullptr} {}
+  InteractionState(InteractionMode mode) : mode{mode}, selected_site{nullptr}, selected_state{nullptr} {}
 
   InteractionMode mode;
-  Unit* selected_unit; // Used by InteractionMode::Unit
+  Vector<UnitId> selected_units; // Used by InteractionMode::Unit
   Map::Site* selected_site; // Used by InteractionMode::Site
   State* selected_state; // Used by InteractionMode::State
 };
@@ -40,6 +41,12 @@ public:
   void handleMouseScroll(float dt, sf::Event::MouseWheelScrollEvent& e) override;
 
 private:
+  void createPlayers();
+  void saveReplay();
+  void loadGame(const String& path);
+  void selectUnits(const Vec2& start, const Vec2& end);
+  void drawSelection();
+
   Vec2i last_mouse_position_;
   Vec2 camera_movement_speed_;
 
@@ -48,20 +55,36 @@ private:
 
   // Interaction.
   InteractionState interaction_state_, interaction_pending_;
+  bool dragging_;
+  Vec2 drag_start_;
 
   // Render state.
   RenderContext render_context_;
 
-  // World.
-  UniquePtr<World> world_;
+  // Simulation.
+  UniquePtr<Simulation> sim_;
+  float sim_accumulator_;
+  UniquePtr<CommandLog> command_log_;
+
+  // Saving.
+  SnapshotWriter snapshot_writer_;
+  u64 last_autosave_tick_;
 
   // Players.
   Vector<SharedPtr<Player>> players_;
 
   // Local controller.
   UniquePtr<LocalController> local_controller_;
+  u32 local_player_;
+
+  // Every other player is controlled by the AI. Declared after the simulation, so the AI stops
+  // thinking before the simulation is destroyed.
+  UniquePtr<AIScheduler> ai_;
 
   // Units.
-  Vector<SharedPtr<Unit>> units_;
   bool show_orders_;
+
+  // How many of the selected units accepted the last order, so a full order queue is visible.
+  u32 last_order_accepted_;
+  u32 last_order_size_;
 };
\ No newline at end of file
@@ -1,10 +1,21 @@
 #pragma once
 
 class World;
+class Visibility;
 
 struct RenderContext
 {
 	sf::RenderWindow* window;
 	World* world;
 	sf::Font font;
+
+	// What 'viewer' can see. Everything is drawn if null.
+	const Visibility* visibility = nullptr;
+	u32 viewer = 0;
+
+	// The area of the world in view, and how many pixels a unit of world space covers. Extra
+	// detail is only drawn when the scale is known.
+	Vec2 view_min{0.0f, 0.0f};
+	Vec2 view_max{0.0f, 0.0f};
+	float pixels_per_unit = 0.0f;
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "Common.h"
+#include "Replay.h"
+#include "gameplay/CommandLog.h"
+#include "gameplay/Simulation.h"
+#include "core/JobSystem.h"
+
+#include <fstream>
+
+int runReplay(const ReplaySettings& settings) {
+    CommandLog log;
+    if (!log.load(settings.input)) {
+        return 1;
+    }
+    std::cout << "Replay: " << settings.input << " has " << log.lastTick() << " ticks in " << log.sizeBytes()
+              << " bytes" << std::endl;
+
+    JobSystem jobs;
+    auto setup_start = std::chrono::steady_clock::now();
+    Simulation sim{log.settings(), jobs};
+    double setup_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - setup_start).count();
+
+    // Each record is applied at the start of its tick. Checksums were recorded at the start of the
+    // tick too, before any commands.
+    auto replay_start = std::chrono::steady_clock::now();
+    CommandLog::Reader reader{log};
+    u64 tick;
+    Command command;
+    u64 commands = 0, checksums = 0, desync_tick = 0;
+    bool desynced = false;
+    while (reader.next(tick, command)) {
+        while (sim.tickCount() < tick) {
+            PROFILE_FRAME();
+            sim.tick();
+        }
+        if (command.type == CommandType::Checksum) {
+            checksums++;
+            if (!desynced && command.checksum != sim.checksum()) {
+                desynced = true;
+                desync_tick = tick;
+                std::cerr << "Replay: Desync at tick " << tick << std::endl;
+            }
+        } else {
+            commands++;
+            sim.apply(command);
+        }
+    }
+    double replay_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replay_start).count();
+    std::cout << "Replay: " << sim.tickCount() << " ticks took " << replay_ms << " ms ("
+              << sim.tickCount() * Simulation::TICK_DT * 1000.0 / std::max(replay_ms, 1e-3) << "x real time)"
+              << std::endl;
+
+    std::ofstream out{settings.output};
+    if (!out) {
+        std::cerr << "Replay: Unable to open " << settings.output << " for writing." << std::endl;
+        return 1;
+    }
+    out << "{\"input\":\"" << settings.input << "\""
+        << ",\"workers\":" << jobs.workerCount()
+        << ",\"ticks\":" << sim.tickCount()
+        << ",\"commands\":" << commands
+        << ",\"checksums\":" << checksums
+        << ",\"desynced\":" << (desynced ? "true" : "false")
+        << ",\"desync_tick\":" << desync_tick
+        << ",\"final_checksum\":" << sim.checksum()
+        << ",\"timings_ms\":{\"setup\":" << setup_ms << ",\"replay\":" << replay_ms << "}"
+        << ",\"tick_average_ms\":" << (sim.tickCount() > 0 ? replay_ms / sim.tickCount() : 0.0)
+        << "}\n";
+    std::cout << "Replay: Wrote results to " << settings.output << std::endl;
+
+#ifdef DIPLOMACY_PROFILER
+    Profiler::get().writeChromeTrace(settings.output + ".trace.json");
+#endif
+    return desynced ? 2 : 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Headless replay. Loads a command log recorded from a match, and replays it into a new
+// simulation as fast as possible without rendering, checking the recorded checksums as it goes.
+// Writes the timings and the final checksum to a JSON file, so recorded matches double as
+// benchmarks and as regression tests.
+struct ReplaySettings {
+    ReplaySettings() : output{"replay.json"} {}
+
+    String input;
+    String output;
+};
+
+// Returns non-zero if the log couldn't be loaded, or if the replay desynced from the recording.
+int runReplay(const ReplaySettings& settings);
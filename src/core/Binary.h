@@ -0,0 +1,157 @@
+#pragma once
+
+// Little endian binary encoding, for files shared between machines (command logs and snapshots).
+//
+// Arrays of plain values are copied as they are laid out in memory, so they load with a single
+// copy into a sized vector. That makes files portable only between little endian machines, which
+// covers every platform we build for.
+class BinaryWriter {
+public:
+    explicit BinaryWriter(Vector<u8>& out) : out_(out) {}
+
+    void writeU8(u8 value) {
+        out_.push_back(value);
+    }
+
+    void writeU32(u32 value) {
+        for (int i = 0; i < 4; ++i) {
+            out_.push_back(u8(value >> (i * 8)));
+        }
+    }
+
+    void writeU64(u64 value) {
+        for (int i = 0; i < 8; ++i) {
+            out_.push_back(u8(value >> (i * 8)));
+        }
+    }
+
+    void writeFloat(float value) {
+        writeU32((u32)hashFloat(value));
+    }
+
+    // 7 bits per byte, smallest first, with the top bit set on every byte but the last.
+    void writeVarint(u64 value) {
+        while (value >= 0x80) {
+            out_.push_back(u8(value | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(u8(value));
+    }
+
+    void writeBytes(const void* data, size_t size) {
+        auto bytes = static_cast<const u8*>(data);
+        out_.insert(out_.end(), bytes, bytes + size);
+    }
+
+    // The element count is not written.
+    template <typename T>
+    void writeArray(const Vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written as arrays");
+        writeBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    Vector<u8>& bytes() {
+        return out_;
+    }
+
+private:
+    Vector<u8>& out_;
+};
+
+// Reads return false, rather than run past the end of the data.
+class BinaryReader {
+public:
+    BinaryReader(const u8* data, size_t size) : data_{data}, size_{size}, offset_{0} {}
+    explicit BinaryReader(const Vector<u8>& data) : BinaryReader(data.data(), data.size()) {}
+
+    bool readU8(u8& value) {
+        if (remaining() < 1) {
+            return false;
+        }
+        value = data_[offset_++];
+        return true;
+    }
+
+    bool readU32(u32& value) {
+        if (remaining() < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= u32(data_[offset_++]) << (i * 8);
+        }
+        return true;
+    }
+
+    bool readU64(u64& value) {
+        if (remaining() < 8) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= u64(data_[offset_++]) << (i * 8);
+        }
+        return true;
+    }
+
+    bool readFloat(float& value) {
+        u32 bits;
+        if (!readU32(bits)) {
+            return false;
+        }
+        std::memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    bool readVarint(u64& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            u8 byte;
+            if (!readU8(byte)) {
+                return false;
+            }
+            value |= u64(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readBytes(void* data, size_t size) {
+        if (remaining() < size) {
+            return false;
+        }
+        std::memcpy(data, data_ + offset_, size);
+        offset_ += size;
+        return true;
+    }
+
+    // Resizes 'values' to 'count' and fills it with one copy.
+    template <typename T>
+    bool readArray(Vector<T>& values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be read as arrays");
+        if (remaining() / sizeof(T) < count) {
+            return false;
+        }
+        values.resize(count);
+        return readBytes(values.data(), count * sizeof(T));
+    }
+
+    size_t offset() const {
+        return offset_;
+    }
+
+    size_t remaining() const {
+        return size_ - offset_;
+    }
+
+    bool atEnd() const {
+        return offset_ == size_;
+    }
+
+private:
+    const u8* data_;
+    size_t size_;
+    size_t offset_;
+};
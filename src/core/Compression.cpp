@@ -0,0 +1,145 @@
+#include "Common.h"
+#include "core/Compression.h"
+
+namespace {
+const u32 MIN_MATCH = 4;
+const u32 MAX_OFFSET = 65535;
+
+// The format requires the last match to start at least MATCH_LIMIT bytes before the end of the
+// input, and the last LAST_LITERALS bytes to be literals.
+const size_t MATCH_LIMIT = 12;
+const size_t LAST_LITERALS = 5;
+
+const u32 HASH_BITS = 16;
+
+u32 read32(const u8* p) {
+    u32 value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+u32 hash32(u32 value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths which don't fit in a token nibble continue in bytes of 255, ending with a smaller one.
+void writeLength(Vector<u8>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(u8(length));
+}
+
+void writeSequence(Vector<u8>& out, const u8* literals, size_t literal_length, u32 offset, size_t match_length) {
+    size_t match_code = match_length - MIN_MATCH;
+    u8 token = u8(std::min<size_t>(literal_length, 15) << 4);
+    if (offset > 0) {
+        token |= u8(std::min<size_t>(match_code, 15));
+    }
+    out.push_back(token);
+    if (literal_length >= 15) {
+        writeLength(out, literal_length - 15);
+    }
+    out.insert(out.end(), literals, literals + literal_length);
+    if (offset > 0) {
+        out.push_back(u8(offset));
+        out.push_back(u8(offset >> 8));
+        if (match_code >= 15) {
+            writeLength(out, match_code - 15);
+        }
+    }
+}
+
+bool readLength(const u8*& in, const u8* in_end, size_t& length) {
+    u8 byte;
+    do {
+        if (in == in_end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+}
+
+void compressLZ4(const u8* data, size_t size, Vector<u8>& out) {
+    PROFILE_SCOPE("compressLZ4");
+    out.reserve(out.size() + size / 2 + 16);
+    size_t anchor = 0;
+    if (size > MATCH_LIMIT) {
+        // Positions of recent 4 byte sequences, by hash. Stale and colliding entries are caught
+        // by comparing the bytes.
+        Vector<u32> table(size_t(1) << HASH_BITS, 0);
+        size_t limit = size - MATCH_LIMIT;
+        size_t position = 1;
+        while (position < limit) {
+            u32 sequence = read32(data + position);
+            u32& entry = table[hash32(sequence)];
+            size_t candidate = entry;
+            entry = (u32)position;
+            if (position - candidate > MAX_OFFSET || read32(data + candidate) != sequence) {
+                // Skip ahead faster through data which doesn't compress.
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            size_t match_length = MIN_MATCH;
+            while (position + match_length < size - LAST_LITERALS &&
+                   data[candidate + match_length] == data[position + match_length]) {
+                match_length++;
+            }
+            writeSequence(out, data + anchor, position - anchor, u32(position - candidate), match_length);
+            position += match_length;
+            anchor = position;
+        }
+    }
+    writeSequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+bool decompressLZ4(const u8* data, size_t size, u8* out, size_t out_size) {
+    PROFILE_SCOPE("decompressLZ4");
+    const u8* in = data;
+    const u8* in_end = data + size;
+    u8* op = out;
+    u8* out_end = out + out_size;
+    while (in < in_end) {
+        u8 token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !readLength(in, in_end, literal_length)) {
+            return false;
+        }
+        if (size_t(in_end - in) < literal_length || size_t(out_end - op) < literal_length) {
+            return false;
+        }
+        std::memcpy(op, in, literal_length);
+        in += literal_length;
+        op += literal_length;
+
+        // The last sequence has no match.
+        if (in == in_end) {
+            break;
+        }
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+        in += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !readLength(in, in_end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || size_t(op - out) < offset || size_t(out_end - op) < match_length) {
+            return false;
+        }
+        // Matches may overlap their own output, so copy forwards a byte at a time.
+        const u8* match = op - offset;
+        for (size_t i = 0; i < match_length; ++i) {
+            op[i] = match[i];
+        }
+        op += match_length;
+    }
+    return op == out_end;
+}
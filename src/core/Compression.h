@@ -0,0 +1,13 @@
+#pragma once
+
+// Fast lossless compression in the LZ4 block format: a sequence of literal runs, each followed by
+// a copy of earlier output. Trades ratio for speed, so saving and loading snapshots stays bound
+// by copying rather than by compression.
+
+// Compress 'size' bytes of 'data', appending the result to 'out'. The decompressed size is not
+// stored, and must be kept alongside.
+void compressLZ4(const u8* data, size_t size, Vector<u8>& out);
+
+// Decompress into exactly 'out_size' bytes at 'out'. Returns false if the data is malformed, or
+// doesn't decompress to exactly 'out_size' bytes.
+bool decompressLZ4(const u8* data, size_t size, u8* out, size_t out_size);
@@ -0,0 +1,141 @@
+#include "Common.h"
+#include "core/JobSystem.h"
+
+namespace {
+// Index of the worker running on this thread, or -1 for threads outside of any job system.
+thread_local int tls_worker_index = -1;
+}
+
+JobSystem::JobSystem(u32 worker_count) : queued_jobs_{0}, running_{true} {
+    if (worker_count == 0) {
+        worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (u32 i = 0; i < worker_count; ++i) {
+        queues_.emplace_back(make_unique<WorkerQueue>());
+    }
+
+    // The owning thread is worker 0. Spawn the rest.
+    tls_worker_index = 0;
+    for (u32 i = 1; i < worker_count; ++i) {
+        threads_.emplace_back(&JobSystem::workerMain, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock{sleep_mutex_};
+        running_ = false;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void JobSystem::run(JobCounter& counter, JobFunction function, void* data, u32 begin, u32 end) {
+    push(*queues_[currentWorker()], {function, data, begin, end, &counter});
+}
+
+void JobSystem::runBackground(JobCounter& counter, JobFunction function, void* data, u32 begin, u32 end) {
+    push(background_queue_, {function, data, begin, end, &counter});
+}
+
+void JobSystem::push(WorkerQueue& queue, const Job& job) {
+    job.counter->pending_.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.jobs.push_back(job);
+    }
+    queued_jobs_.fetch_add(1, std::memory_order_release);
+
+    // Synchronise with a worker which may be between checking for jobs and going to sleep, so the
+    // notification isn't lost.
+    { std::lock_guard<std::mutex> lock{sleep_mutex_}; }
+    wake_.notify_one();
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    PROFILE_SCOPE("JobSystem::wait");
+    u32 index = currentWorker();
+    while (!counter.done()) {
+        if (!runNextJob(index)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::workerMain(u32 index) {
+    tls_worker_index = (int)index;
+    PROFILE_THREAD_NAME("Worker " + std::to_string(index));
+    while (running_.load(std::memory_order_acquire)) {
+        if (runNextJob(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{sleep_mutex_};
+        wake_.wait(lock, [this]() {
+            return queued_jobs_.load(std::memory_order_acquire) > 0 || !running_.load(std::memory_order_acquire);
+        });
+    }
+}
+
+bool JobSystem::runNextJob(u32 index) {
+    Job job;
+    if (popJob(index, job) || stealJob(index, job) || popBackgroundJob(index, job)) {
+        queued_jobs_.fetch_sub(1, std::memory_order_relaxed);
+        execute(job);
+        return true;
+    }
+    return false;
+}
+
+bool JobSystem::popJob(u32 index, Job& job) {
+    // Newest first, as its data is most likely to still be in cache.
+    WorkerQueue& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.jobs.empty()) {
+        return false;
+    }
+    job = queue.jobs.back();
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool JobSystem::stealJob(u32 thief, Job& job) {
+    // Oldest first, as older jobs tend to be larger.
+    u32 count = workerCount();
+    for (u32 offset = 1; offset < count; ++offset) {
+        WorkerQueue& queue = *queues_[(thief + offset) % count];
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        if (!queue.jobs.empty()) {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JobSystem::popBackgroundJob(u32 index, Job& job) {
+    // Only once there is nothing else to do, and never on the owning thread.
+    if (index == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock{background_queue_.mutex};
+    if (background_queue_.jobs.empty()) {
+        return false;
+    }
+    job = background_queue_.jobs.front();
+    background_queue_.jobs.pop_front();
+    return true;
+}
+
+void JobSystem::execute(const Job& job) {
+    job.function(job.data, job.begin, job.end);
+    job.counter->pending_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+u32 JobSystem::currentWorker() const {
+    // Threads which aren't workers (for example, a thread owned by another job system) share the
+    // owning thread's queue.
+    return tls_worker_index >= 0 && (u32)tls_worker_index < workerCount() ? (u32)tls_worker_index : 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+// Tracks a group of jobs. Pass the same counter to JobSystem::run for each job in the group, then
+// JobSystem::wait on it to join.
+class JobCounter {
+public:
+    JobCounter() : pending_{0} {}
+
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    bool done() const {
+        return pending_.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    std::atomic<u32> pending_;
+
+    friend class JobSystem;
+};
+
+// A work-stealing scheduler. Each worker thread owns a deque of jobs: it pushes and pops at the
+// back, while idle workers steal from the front of other workers' deques. The thread which created
+// the job system is worker 0, and runs jobs whenever it waits on a counter. Background jobs sit in
+// a separate queue which only the other workers take from, so worker 0 never picks one up.
+class JobSystem {
+public:
+    using JobFunction = void (*)(void* data, u32 begin, u32 end);
+
+    // A worker_count of 0 uses one worker per hardware thread.
+    explicit JobSystem(u32 worker_count = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Number of threads which execute jobs, including the owning thread.
+    u32 workerCount() const {
+        return (u32)queues_.size();
+    }
+
+    // Queue 'function(data, begin, end)' to be run on any worker. 'data' must stay alive until the
+    // counter has been waited on.
+    void run(JobCounter& counter, JobFunction function, void* data, u32 begin = 0, u32 end = 0);
+
+    // Queue 'function(data, begin, end)' to be run on any worker except worker 0, for long-running
+    // work which must never hold up the owning thread while it waits on other jobs. Requires more
+    // than one worker.
+    void runBackground(JobCounter& counter, JobFunction function, void* data, u32 begin = 0, u32 end = 0);
+
+    // Block until every job added with 'counter' has finished. Executes queued jobs while waiting.
+    void wait(JobCounter& counter);
+
+    // Call 'fn(chunk_begin, chunk_end)' for chunks of at most 'grain' elements covering
+    // [begin, end), in parallel, and wait for all of them to finish.
+    template <typename F>
+    void parallelFor(u32 begin, u32 end, u32 grain, const F& fn) {
+        if (end <= begin) {
+            return;
+        }
+        grain = std::max(grain, 1u);
+        if (end - begin <= grain) {
+            fn(begin, end);
+            return;
+        }
+        JobCounter counter;
+        for (u32 chunk = begin; chunk < end; chunk += grain) {
+            run(counter, &invokeRange<F>, const_cast<F*>(&fn), chunk, std::min(end, chunk + grain));
+        }
+        wait(counter);
+    }
+
+    // Run 'a' and 'b' in parallel and wait for both to finish.
+    template <typename A, typename B>
+    void forkJoin(const A& a, const B& b) {
+        JobCounter counter;
+        run(counter, &invokeTask<B>, const_cast<B*>(&b));
+        a();
+        wait(counter);
+    }
+
+private:
+    struct Job {
+        JobFunction function;
+        void* data;
+        u32 begin;
+        u32 end;
+        JobCounter* counter;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    Vector<UniquePtr<WorkerQueue>> queues_;
+    WorkerQueue background_queue_;
+    Vector<std::thread> threads_;
+
+    // Used to put idle workers to sleep.
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<u32> queued_jobs_;
+    std::atomic<bool> running_;
+
+    void workerMain(u32 index);
+    bool runNextJob(u32 index);
+    bool popJob(u32 index, Job& job);
+    bool stealJob(u32 thief, Job& job);
+    bool popBackgroundJob(u32 index, Job& job);
+    void push(WorkerQueue& queue, const Job& job);
+    void execute(const Job& job);
+    u32 currentWorker() const;
+
+    template <typename F>
+    static void invokeRange(void* data, u32 begin, u32 end) {
+        (*static_cast<const F*>(data))(begin, end);
+    }
+
+    template <typename F>
+    static void invokeTask(void* data, u32, u32) {
+        (*static_cast<const F*>(data))();
+    }
+};
@@ -0,0 +1,247 @@
+#include "Common.h"
+#include "core/MemoryTracker.h"
+
+#include <cstdlib>
+#include <new>
+
+const char* memoryTagName(MemoryTag tag) {
+    switch (tag) {
+        case MemoryTag::Untagged: return "Untagged";
+        case MemoryTag::Map: return "Map";
+        case MemoryTag::World: return "World";
+        case MemoryTag::States: return "States";
+        case MemoryTag::Units: return "Units";
+        case MemoryTag::Orders: return "Orders";
+        case MemoryTag::Navigation: return "Navigation";
+        case MemoryTag::Render: return "Render";
+        default: return "Unknown";
+    }
+}
+
+#ifdef DIPLOMACY_MEMORY_TRACKING
+
+namespace {
+thread_local MemorySite* tls_site = nullptr;
+
+// Prepended to every allocation. Keeps the returned pointer 16-byte aligned.
+struct alignas(16) AllocationHeader {
+    u64 size;
+    u32 site;
+    u32 padding;
+};
+static_assert(sizeof(AllocationHeader) == 16, "Allocation header must preserve malloc alignment");
+}
+
+MemorySite::MemorySite(MemoryTag tag, const char* function, const char* file, int line)
+    : tag{tag},
+      function{function},
+      file{file},
+      line{line},
+      index{UNREGISTERED},
+      live_bytes{0},
+      allocations{0},
+      allocations_at_frame_start{0},
+      allocations_last_frame{0} {
+}
+
+MemoryScope::MemoryScope(MemorySite& site) : previous_{tls_site} {
+    if (site.index.load(std::memory_order_acquire) == MemorySite::UNREGISTERED) {
+        MemoryTracker::get().registerSite(site);
+    }
+    tls_site = &site;
+}
+
+MemoryScope::~MemoryScope() {
+    tls_site = previous_;
+}
+
+MemoryTracker& MemoryTracker::get() {
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+MemoryTracker::MemoryTracker()
+    : site_count_{0}, untagged_{MemoryTag::Untagged, "(untagged)", "", 0} {
+    std::fill(std::begin(sites_), std::end(sites_), nullptr);
+    registerSite(untagged_);
+}
+
+void MemoryTracker::registerSite(MemorySite& site) {
+    std::lock_guard<std::mutex> lock{register_mutex_};
+    if (site.index.load(std::memory_order_relaxed) != MemorySite::UNREGISTERED) {
+        return;
+    }
+    u32 index = site_count_.load(std::memory_order_relaxed);
+    if (index >= MAX_SITES) {
+        // Out of slots. Attribute this site's allocations to the untagged site.
+        site.index.store(0, std::memory_order_release);
+        return;
+    }
+    sites_[index] = &site;
+    site.index.store(index, std::memory_order_release);
+    site_count_.store(index + 1, std::memory_order_release);
+}
+
+void* MemoryTracker::allocate(std::size_t size) {
+    auto header = static_cast<AllocationHeader*>(std::malloc(sizeof(AllocationHeader) + size));
+    if (!header) {
+        return nullptr;
+    }
+    MemorySite* site = tls_site ? tls_site : &get().untagged_;
+    header->size = size;
+    header->site = site->index.load(std::memory_order_relaxed);
+    MemorySite* owner = get().sites_[header->site];
+    owner->live_bytes.fetch_add((i64)size, std::memory_order_relaxed);
+    owner->allocations.fetch_add(1, std::memory_order_relaxed);
+    return header + 1;
+}
+
+void MemoryTracker::deallocate(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    auto header = static_cast<AllocationHeader*>(ptr) - 1;
+    get().sites_[header->site]->live_bytes.fetch_sub((i64)header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+void MemoryTracker::markFrame() {
+    u32 count = site_count_.load(std::memory_order_acquire);
+    for (u32 i = 0; i < count; ++i) {
+        MemorySite& site = *sites_[i];
+        u64 allocations = site.allocations.load(std::memory_order_relaxed);
+        site.allocations_last_frame = allocations - site.allocations_at_frame_start;
+        site.allocations_at_frame_start = allocations;
+    }
+}
+
+MemoryTagStats MemoryTracker::tagStats(MemoryTag tag) const {
+    MemoryTagStats stats = {0, 0, 0};
+    u32 count = site_count_.load(std::memory_order_acquire);
+    for (u32 i = 0; i < count; ++i) {
+        const MemorySite& site = *sites_[i];
+        if (site.tag == tag) {
+            stats.live_bytes += site.live_bytes.load(std::memory_order_relaxed);
+            stats.allocations += site.allocations.load(std::memory_order_relaxed);
+            stats.allocations_last_frame += site.allocations_last_frame;
+        }
+    }
+    return stats;
+}
+
+Vector<const MemorySite*> MemoryTracker::topSites(size_t count) const {
+    Vector<const MemorySite*> sites{sites_, sites_ + site_count_.load(std::memory_order_acquire)};
+    std::sort(sites.begin(), sites.end(), [](const MemorySite* a, const MemorySite* b) {
+        return a->live_bytes.load(std::memory_order_relaxed) > b->live_bytes.load(std::memory_order_relaxed);
+    });
+    if (sites.size() > count) {
+        sites.resize(count);
+    }
+    return sites;
+}
+
+void MemoryTracker::writeJson(std::ostream& out) const {
+    out << "{\"tags\":{";
+    for (int t = 0; t < (int)MemoryTag::Count; ++t) {
+        MemoryTagStats stats = tagStats((MemoryTag)t);
+        out << (t > 0 ? "," : "") << '"' << memoryTagName((MemoryTag)t) << "\":{"
+            << "\"live_bytes\":" << stats.live_bytes
+            << ",\"allocations\":" << stats.allocations
+            << ",\"allocations_last_frame\":" << stats.allocations_last_frame << "}";
+    }
+    out << "},\"top_sites\":[";
+    auto sites = topSites(16);
+    for (size_t i = 0; i < sites.size(); ++i) {
+        const MemorySite& site = *sites[i];
+        out << (i > 0 ? "," : "") << "{\"function\":\"" << site.function << "\",\"file\":\"" << site.file
+            << "\",\"line\":" << site.line << ",\"tag\":\"" << memoryTagName(site.tag)
+            << "\",\"live_bytes\":" << site.live_bytes.load(std::memory_order_relaxed)
+            << ",\"allocations\":" << site.allocations.load(std::memory_order_relaxed) << "}";
+    }
+    out << "]}";
+}
+
+void MemoryTracker::drawOverlay(const Vec2& position, const Vec2& size) {
+    ImGui::SetNextWindowPos(ImVec2(position.x, position.y));
+    ImGui::SetNextWindowSize(ImVec2(size.x, size.y));
+    ImGui::Begin("Memory");
+    ImGui::Columns(4, "tags");
+    ImGui::Text("Tag");
+    ImGui::NextColumn();
+    ImGui::Text("Live KB");
+    ImGui::NextColumn();
+    ImGui::Text("Allocs/frame");
+    ImGui::NextColumn();
+    ImGui::Text("Allocs");
+    ImGui::NextColumn();
+    ImGui::Separator();
+    for (int t = 0; t < (int)MemoryTag::Count; ++t) {
+        MemoryTagStats stats = tagStats((MemoryTag)t);
+        ImGui::Text("%s", memoryTagName((MemoryTag)t));
+        ImGui::NextColumn();
+        ImGui::Text("%.1f", double(stats.live_bytes) / 1024.0);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)stats.allocations_last_frame);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)stats.allocations);
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+    ImGui::Text("Top sites by live bytes:");
+    for (auto site : topSites(8)) {
+        ImGui::Text("%8.1f KB  %s (%s:%d)", double(site->live_bytes.load(std::memory_order_relaxed)) / 1024.0,
+                    site->function, site->file, site->line);
+    }
+    ImGui::End();
+}
+
+void* operator new(std::size_t size) {
+    void* ptr = MemoryTracker::allocate(size);
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    return ptr;
+}
+
+void* operator new[](std::size_t size) {
+    void* ptr = MemoryTracker::allocate(size);
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    return ptr;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return MemoryTracker::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return MemoryTracker::allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    MemoryTracker::deallocate(ptr);
+}
+
+#endif
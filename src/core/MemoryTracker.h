@@ -0,0 +1,112 @@
+#pragma once
+
+// Opt-in allocation tracking. Build with -DDIPLOMACY_MEMORY_TRACKING=ON to replace the global
+// operator new/delete with versions that attribute every allocation to the innermost
+// MEMORY_SCOPE on the allocating thread. Otherwise the MEMORY_* macros compile away to nothing.
+//
+// Usage:
+//   Map::Map(...) {
+//       MEMORY_SCOPE(MemoryTag::Map);
+//       ...
+//   }
+#ifdef DIPLOMACY_MEMORY_TRACKING
+#define MEMORY_CONCAT_INNER(a, b) a##b
+#define MEMORY_CONCAT(a, b) MEMORY_CONCAT_INNER(a, b)
+#define MEMORY_SCOPE(tag)                                                                        \
+    static MemorySite MEMORY_CONCAT(memory_site_, __LINE__){tag, __func__, __FILE__, __LINE__}; \
+    MemoryScope MEMORY_CONCAT(memory_scope_, __LINE__){MEMORY_CONCAT(memory_site_, __LINE__)}
+#define MEMORY_FRAME() MemoryTracker::get().markFrame()
+#else
+#define MEMORY_SCOPE(tag)
+#define MEMORY_FRAME()
+#endif
+
+enum class MemoryTag : u8 {
+    Untagged,
+    Map,
+    World,
+    States,
+    Units,
+    Orders,
+    Navigation,
+    Render,
+    Count
+};
+
+const char* memoryTagName(MemoryTag tag);
+
+#ifdef DIPLOMACY_MEMORY_TRACKING
+
+// A source location which allocates memory. Sites are registered the first time their scope is
+// entered and live for the lifetime of the program.
+struct MemorySite {
+    static const u32 UNREGISTERED = ~0u;
+
+    MemorySite(MemoryTag tag, const char* function, const char* file, int line);
+
+    MemoryTag tag;
+    const char* function;
+    const char* file;
+    int line;
+    std::atomic<u32> index;
+
+    std::atomic<i64> live_bytes;
+    std::atomic<u64> allocations;
+    u64 allocations_at_frame_start;
+    u64 allocations_last_frame;
+};
+
+class MemoryScope {
+public:
+    explicit MemoryScope(MemorySite& site);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+    MemorySite* previous_;
+};
+
+struct MemoryTagStats {
+    i64 live_bytes;
+    u64 allocations;
+    u64 allocations_last_frame;
+};
+
+class MemoryTracker {
+public:
+    static const u32 MAX_SITES = 512;
+
+    static MemoryTracker& get();
+
+    // Hooks used by the global operator new/delete replacements.
+    static void* allocate(std::size_t size);
+    static void deallocate(void* ptr);
+
+    // Rolls the per-frame allocation counters. Called once per frame from the main loop.
+    void markFrame();
+
+    MemoryTagStats tagStats(MemoryTag tag) const;
+
+    // The sites with the most live bytes, largest first.
+    Vector<const MemorySite*> topSites(size_t count) const;
+
+    void writeJson(std::ostream& out) const;
+
+    void drawOverlay(const Vec2& position, const Vec2& size);
+
+private:
+    friend class MemoryScope;
+
+    std::mutex register_mutex_;
+    std::atomic<u32> site_count_;
+    MemorySite* sites_[MAX_SITES];
+    MemorySite untagged_;
+
+    MemoryTracker();
+
+    void registerSite(MemorySite& site);
+};
+
+#endif
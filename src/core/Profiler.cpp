@@ -0,0 +1,290 @@
+#include "Common.h"
+#include "core/Profiler.h"
+
+#ifdef DIPLOMACY_PROFILER
+
+#include <fstream>
+
+namespace {
+thread_local void* tls_thread_buffer = nullptr;
+
+ImU32 zoneColour(const char* name) {
+    // Hash the name pointer so the same zone keeps the same colour between frames.
+    auto hash = std::hash<const void*>()(name);
+    HSVColour colour{float(hash % 360), 0.5f, 0.75f};
+    sf::Color rgb = colour;
+    return IM_COL32(rgb.r, rgb.g, rgb.b, 255);
+}
+
+void writeJsonString(std::ostream& out, const char* str) {
+    out << '"';
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+}
+
+Profiler& Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+u64 Profiler::now() {
+    using namespace std::chrono;
+    return (u64)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::Profiler()
+    : frame_count_{0},
+      paused_{false},
+      pause_on_spike_{false},
+      spike_threshold_ms_{33.0f},
+      displayed_frame_start_{0},
+      displayed_frame_end_{0} {
+    std::fill(std::begin(frame_starts_), std::end(frame_starts_), 0);
+}
+
+Profiler::ThreadBuffer& Profiler::threadBuffer() {
+    if (!tls_thread_buffer) {
+        std::lock_guard<std::mutex> lock{threads_mutex_};
+        auto buffer = make_unique<ThreadBuffer>();
+        buffer->index = (u32)threads_.size();
+        buffer->name = buffer->index == 0 ? "Main" : "Thread " + std::to_string(buffer->index);
+        buffer->depth = 0;
+        buffer->head = 0;
+        buffer->events.reset(new ProfileEvent[EVENT_CAPACITY]);
+        tls_thread_buffer = buffer.get();
+        threads_.emplace_back(std::move(buffer));
+    }
+    return *static_cast<ThreadBuffer*>(tls_thread_buffer);
+}
+
+void Profiler::markFrame() {
+    frame_starts_[frame_count_ % FRAME_HISTORY] = now();
+    frame_count_++;
+}
+
+void Profiler::setThreadName(const String& name) {
+    auto& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock{threads_mutex_};
+    buffer.name = name;
+}
+
+void Profiler::beginZone() {
+    threadBuffer().depth++;
+}
+
+void Profiler::endZone(const char* name, u64 start_ns) {
+    auto& buffer = threadBuffer();
+    buffer.depth--;
+
+    // Only this thread writes to the buffer, so publishing the new head with release semantics is
+    // enough for readers on other threads to see a complete event.
+    u64 head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % EVENT_CAPACITY] = {name, start_ns, now(), buffer.depth};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+u64 Profiler::oldestReadableEvent(u64 head) {
+    // The slot at head - EVENT_CAPACITY is the one the owning thread writes next.
+    return head >= EVENT_CAPACITY ? head - EVENT_CAPACITY + 1 : 0;
+}
+
+u64 Profiler::oldestStableEvent(const ThreadBuffer& thread) {
+    // The owning thread keeps writing while other threads copy events out, so a copy can only be
+    // trusted if its slot was not reused in the meantime. Call this after copying: anything older
+    // than the returned index may have been overwritten mid-copy and must be thrown away.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return oldestReadableEvent(thread.head.load(std::memory_order_relaxed));
+}
+
+Vector<ProfileEvent> Profiler::copyEvents(const ThreadBuffer& thread) {
+    u64 head = thread.head.load(std::memory_order_acquire);
+    u64 tail = oldestReadableEvent(head);
+    Vector<ProfileEvent> events;
+    events.reserve(head - tail);
+    for (u64 i = tail; i < head; ++i) {
+        events.push_back(thread.events[i % EVENT_CAPACITY]);
+    }
+    u64 stable = std::min(oldestStableEvent(thread), head);
+    if (stable > tail) {
+        events.erase(events.begin(), events.begin() + (stable - tail));
+    }
+    return events;
+}
+
+bool Profiler::writeChromeTrace(const String& filename) {
+    std::ofstream out{filename};
+    if (!out) {
+        std::cerr << "Profiler: Unable to open " << filename << " for writing." << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{threads_mutex_};
+    Vector<Vector<ProfileEvent>> thread_events;
+    u64 origin = std::numeric_limits<u64>::max();
+    for (auto& thread : threads_) {
+        thread_events.emplace_back(copyEvents(*thread));
+        for (auto& e : thread_events.back()) {
+            origin = std::min(origin, e.start_ns);
+        }
+    }
+
+    out << "{\"traceEvents\":[\n";
+    for (size_t t = 0; t < threads_.size(); ++t) {
+        auto& thread = threads_[t];
+        if (t > 0) {
+            out << ",\n";
+        }
+        out << R"({"name":"thread_name","ph":"M","pid":0,"tid":)" << thread->index << R"(,"args":{"name":)";
+        writeJsonString(out, thread->name.c_str());
+        out << "}}";
+
+        for (auto& e : thread_events[t]) {
+            out << ",\n{\"name\":";
+            writeJsonString(out, e.name);
+            out << std::fixed << std::setprecision(3)
+                << R"(,"ph":"X","pid":0,"tid":)" << thread->index
+                << R"(,"ts":)" << double(e.start_ns - origin) / 1000.0
+                << R"(,"dur":)" << double(e.end_ns - e.start_ns) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    std::cout << "Profiler: Wrote trace to " << filename << std::endl;
+    return true;
+}
+
+void Profiler::captureFrame(u64 frame_start, u64 frame_end) {
+    displayed_frame_start_ = frame_start;
+    displayed_frame_end_ = frame_end;
+    displayed_events_.clear();
+
+    std::lock_guard<std::mutex> lock{threads_mutex_};
+    Vector<u64> indices;
+    for (auto& thread : threads_) {
+        // Events are stored in the order they finished, so walk backwards until we pass the start
+        // of the frame. A parent zone finishes after its children, so it is never skipped.
+        u64 head = thread->head.load(std::memory_order_acquire);
+        u64 tail = oldestReadableEvent(head);
+        indices.clear();
+        for (u64 i = head; i > tail; --i) {
+            ProfileEvent e = thread->events[(i - 1) % EVENT_CAPACITY];
+            if (e.end_ns < frame_start) {
+                break;
+            }
+            if (e.start_ns < frame_end) {
+                displayed_events_.emplace_back(thread->index, e);
+                indices.push_back(i - 1);
+            }
+        }
+
+        // Copies were taken newest first, so any that were overwritten are at the back.
+        u64 stable = oldestStableEvent(*thread);
+        while (!indices.empty() && indices.back() < stable) {
+            indices.pop_back();
+            displayed_events_.pop_back();
+        }
+    }
+}
+
+void Profiler::drawOverlay(const Vec2& position, const Vec2& size) {
+    PROFILE_SCOPE("Profiler::drawOverlay");
+
+    // Collect frame times, oldest first.
+    float frame_times[FRAME_HISTORY - 1];
+    int frame_time_count = 0;
+    float worst_frame_ms = 0.0f;
+    u64 first_frame = frame_count_ > FRAME_HISTORY ? frame_count_ - FRAME_HISTORY : 0;
+    for (u64 f = first_frame; f + 1 < frame_count_; ++f) {
+        u64 start = frame_starts_[f % FRAME_HISTORY];
+        u64 end = frame_starts_[(f + 1) % FRAME_HISTORY];
+        float ms = float(end - start) / 1e6f;
+        frame_times[frame_time_count++] = ms;
+        worst_frame_ms = std::max(worst_frame_ms, ms);
+    }
+
+    // Refresh the timeline with the last complete frame.
+    if (!paused_ && frame_count_ >= 2) {
+        u64 start = frame_starts_[(frame_count_ - 2) % FRAME_HISTORY];
+        u64 end = frame_starts_[(frame_count_ - 1) % FRAME_HISTORY];
+        captureFrame(start, end);
+        if (pause_on_spike_ && float(end - start) / 1e6f > spike_threshold_ms_) {
+            paused_ = true;
+        }
+    }
+
+    ImGui::SetNextWindowPos(ImVec2(position.x, position.y));
+    ImGui::SetNextWindowSize(ImVec2(size.x, size.y));
+    ImGui::Begin("Profiler");
+    float last_frame_ms = frame_time_count > 0 ? frame_times[frame_time_count - 1] : 0.0f;
+    ImGui::Text("Frame: %.2f ms (worst %.2f ms)", last_frame_ms, worst_frame_ms);
+    ImGui::PlotLines("##frametimes", frame_times, frame_time_count, 0, nullptr, 0.0f, 50.0f,
+                     ImVec2(size.x - 20.0f, 40.0f));
+    ImGui::Checkbox("Pause", &paused_);
+    ImGui::SameLine();
+    ImGui::Checkbox("Pause on spike", &pause_on_spike_);
+    ImGui::SameLine();
+    ImGui::PushItemWidth(100.0f);
+    ImGui::SliderFloat("ms", &spike_threshold_ms_, 5.0f, 100.0f, "%.0f");
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    if (ImGui::Button("Export trace")) {
+        writeChromeTrace("profile.json");
+    }
+    drawTimeline(size.x - 20.0f);
+    ImGui::End();
+}
+
+void Profiler::drawTimeline(float width) {
+    const float row_height = 16.0f;
+    const float thread_gap = 4.0f;
+    if (displayed_frame_end_ <= displayed_frame_start_) {
+        return;
+    }
+
+    // Lay out one band of rows per thread, as deep as that thread's deepest zone.
+    Vector<u32> thread_depth;
+    for (auto& entry : displayed_events_) {
+        if (entry.first >= thread_depth.size()) {
+            thread_depth.resize(entry.first + 1, 0);
+        }
+        thread_depth[entry.first] = std::max(thread_depth[entry.first], entry.second.depth + 1);
+    }
+    Vector<float> thread_offset(thread_depth.size(), 0.0f);
+    float height = 0.0f;
+    for (size_t i = 0; i < thread_depth.size(); ++i) {
+        thread_offset[i] = height;
+        height += thread_depth[i] * row_height + (thread_depth[i] > 0 ? thread_gap : 0.0f);
+    }
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+    double ns_to_px = width / double(displayed_frame_end_ - displayed_frame_start_);
+    for (auto& entry : displayed_events_) {
+        const ProfileEvent& e = entry.second;
+        u64 start = std::max(e.start_ns, displayed_frame_start_);
+        u64 end = std::min(e.end_ns, displayed_frame_end_);
+        ImVec2 a{origin.x + float((start - displayed_frame_start_) * ns_to_px),
+                 origin.y + thread_offset[entry.first] + e.depth * row_height};
+        ImVec2 b{origin.x + float((end - displayed_frame_start_) * ns_to_px), a.y + row_height - 1.0f};
+        if (b.x - a.x < 1.0f) {
+            b.x = a.x + 1.0f;
+        }
+        draw_list->AddRectFilled(a, b, zoneColour(e.name));
+        if (b.x - a.x > 40.0f) {
+            draw_list->PushClipRect(a, b, true);
+            draw_list->AddText(ImVec2(a.x + 2.0f, a.y), IM_COL32_BLACK, e.name);
+            draw_list->PopClipRect();
+        }
+        if (ImGui::IsMouseHoveringRect(a, b)) {
+            ImGui::SetTooltip("%s\n%.3f ms", e.name, double(e.end_ns - e.start_ns) / 1e6);
+        }
+    }
+    ImGui::Dummy(ImVec2(width, height));
+}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+// Scoped-zone profiler. Zones are recorded into a ring buffer owned by the calling thread, so
+// recording never takes a lock. Build with -DDIPLOMACY_PROFILER=ON to enable it; otherwise every
+// PROFILE_* macro compiles away to nothing.
+//
+// Usage:
+//   void World::draw(RenderContext& ctx) {
+//       PROFILE_SCOPE("World::draw");
+//       ...
+//   }
+#ifdef DIPLOMACY_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__){name}
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+#define PROFILE_FRAME() Profiler::get().markFrame()
+#define PROFILE_THREAD_NAME(name) Profiler::get().setThreadName(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_FRAME()
+#define PROFILE_THREAD_NAME(name)
+#endif
+
+#ifdef DIPLOMACY_PROFILER
+
+struct ProfileEvent {
+    const char* name;
+    u64 start_ns;
+    u64 end_ns;
+    u32 depth;
+};
+
+class Profiler {
+public:
+    static Profiler& get();
+
+    static u64 now();
+
+    // Called at the start of each frame on the main thread.
+    void markFrame();
+
+    // Names the calling thread in the trace and the overlay.
+    void setThreadName(const String& name);
+
+    void beginZone();
+    void endZone(const char* name, u64 start_ns);
+
+    // Writes every event still held in the ring buffers in Chrome's trace_event format. Load the
+    // result in chrome://tracing or https://ui.perfetto.dev.
+    bool writeChromeTrace(const String& filename);
+
+    // Frame time graph and a timeline of the last frame, one row per thread.
+    void drawOverlay(const Vec2& position, const Vec2& size);
+
+private:
+    static const u32 EVENT_CAPACITY = 1 << 15;
+    static const u32 FRAME_HISTORY = 240;
+
+    struct ThreadBuffer {
+        u32 index;
+        String name;
+        u32 depth;
+        std::atomic<u64> head;
+        UniquePtr<ProfileEvent[]> events;
+    };
+
+    std::mutex threads_mutex_;
+    Vector<UniquePtr<ThreadBuffer>> threads_;
+
+    // Frame start timestamps, indexed by frame number modulo FRAME_HISTORY.
+    u64 frame_count_;
+    u64 frame_starts_[FRAME_HISTORY];
+
+    // Overlay state.
+    bool paused_;
+    bool pause_on_spike_;
+    float spike_threshold_ms_;
+    u64 displayed_frame_start_;
+    u64 displayed_frame_end_;
+    Vector<Pair<u32, ProfileEvent>> displayed_events_;
+
+    Profiler();
+
+    ThreadBuffer& threadBuffer();
+    static u64 oldestReadableEvent(u64 head);
+    static u64 oldestStableEvent(const ThreadBuffer& thread);
+    static Vector<ProfileEvent> copyEvents(const ThreadBuffer& thread);
+    void captureFrame(u64 frame_start, u64 frame_end);
+    void drawTimeline(float width);
+};
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) : name_{name}, start_ns_{Profiler::now()} {
+        Profiler::get().beginZone();
+    }
+
+    ~ProfileZone() {
+        Profiler::get().endZone(name_, start_ns_);
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name_;
+    u64 start_ns_;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "Common.h"
+#include "gameplay/CommandLog.h"
+#include "gameplay/Unit.h"
+#include "core/Binary.h"
+
+#include <fstream>
+
+const u32 CommandLog::VERSION;
+
+namespace {
+const char MAGIC[4] = {'D', 'P', 'C', 'L'};
+
+// Order flags.
+const u8 FLAG_QUEUE = 1 << 0;
+const u8 FLAG_FLOW_FIELD = 1 << 1;
+
+u64 zigzag(i64 value) {
+    return (u64(value) << 1) ^ u64(value >> 63);
+}
+
+i64 unzigzag(u64 value) {
+    return i64(value >> 1) ^ -i64(value & 1);
+}
+}
+
+Command Command::createUnit(u32 player, UnitTypeId type, const Vec2& position) {
+    Command command;
+    command.type = CommandType::CreateUnit;
+    command.player = player;
+    command.unit_type = type;
+    command.position = position;
+    return command;
+}
+
+Command Command::groupOrder(u32 player, const Vector<UnitId>& units, const Order& order, bool queue) {
+    Command command;
+    command.type = CommandType::GroupOrder;
+    command.player = player;
+    command.units = units;
+    command.order = order;
+    command.queue = queue;
+    return command;
+}
+
+Command Command::checksumOf(u64 checksum) {
+    Command command;
+    command.type = CommandType::Checksum;
+    command.player = 0;
+    command.checksum = checksum;
+    return command;
+}
+
+CommandLog::CommandLog(const SimulationSettings& settings) : settings_(settings), last_tick_{0} {
+}
+
+void CommandLog::record(u64 tick, const Command& command) {
+    MEMORY_SCOPE(MemoryTag::Orders);
+    BinaryWriter writer{data_};
+    writer.writeVarint(tick - last_tick_);
+    last_tick_ = tick;
+    writer.writeU8((u8)command.type);
+    switch (command.type) {
+        case CommandType::CreateUnit:
+            writer.writeVarint(command.player);
+            writer.writeU8((u8)command.unit_type);
+            writer.writeFloat(command.position.x);
+            writer.writeFloat(command.position.y);
+            break;
+        case CommandType::GroupOrder: {
+            writer.writeVarint(command.player);
+            writer.writeU8((u8)command.order.type);
+            u8 flags = command.queue ? FLAG_QUEUE : 0;
+            switch (command.order.type) {
+                case OrderType::Move:
+                    flags |= command.order.move.use_flow_field ? FLAG_FLOW_FIELD : 0;
+                    writer.writeU8(flags);
+                    writer.writeFloat(command.order.move.target_x);
+                    writer.writeFloat(command.order.move.target_y);
+                    break;
+            }
+            writer.writeVarint(command.units.size());
+            i64 previous = 0;
+            for (UnitId unit : command.units) {
+                writer.writeVarint(zigzag(i64(unit) - previous));
+                previous = unit;
+            }
+        } break;
+        case CommandType::Checksum:
+            writer.writeU64(command.checksum);
+            break;
+        default:
+            break;
+    }
+}
+
+bool CommandLog::save(const String& path) const {
+    std::ofstream out{path, std::ios::binary};
+    if (!out) {
+        std::cerr << "CommandLog: Unable to open " << path << " for writing." << std::endl;
+        return false;
+    }
+    Vector<u8> header;
+    BinaryWriter writer{header};
+    writer.writeBytes(MAGIC, sizeof(MAGIC));
+    writer.writeU32(VERSION);
+    writer.writeU32((u32)settings_.num_sites);
+    writer.writeFloat(settings_.min.x);
+    writer.writeFloat(settings_.min.y);
+    writer.writeFloat(settings_.max.x);
+    writer.writeFloat(settings_.max.y);
+    writer.writeU32((u32)settings_.num_players);
+    out.write((const char*)header.data(), header.size());
+    out.write((const char*)data_.data(), data_.size());
+    return (bool)out;
+}
+
+bool CommandLog::load(const String& path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        std::cerr << "CommandLog: Unable to open " << path << "." << std::endl;
+        return false;
+    }
+    Vector<u8> bytes{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    BinaryReader reader{bytes};
+    char magic[sizeof(MAGIC)];
+    u32 version, num_sites, num_players;
+    SimulationSettings settings;
+    if (!reader.readBytes(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !reader.readU32(version) || version != VERSION || !reader.readU32(num_sites) ||
+        !reader.readFloat(settings.min.x) || !reader.readFloat(settings.min.y) ||
+        !reader.readFloat(settings.max.x) || !reader.readFloat(settings.max.y) || !reader.readU32(num_players)) {
+        std::cerr << "CommandLog: " << path << " is not a version " << VERSION << " command log." << std::endl;
+        return false;
+    }
+    settings.num_sites = (int)num_sites;
+    settings.num_players = (int)num_players;
+
+    // Walk the records to find the last tick, and to check that they are well formed.
+    CommandLog log{settings};
+    log.data_.assign(bytes.begin() + reader.offset(), bytes.end());
+    Reader records{log};
+    u64 tick;
+    Command command;
+    while (records.next(tick, command)) {
+        log.last_tick_ = tick;
+    }
+    if (!records.atEnd()) {
+        std::cerr << "CommandLog: " << path << " is corrupt." << std::endl;
+        return false;
+    }
+    *this = std::move(log);
+    return true;
+}
+
+CommandLog::Reader::Reader(const CommandLog& log) : log_(log), offset_{0}, tick_{0} {
+}
+
+bool CommandLog::Reader::next(u64& tick, Command& command) {
+    BinaryReader reader{log_.data_.data() + offset_, log_.data_.size() - offset_};
+    u64 delta, value;
+    u8 type;
+    if (!reader.readVarint(delta) || !reader.readU8(type) || type >= (u8)CommandType::Count) {
+        return false;
+    }
+    command.type = (CommandType)type;
+    switch (command.type) {
+        case CommandType::CreateUnit: {
+            u8 unit_type;
+            if (!reader.readVarint(value) || !reader.readU8(unit_type) || unit_type >= (u8)UnitTypeId::Count ||
+                !reader.readFloat(command.position.x) || !reader.readFloat(command.position.y)) {
+                return false;
+            }
+            command.player = (u32)value;
+            command.unit_type = (UnitTypeId)unit_type;
+        } break;
+        case CommandType::GroupOrder: {
+            u8 order_type, flags;
+            if (!reader.readVarint(value) || !reader.readU8(order_type) || order_type != (u8)OrderType::Move ||
+                !reader.readU8(flags)) {
+                return false;
+            }
+            command.player = (u32)value;
+            command.queue = (flags & FLAG_QUEUE) != 0;
+            Vec2 target;
+            if (!reader.readFloat(target.x) || !reader.readFloat(target.y)) {
+                return false;
+            }
+            command.order = Order::moveTo(target, (flags & FLAG_FLOW_FIELD) != 0);
+            u64 count;
+            if (!reader.readVarint(count) || count > log_.data_.size()) {
+                return false;
+            }
+            command.units.resize((size_t)count);
+            i64 previous = 0;
+            for (UnitId& unit : command.units) {
+                if (!reader.readVarint(value)) {
+                    return false;
+                }
+                previous += unzigzag(value);
+                unit = (UnitId)previous;
+            }
+        } break;
+        case CommandType::Checksum:
+            command.player = 0;
+            if (!reader.readU64(command.checksum)) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    tick_ += delta;
+    tick = tick_;
+    offset_ += reader.offset();
+    return true;
+}
+
+bool CommandLog::Reader::atEnd() const {
+    return offset_ == log_.data_.size();
+}
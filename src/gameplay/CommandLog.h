@@ -0,0 +1,105 @@
+#pragma once
+
+#include "gameplay/Orders.h"
+#include "gameplay/UnitGrid.h"
+
+enum class UnitTypeId : u8;
+
+// Settings which, together with the commands issued, fully determine a game.
+struct SimulationSettings {
+    SimulationSettings() : num_sites{800}, min{0.0f, 0.0f}, max{2400.0f, 2400.0f}, num_players{8} {}
+
+    int num_sites;
+    Vec2 min;
+    Vec2 max;
+    int num_players;
+};
+
+enum class CommandType : u8 {
+    // Spawn a unit for a player.
+    CreateUnit,
+    // Give an order to a group of a player's units.
+    GroupOrder,
+    // Not a command. The simulation checksum at the start of the tick, used to check a replay.
+    Checksum,
+    Count
+};
+
+// Something a player did to change the game. Everything which changes the simulation, other than
+// ticking it, goes through a command, so replaying the commands replays the game.
+struct Command {
+    CommandType type;
+    u32 player;
+
+    // CreateUnit.
+    UnitTypeId unit_type;
+    Vec2 position;
+
+    // GroupOrder.
+    Vector<UnitId> units;
+    Order order;
+    bool queue;
+
+    // Checksum.
+    u64 checksum;
+
+    static Command createUnit(u32 player, UnitTypeId type, const Vec2& position);
+    static Command groupOrder(u32 player, const Vector<UnitId>& units, const Order& order, bool queue);
+    static Command checksumOf(u64 checksum);
+};
+
+// Every command issued during a game, keyed by the tick it was applied before, in a compact binary
+// form. Ticks are stored as deltas and unit ids as deltas from the previous id, both as variable
+// length integers, so an order to a group of a hundred units takes a little over a hundred bytes.
+//
+// Files start with a header holding a version and the simulation settings, and are otherwise
+// just the records.
+class CommandLog {
+public:
+    static const u32 VERSION = 1;
+
+    explicit CommandLog(const SimulationSettings& settings = SimulationSettings{});
+
+    const SimulationSettings& settings() const {
+        return settings_;
+    }
+
+    // Commands must be recorded in tick order.
+    void record(u64 tick, const Command& command);
+
+    // Tick of the last record.
+    u64 lastTick() const {
+        return last_tick_;
+    }
+
+    size_t sizeBytes() const {
+        return data_.size();
+    }
+
+    bool save(const String& path) const;
+
+    // Returns false, leaving the log unchanged, if the file can't be read or is not a command log
+    // of this version.
+    bool load(const String& path);
+
+    // Reads the records back in order.
+    class Reader {
+    public:
+        explicit Reader(const CommandLog& log);
+
+        // Returns false at the end of the log, or if a record is malformed.
+        bool next(u64& tick, Command& command);
+
+        bool atEnd() const;
+
+    private:
+        const CommandLog& log_;
+        size_t offset_;
+        u64 tick_;
+    };
+
+private:
+    SimulationSettings settings_;
+    Vector<u8> data_;
+    u64 last_tick_;
+};
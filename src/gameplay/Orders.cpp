@@ -1,82 +1,148 @@
 #include "Common.h"
 #include "Orders.h"
-#include "Unit.h"
 #include "RenderContext.h"
 
-Order::Order() : unit_{nullptr}, previous_{nullptr} {
-}
-
-MoveOrder::MoveOrder(const Vec2& target_position): target_position_{target_position} {
-}
-
-void MoveOrder::draw(RenderContext& ctx) {
-    Vec2 rem = remaining();
+namespace {
+void drawMoveOrder(RenderContext& ctx, const Vec2& start, const Vec2& end) {
+    Vec2 rem = end - start;
     sf::RectangleShape travel_line;
     travel_line.setSize({glm::length(rem), 3.0f});
-    travel_line.setPosition(toSFML(startPosition()));
+    travel_line.setPosition(toSFML(start));
     travel_line.setRotation(atan2(rem.y, rem.x) * RAD_TO_DEG);
     travel_line.setFillColor(sf::Color(255, 255, 255, 120));
     ctx.window->draw(travel_line);
 }
+}
 
-bool MoveOrder::tick(float dt) {
-    Vec2 rem = remaining();
-    float rem_length = glm::length(rem);
-    if (rem_length < 5.0f) {
-        return false;
+Order Order::moveTo(const Vec2& target_position, bool use_flow_field) {
+    Order order;
+    order.type = OrderType::Move;
+    order.move = {target_position.x, target_position.y, use_flow_field};
+    return order;
+}
+
+Vec2 Order::endPosition() const {
+    switch (type) {
+        case OrderType::Move:
+            return {move.target_x, move.target_y};
     }
+    return {0.0f, 0.0f};
+}
 
-    unit_->stepTowards(dt, rem / rem_length, 1.0f);
-    return true;
+OrderPool& OrderPool::get() {
+    static OrderPool pool;
+    return pool;
 }
 
-Vec2 MoveOrder::startPosition() const {
-    if (previous_) {
-        MoveOrder* previous_move = dynamic_cast<MoveOrder*>(previous_);
-        if (previous_move) {
-            return previous_move->target_position_;
-        }
+void OrderPool::reserve(u32 count) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    while (free_blocks_.size() < count) {
+        addChunk();
     }
-    return unit_->position();
 }
 
-Vec2 MoveOrder::remaining() const {
-    return target_position_ - startPosition();
+u32 OrderPool::acquire() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (free_blocks_.empty()) {
+        addChunk();
+    }
+    u32 block = free_blocks_.back();
+    free_blocks_.pop_back();
+    return block;
 }
 
-OrderList::OrderList(Unit* unit) : OrderList(unit, List<UniquePtr<Order>>{}) {
+void OrderPool::release(u32 block) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    free_blocks_.push_back(block);
 }
 
-OrderList::OrderList(Unit* unit, List<UniquePtr<Order>> orders) : unit_{unit}, orders_(std::move(orders)) {
+void OrderPool::addChunk() {
+    MEMORY_SCOPE(MemoryTag::Orders);
+    u32 first_block = (u32)chunks_.size() * BLOCKS_PER_CHUNK;
+    chunks_.emplace_back(new OrderBlock[BLOCKS_PER_CHUNK]);
+
+    // Hand out blocks in ascending order, so units created together share cache lines.
+    free_blocks_.reserve(free_blocks_.size() + BLOCKS_PER_CHUNK);
+    for (u32 i = BLOCKS_PER_CHUNK; i > 0; --i) {
+        free_blocks_.push_back(first_block + i - 1);
+    }
 }
 
-void OrderList::add(UniquePtr<Order> order, bool queue) {
-    order->unit_ = unit_;
-    if (queue) {
-        if (!orders_.empty()) {
-            order->previous_ = orders_.back().get();
-        }
-    } else {
-        orders_.clear();
+OrderList::OrderList() : block_{OrderPool::INVALID_BLOCK}, head_{0}, count_{0} {
+}
+
+OrderList::~OrderList() {
+    clear();
+}
+
+OrderList::OrderList(OrderList&& other) noexcept : block_{other.block_}, head_{other.head_}, count_{other.count_} {
+    other.block_ = OrderPool::INVALID_BLOCK;
+    other.head_ = 0;
+    other.count_ = 0;
+}
+
+OrderList& OrderList::operator=(OrderList&& other) noexcept {
+    if (this != &other) {
+        clear();
+        std::swap(block_, other.block_);
+        std::swap(head_, other.head_);
+        std::swap(count_, other.count_);
+    }
+    return *this;
+}
+
+bool OrderList::add(const Order& order, bool queue) {
+    if (!queue) {
+        head_ = 0;
+        count_ = 0;
+    }
+    if (count_ == ORDER_QUEUE_CAPACITY) {
+        return false;
+    }
+    if (block_ == OrderPool::INVALID_BLOCK) {
+        block_ = OrderPool::get().acquire();
+        head_ = 0;
     }
-    orders_.emplace_back(std::move(order));
+    OrderPool::get().block(block_).orders[(head_ + count_) % ORDER_QUEUE_CAPACITY] = order;
+    count_++;
+    return true;
 }
 
-void OrderList::draw(RenderContext& ctx) {
-    for (auto it = orders_.rbegin(); it != orders_.rend(); ++it) {
-        (*it)->draw(ctx);
+void OrderList::clear() {
+    if (block_ != OrderPool::INVALID_BLOCK) {
+        OrderPool::get().release(block_);
+        block_ = OrderPool::INVALID_BLOCK;
     }
+    head_ = 0;
+    count_ = 0;
+}
+
+const Order& OrderList::operator[](u32 index) const {
+    return OrderPool::get().block(block_).orders[(head_ + index) % ORDER_QUEUE_CAPACITY];
 }
 
-void OrderList::tick(float dt) {
-    // Process first order.
-    if (!orders_.empty()) {
-        // Once that order has finished, pop it.
-        if (!orders_.front()->tick(dt)) {
-            orders_.pop_front();
-            if (!orders_.empty()) {
-                orders_.front()->previous_ = nullptr;
-            }
+Vec2 OrderList::startPosition(u32 index, const Vec2& unit_position) const {
+    if (index == 0) {
+        return unit_position;
+    }
+    return (*this)[index - 1].endPosition();
+}
+
+void OrderList::draw(RenderContext& ctx, const Vec2& unit_position) const {
+    for (u32 i = count_; i > 0; --i) {
+        const Order& order = (*this)[i - 1];
+        switch (order.type) {
+            case OrderType::Move:
+                drawMoveOrder(ctx, startPosition(i - 1, unit_position), order.endPosition());
+                break;
         }
     }
 }
+
+void OrderList::popFront() {
+    head_ = (u8)((head_ + 1) % ORDER_QUEUE_CAPACITY);
+    count_--;
+    if (count_ == 0) {
+        clear();
+    }
+}
@@ -1,56 +1,109 @@
 #pragma once
 
-class Unit;
 struct RenderContext;
 
-class Order {
-public:
-    Order();
-    virtual ~Order() = default;
+enum class OrderType : u8 {
+    Move
+};
+
+struct MoveOrderData {
+    float target_x;
+    float target_y;
+
+    // Route with a flow field shared by every unit moving to the same site, rather than a path
+    // of its own. Set for orders given to large groups.
+    bool use_flow_field;
+};
 
-    // Draw when visible.
-    virtual void draw(RenderContext& ctx) = 0;
+// A compact order record. Orders are plain data so they can be stored by value in pooled queues,
+// with the payload selected by 'type'.
+struct Order {
+    OrderType type;
+    union {
+        MoveOrderData move;
+    };
 
-    // True: completed. False: Requires more processing.
-    virtual bool tick(float dt) = 0;
+    static Order moveTo(const Vec2& target_position, bool use_flow_field = false);
 
-protected:
-    Unit* unit_;
-    Order* previous_;
+    // Where the unit will be once this order has completed.
+    Vec2 endPosition() const;
+};
+
+const u32 ORDER_QUEUE_CAPACITY = 8;
 
-    friend class OrderList;
+struct OrderBlock {
+    Order orders[ORDER_QUEUE_CAPACITY];
 };
 
-class MoveOrder : public Order
-{
+// Global pool of fixed size order queue storage. Blocks are allocated in chunks which are never
+// freed, so issuing orders in the steady state does not touch the heap.
+class OrderPool {
 public:
-    MoveOrder(const Vec2& target_position);
+    static const u32 INVALID_BLOCK = ~0u;
+    static const u32 BLOCKS_PER_CHUNK = 1024;
 
-    ~MoveOrder() override = default;
+    static OrderPool& get();
 
-    // Order
-    void draw(RenderContext& ctx) override;
-    bool tick(float dt) override;
+    // Ensure at least 'count' blocks can be acquired without allocating.
+    void reserve(u32 count);
 
-private:
-    Vec2 target_position_;
+    u32 acquire();
+    void release(u32 block);
+
+    OrderBlock& block(u32 block) {
+        return chunks_[block / BLOCKS_PER_CHUNK][block % BLOCKS_PER_CHUNK];
+    }
 
 private:
-    Vec2 startPosition() const;
-    Vec2 remaining() const;
+    std::mutex mutex_;
+    Vector<UniquePtr<OrderBlock[]>> chunks_;
+    Vector<u32> free_blocks_;
+
+    OrderPool() = default;
+
+    void addChunk();
 };
 
+// A per-unit ring buffer of orders, backed by a block from the order pool. The block is held only
+// while the unit has orders.
 class OrderList {
 public:
-    OrderList(Unit* unit);
-    OrderList(Unit* unit, List<UniquePtr<Order>> orders);
+    OrderList();
+    ~OrderList();
+
+    OrderList(const OrderList&) = delete;
+    OrderList& operator=(const OrderList&) = delete;
+    OrderList(OrderList&& other) noexcept;
+    OrderList& operator=(OrderList&& other) noexcept;
+
+    // Returns false if the order could not be queued because the queue is full.
+    bool add(const Order& order, bool queue);
+    void clear();
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    u32 size() const {
+        return count_;
+    }
 
-    void add(UniquePtr<Order> order, bool queue);
+    // Orders are indexed from the front of the queue.
+    const Order& operator[](u32 index) const;
 
-    void draw(RenderContext& ctx);
-    void tick(float dt);
+    const Order& front() const {
+        return (*this)[0];
+    }
+
+    void popFront();
+
+    // The position the unit will be in when starting the order at 'index'.
+    Vec2 startPosition(u32 index, const Vec2& unit_position) const;
+
+    void draw(RenderContext& ctx, const Vec2& unit_position) const;
 
 private:
-    Unit* unit_;
-    List<UniquePtr<Order>> orders_;
-};
\ No newline at end of file
+    u32 block_;
+    u8 head_;
+    u8 count_;
+};
@@ -0,0 +1,83 @@
+#include "Common.h"
+#include "gameplay/Simulation.h"
+#include "core/Binary.h"
+#include "core/JobSystem.h"
+
+constexpr float Simulation::TICK_DT;
+const u64 Simulation::CHECKSUM_INTERVAL;
+
+Simulation::Simulation(const SimulationSettings& settings, JobSystem& jobs, const String& terrain_cache_path)
+    : jobs_(jobs), settings_(settings), recorder_{nullptr}, tick_count_{0} {
+    world_ = make_unique<World>(settings_.num_sites, settings_.min, settings_.max, jobs_, terrain_cache_path);
+    world_->fillStates(settings_.num_players);
+    visibility_ = make_unique<Visibility>(world_->map(), (u32)settings_.num_players);
+    units_.setPathfinder(&world_->pathfinder());
+    units_.setVisibility(visibility_.get());
+    units_.setBounds(world_->map().boundsMin(), world_->map().boundsMax());
+}
+
+void Simulation::setRecorder(CommandLog* log) {
+    recorder_ = log;
+}
+
+CommandResult Simulation::apply(const Command& command) {
+    if (recorder_) {
+        recorder_->record(tick_count_, command);
+    }
+    CommandResult result{INVALID_UNIT, 0};
+    switch (command.type) {
+        case CommandType::CreateUnit:
+            result.created_unit = units_.create(command.unit_type, command.position, command.player);
+            break;
+        case CommandType::GroupOrder: {
+            // Players can only order their own units.
+            Vector<UnitId> units;
+            units.reserve(command.units.size());
+            for (UnitId unit : command.units) {
+                if (unit < units_.size() && units_.owner(unit) == command.player) {
+                    units.push_back(unit);
+                }
+            }
+            result.accepted_units = units_.addGroupOrder(units, command.order, command.queue);
+        } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+void Simulation::tick() {
+    PROFILE_SCOPE("Simulation::tick");
+    // Visibility changes are collected afresh each tick.
+    visibility_->clearChanges();
+    world_->tick();
+    units_.tick(TICK_DT, jobs_);
+    tick_count_++;
+    if (recorder_ && tick_count_ % CHECKSUM_INTERVAL == 0) {
+        recorder_->record(tick_count_, Command::checksumOf(checksum()));
+    }
+}
+
+void Simulation::saveState(BinaryWriter& writer) const {
+    PROFILE_SCOPE("Simulation::saveState");
+    writer.writeU64(tick_count_);
+    world_->saveState(writer);
+    units_.saveState(writer);
+    writer.writeU64(checksum());
+}
+
+bool Simulation::loadState(BinaryReader& reader) {
+    PROFILE_SCOPE("Simulation::loadState");
+    u64 tick_count, saved_checksum;
+    if (tick_count_ != 0 || !reader.readU64(tick_count) || !world_->loadState(reader)) {
+        return false;
+    }
+    tick_count_ = tick_count;
+    // Routes are rebuilt against the loaded ownership.
+    world_->pathfinder().refresh();
+    return units_.loadState(reader) && reader.readU64(saved_checksum) && saved_checksum == checksum();
+}
+
+u64 Simulation::checksum() const {
+    return hashCombine(hashCombine(tick_count_, world_->checksum()), units_.checksum());
+}
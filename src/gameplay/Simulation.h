@@ -0,0 +1,112 @@
+#pragma once
+
+#include "gameplay/CommandLog.h"
+#include "gameplay/Unit.h"
+#include "world/Visibility.h"
+#include "world/World.h"
+
+class JobSystem;
+
+// What applying a command did.
+struct CommandResult {
+    // The unit created by a CreateUnit command, or INVALID_UNIT.
+    UnitId created_unit;
+    // The number of units which accepted a GroupOrder command. This is fewer than were ordered
+    // when some aren't the player's, or already have ORDER_QUEUE_CAPACITY orders queued.
+    u32 accepted_units;
+};
+
+// The deterministic part of the game: the world, the units and what each player can see,
+// advanced in fixed ticks.
+//
+// Given the same settings, and the same orders issued before the same ticks, every run plays out
+// identically, whatever the number of workers. Containers on the simulation path iterate in a
+// defined order, batches have a fixed size, and the float math is evaluated the same way on every
+// machine running the same build. This allows lockstep: peers only exchange orders, and compare
+// checksums to detect a desync.
+class Simulation {
+public:
+    // Length of a tick, in seconds.
+    static constexpr float TICK_DT = 1.0f / 60.0f;
+
+    // How often a checksum is recorded alongside the commands, in ticks.
+    static const u64 CHECKSUM_INTERVAL = 60;
+
+    // Terrain is cached in 'terrain_cache_path', if given. See Map.
+    Simulation(const SimulationSettings& settings, JobSystem& jobs, const String& terrain_cache_path = "");
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    // Record every command applied from now on into 'log', and a checksum every
+    // CHECKSUM_INTERVAL ticks. The log must have been created with this simulation's settings.
+    void setRecorder(CommandLog* log);
+
+    // Apply a command before the next tick. The command is recorded even if no unit accepts it,
+    // as replaying it has the same effect.
+    CommandResult apply(const Command& command);
+
+    UnitId createUnit(u32 player, UnitTypeId type, const Vec2& position) {
+        return apply(Command::createUnit(player, type, position)).created_unit;
+    }
+
+    // Returns the number of units which accepted the order.
+    u32 orderUnits(u32 player, const Vector<UnitId>& units, const Order& order, bool queue) {
+        return apply(Command::groupOrder(player, units, order, queue)).accepted_units;
+    }
+
+    // Advance by one tick.
+    void tick();
+
+    // Number of ticks run so far.
+    u64 tickCount() const {
+        return tick_count_;
+    }
+
+    // Snapshots of the state, without the settings. Loading requires a simulation fresh from
+    // construction with the same settings as the one saved, and fails if it doesn't reproduce the
+    // saved checksum.
+    void saveState(BinaryWriter& writer) const;
+    bool loadState(BinaryReader& reader);
+
+    // Hash of the simulation state after the last tick. The world and units hash themselves as
+    // they change, so this is cheap enough to compute every tick.
+    u64 checksum() const;
+
+    World& world() {
+        return *world_;
+    }
+
+    const World& world() const {
+        return *world_;
+    }
+
+    UnitStore& units() {
+        return units_;
+    }
+
+    const UnitStore& units() const {
+        return units_;
+    }
+
+    Visibility& visibility() {
+        return *visibility_;
+    }
+
+    const Visibility& visibility() const {
+        return *visibility_;
+    }
+
+    const SimulationSettings& settings() const {
+        return settings_;
+    }
+
+private:
+    JobSystem& jobs_;
+    SimulationSettings settings_;
+    CommandLog* recorder_;
+    u64 tick_count_;
+    UniquePtr<World> world_;
+    UniquePtr<Visibility> visibility_;
+    UnitStore units_;
+};
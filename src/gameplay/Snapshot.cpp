@@ -0,0 +1,158 @@
+#include "Common.h"
+#include "gameplay/Snapshot.h"
+#include "core/Binary.h"
+#include "core/Compression.h"
+
+#include <fstream>
+
+namespace {
+const char MAGIC[4] = {'D', 'P', 'S', 'S'};
+
+// Header flags.
+const u32 FLAG_COMPRESSED = 1 << 0;
+
+// LZ4 output never expands to more than this many times its size, plus the slack, so a larger
+// payload size in a header can only be corrupt.
+const u64 LZ4_MAX_EXPANSION = 255;
+const u64 LZ4_EXPANSION_SLACK = 16;
+}
+
+void captureSnapshot(const Simulation& sim, Vector<u8>& payload) {
+    PROFILE_SCOPE("captureSnapshot");
+    payload.clear();
+    BinaryWriter writer{payload};
+    const SimulationSettings& settings = sim.settings();
+    writer.writeU32((u32)settings.num_sites);
+    writer.writeFloat(settings.min.x);
+    writer.writeFloat(settings.min.y);
+    writer.writeFloat(settings.max.x);
+    writer.writeFloat(settings.max.y);
+    writer.writeU32((u32)settings.num_players);
+    sim.saveState(writer);
+}
+
+bool writeSnapshot(const String& path, const Vector<u8>& payload, bool compress) {
+    PROFILE_SCOPE("writeSnapshot");
+    Vector<u8> compressed;
+    if (compress) {
+        compressLZ4(payload.data(), payload.size(), compressed);
+    }
+    const Vector<u8>& stored = compress ? compressed : payload;
+
+    Vector<u8> header;
+    BinaryWriter writer{header};
+    writer.writeBytes(MAGIC, sizeof(MAGIC));
+    writer.writeU32(SNAPSHOT_VERSION);
+    writer.writeU32(compress ? FLAG_COMPRESSED : 0);
+    writer.writeU64(payload.size());
+    writer.writeU64(stored.size());
+
+    // Write to a temporary file and rename it over the old snapshot, so a crash while saving
+    // leaves the previous snapshot intact.
+    String temporary_path = path + ".tmp";
+    {
+        std::ofstream out{temporary_path, std::ios::binary};
+        if (!out) {
+            std::cerr << "Snapshot: Unable to open " << temporary_path << " for writing." << std::endl;
+            return false;
+        }
+        out.write((const char*)header.data(), header.size());
+        out.write((const char*)stored.data(), stored.size());
+        if (!out) {
+            std::cerr << "Snapshot: Unable to write " << temporary_path << "." << std::endl;
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Snapshot: Unable to replace " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+UniquePtr<Simulation> loadSnapshot(const String& path, JobSystem& jobs, const String& terrain_cache_path) {
+    PROFILE_SCOPE("loadSnapshot");
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        std::cerr << "Snapshot: Unable to open " << path << "." << std::endl;
+        return nullptr;
+    }
+    Vector<u8> file{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    BinaryReader header{file};
+    char magic[sizeof(MAGIC)];
+    u32 version, flags;
+    u64 payload_size, stored_size;
+    if (!header.readBytes(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !header.readU32(version) || version != SNAPSHOT_VERSION || !header.readU32(flags) ||
+        !header.readU64(payload_size) || !header.readU64(stored_size) || stored_size != header.remaining()) {
+        std::cerr << "Snapshot: " << path << " is not a version " << SNAPSHOT_VERSION << " snapshot." << std::endl;
+        return nullptr;
+    }
+
+    // Decompress in one go into a buffer of the final size.
+    Vector<u8> payload;
+    const u8* stored = file.data() + header.offset();
+    if (flags & FLAG_COMPRESSED) {
+        if (payload_size > stored_size * LZ4_MAX_EXPANSION + LZ4_EXPANSION_SLACK) {
+            std::cerr << "Snapshot: " << path << " is corrupt." << std::endl;
+            return nullptr;
+        }
+        payload.resize((size_t)payload_size);
+        if (!decompressLZ4(stored, (size_t)stored_size, payload.data(), payload.size())) {
+            std::cerr << "Snapshot: " << path << " is corrupt." << std::endl;
+            return nullptr;
+        }
+    } else if (payload_size == stored_size) {
+        payload.assign(stored, stored + stored_size);
+    } else {
+        std::cerr << "Snapshot: " << path << " is corrupt." << std::endl;
+        return nullptr;
+    }
+
+    BinaryReader reader{payload};
+    SimulationSettings settings;
+    u32 num_sites, num_players;
+    if (!reader.readU32(num_sites) || !reader.readFloat(settings.min.x) || !reader.readFloat(settings.min.y) ||
+        !reader.readFloat(settings.max.x) || !reader.readFloat(settings.max.y) || !reader.readU32(num_players)) {
+        std::cerr << "Snapshot: " << path << " is corrupt." << std::endl;
+        return nullptr;
+    }
+    settings.num_sites = (int)num_sites;
+    settings.num_players = (int)num_players;
+    auto sim = make_unique<Simulation>(settings, jobs, terrain_cache_path);
+    if (!sim->loadState(reader) || !reader.atEnd()) {
+        std::cerr << "Snapshot: " << path << " did not load the state it saved." << std::endl;
+        return nullptr;
+    }
+    return sim;
+}
+
+SnapshotWriter::SnapshotWriter() : busy_{false} {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    wait();
+}
+
+bool SnapshotWriter::save(const Simulation& sim, const String& path) {
+    if (busy()) {
+        return false;
+    }
+    wait();
+    MEMORY_SCOPE(MemoryTag::World);
+    captureSnapshot(sim, payload_);
+    path_ = path;
+    busy_.store(true, std::memory_order_release);
+    thread_ = std::thread{[this]() {
+        writeSnapshot(path_, payload_);
+        busy_.store(false, std::memory_order_release);
+    }};
+    return true;
+}
+
+void SnapshotWriter::wait() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "gameplay/Simulation.h"
+
+#include <thread>
+
+// Saved games.
+//
+// A snapshot file is a small header followed by the payload: the simulation settings, then the
+// simulation state. The state is flat, with everything that refers to something else (site
+// owners, unit routes, grid links) stored as an index, so it loads by copying arrays into a
+// simulation built from the same settings, without allocating per unit. The payload is
+// optionally compressed with LZ4.
+const u32 SNAPSHOT_VERSION = 1;
+
+// Copy the state of 'sim' into 'payload'. Mostly array copies, so it is quick enough to do on the
+// simulation thread between ticks.
+void captureSnapshot(const Simulation& sim, Vector<u8>& payload);
+
+// Write a captured payload to 'path'.
+bool writeSnapshot(const String& path, const Vector<u8>& payload, bool compress = true);
+
+// Build a simulation from a snapshot file. Returns null, after logging why, if the file can't be
+// read or isn't a snapshot of this version. Terrain is cached in 'terrain_cache_path', if given.
+UniquePtr<Simulation> loadSnapshot(const String& path, JobSystem& jobs, const String& terrain_cache_path = "");
+
+// Saves snapshots without holding up the game. The simulation is captured into a buffer between
+// ticks, and then compressed and written out on a background thread while the game carries on.
+// Buffers are reused from one save to the next.
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // Returns false, without saving, if the previous save is still being written.
+    bool save(const Simulation& sim, const String& path);
+
+    bool busy() const {
+        return busy_.load(std::memory_order_acquire);
+    }
+
+    // Wait for the save in progress, if any.
+    void wait();
+
+private:
+    std::thread thread_;
+    std::atomic<bool> busy_;
+    Vector<u8> payload_;
+    String path_;
+};
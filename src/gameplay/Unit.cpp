@@ -1,33 +1,848 @@
 #include "Common.h"
 #include "Unit.h"
+#include "RenderContext.h"
+#include "core/Binary.h"
+#include "core/JobSystem.h"
+#include "world/Visibility.h"
 
-Unit::Unit(const Vec2& position) : position_{position}, orders_{this} {
+namespace {
+const UnitType unit_types[(int)UnitTypeId::Count] = {
+    {"Squad", 50.0f, UnitShape::Circle, {10.0f, 10.0f}, sf::Color{150, 150, 150}},
+    {"Tank", 100.0f, UnitShape::Rectangle, {6.0f, 12.0f}, sf::Color{255, 255, 255}}
+};
+
+const int CIRCLE_SEGMENTS = 8;
+
+// Steering tuning. Overlapping units are pushed apart at SEPARATION_GAIN units per second for each
+// unit of overlap, and avoid collisions predicted up to AVOIDANCE_HORIZON seconds ahead. Units
+// within CONTACT_MARGIN of each other are touching. Crowds settle around a target out to
+// SETTLE_RADIUS.
+const float SEPARATION_GAIN = 8.0f;
+const float AVOIDANCE_HORIZON = 0.5f;
+const float CONTACT_MARGIN = 1.0f;
+const float SETTLE_RADIUS = 160.0f;
+const float EPSILON = 1e-6f;
+
+// Saved in place of a path index for units without a path.
+const u32 INVALID_PATH = ~0u;
+
+// Scratch space for steering a batch of units, reused between ticks. Neighbour data is stored
+// slot-major (slot * count + unit) so the steering kernel's inner loop runs over units.
+struct SteeringScratch {
+    Vector<float> preferred_x, preferred_y, in_range;
+    Vector<float> steer_x, steer_y, blocked;
+    Vector<float> neighbour_x, neighbour_y, neighbour_vx, neighbour_vy;
+    Vector<float> neighbour_radius, neighbour_weight, neighbour_idle;
+
+    void resize(u32 count, u32 slots) {
+        MEMORY_SCOPE(MemoryTag::Units);
+        for (auto array : {&preferred_x, &preferred_y, &in_range, &steer_x, &steer_y, &blocked}) {
+            array->resize(count);
+        }
+        for (auto array : {&neighbour_x, &neighbour_y, &neighbour_vx, &neighbour_vy, &neighbour_radius,
+                           &neighbour_weight, &neighbour_idle}) {
+            array->resize(count * slots);
+        }
+    }
+};
+
+thread_local SteeringScratch tls_steering;
+
+// The kernels below take their arrays as restrict-qualified parameters (rather than locals) so the
+// compiler can rely on them not aliasing. They are branch free, so the loops vectorise.
+
+// Preferred velocity: straight at the target at full speed. Units without an order, or which are
+// in range of their target, prefer to stand still.
+void preferVelocities(u32 count, float arrival_radius, const float* __restrict target_x,
+                      const float* __restrict target_y, const float* __restrict order_active,
+                      const float* __restrict speed, const float* __restrict position_x,
+                      const float* __restrict position_y, float* __restrict preferred_x,
+                      float* __restrict preferred_y, float* __restrict in_range) {
+    for (u32 i = 0; i < count; ++i) {
+        float dx = target_x[i] - position_x[i];
+        float dy = target_y[i] - position_y[i];
+        float distance = std::sqrt(dx * dx + dy * dy);
+        float within = distance < arrival_radius ? 1.0f : 0.0f;
+        float scale = order_active[i] * (1.0f - within) * speed[i] / std::max(distance, arrival_radius);
+        preferred_x[i] = dx * scale;
+        preferred_y[i] = dy * scale;
+        in_range[i] = within;
+    }
+}
+
+// Separation and reciprocal avoidance against each neighbour slot. Neighbour positions and
+// velocities are relative to the unit. Separation pushes overlapping units apart. Avoidance finds
+// the closest approach to each neighbour along the preferred velocity, and if the two would
+// overlap, steers sideways by enough to take half of the overlap away before then (the neighbour
+// is expected to take the other half). A unit near its target and touching an idle neighbour which
+// is nearer still is 'blocked', which lets crowds settle around a shared target.
+void steerVelocities(u32 count, u32 slots, float dt, const float* __restrict preferred_x,
+                     const float* __restrict preferred_y, const float* __restrict target_x,
+                     const float* __restrict target_y, const float* __restrict position_x,
+                     const float* __restrict position_y, const float* __restrict neighbour_x,
+                     const float* __restrict neighbour_y, const float* __restrict neighbour_vx,
+                     const float* __restrict neighbour_vy, const float* __restrict neighbour_radius,
+                     const float* __restrict neighbour_weight, const float* __restrict neighbour_idle,
+                     float* __restrict steer_x, float* __restrict steer_y, float* __restrict blocked) {
+    for (u32 i = 0; i < count; ++i) {
+        steer_x[i] = preferred_x[i];
+        steer_y[i] = preferred_y[i];
+        blocked[i] = 0.0f;
+    }
+    for (u32 slot = 0; slot < slots; ++slot) {
+        const float* __restrict rx = neighbour_x + slot * count;
+        const float* __restrict ry = neighbour_y + slot * count;
+        const float* __restrict nvx = neighbour_vx + slot * count;
+        const float* __restrict nvy = neighbour_vy + slot * count;
+        const float* __restrict radius = neighbour_radius + slot * count;
+        const float* __restrict weight = neighbour_weight + slot * count;
+        const float* __restrict idle = neighbour_idle + slot * count;
+        for (u32 i = 0; i < count; ++i) {
+            float distance = std::sqrt(std::max(rx[i] * rx[i] + ry[i] * ry[i], EPSILON));
+
+            // Separation.
+            float overlap = std::max(radius[i] - distance, 0.0f);
+            float push = weight[i] * SEPARATION_GAIN * overlap / distance;
+            float sx = -rx[i] * push;
+            float sy = -ry[i] * push;
+
+            // Avoidance.
+            float ux = preferred_x[i] - nvx[i];
+            float uy = preferred_y[i] - nvy[i];
+            float t = (rx[i] * ux + ry[i] * uy) / std::max(ux * ux + uy * uy, EPSILON);
+            t = std::min(std::max(t, 0.0f), AVOIDANCE_HORIZON);
+            float cx = rx[i] - ux * t;
+            float cy = ry[i] - uy * t;
+            float closest = std::sqrt(std::max(cx * cx + cy * cy, EPSILON));
+            float miss = std::max(radius[i] - closest, 0.0f);
+            float approaching = t > 0.0f ? 1.0f : 0.0f;
+            float avoid = weight[i] * approaching * 0.5f * miss / (closest * (t + dt));
+
+            steer_x[i] += sx - cx * avoid;
+            steer_y[i] += sy - cy * avoid;
+
+            // Blocked by an idle neighbour nearer to the target.
+            float tx = target_x[i] - position_x[i];
+            float ty = target_y[i] - position_y[i];
+            float touching = distance < radius[i] + CONTACT_MARGIN ? 1.0f : 0.0f;
+            float target_distance_sq = tx * tx + ty * ty;
+            float settling = target_distance_sq < SETTLE_RADIUS * SETTLE_RADIUS ? 1.0f : 0.0f;
+            float nearer = (tx - rx[i]) * (tx - rx[i]) + (ty - ry[i]) * (ty - ry[i]) < target_distance_sq ? 1.0f : 0.0f;
+            blocked[i] = std::max(blocked[i], weight[i] * idle[i] * touching * settling * nearer);
+        }
+    }
+}
+
+// Clamp the steered velocity to the unit's speed. Units in range of their target, or blocked from
+// reaching it, have arrived and stop.
+void resolveVelocities(u32 count, const float* __restrict order_active, const float* __restrict speed,
+                       const float* __restrict in_range, const float* __restrict blocked,
+                       const float* __restrict steer_x, const float* __restrict steer_y,
+                       float* __restrict velocity_x, float* __restrict velocity_y, float* __restrict arrived) {
+    for (u32 i = 0; i < count; ++i) {
+        float done = order_active[i] * std::max(in_range[i], blocked[i]);
+        float length = std::sqrt(steer_x[i] * steer_x[i] + steer_y[i] * steer_y[i]);
+        float scale = (1.0f - done) * std::min(1.0f, speed[i] / std::max(length, EPSILON));
+        velocity_x[i] = steer_x[i] * scale;
+        velocity_y[i] = steer_y[i] * scale;
+        arrived[i] = done;
+    }
+}
+
+void integratePositions(u32 begin, u32 end, float dt, const float* __restrict next_velocity_x,
+                        const float* __restrict next_velocity_y, float* __restrict position_x,
+                        float* __restrict position_y, float* __restrict velocity_x,
+                        float* __restrict velocity_y) {
+    for (u32 i = begin; i < end; ++i) {
+        velocity_x[i] = next_velocity_x[i];
+        velocity_y[i] = next_velocity_y[i];
+        position_x[i] += velocity_x[i] * dt;
+        position_y[i] += velocity_y[i] * dt;
+    }
+}
+}
+
+const UnitType& unitType(UnitTypeId id) {
+    return unit_types[(int)id];
+}
+
+UnitStore::UnitStore() : pathfinder_{nullptr}, checksum_{0}, visibility_{nullptr} {
+}
+
+void UnitStore::setPathfinder(Pathfinder* pathfinder) {
+    pathfinder_ = pathfinder;
+}
+
+void UnitStore::setVisibility(Visibility* visibility) {
+    visibility_ = visibility;
+    for (UnitId i = 0; i < size(); ++i) {
+        site_[i] = next_site_[i] = visibility_ ? visibility_->map().siteIndexAt(position(i)) : INVALID_SITE;
+        if (visibility_) {
+            visibility_->addViewer(owner_[i], site_[i]);
+        }
+    }
+}
+
+void UnitStore::setBounds(const Vec2& min, const Vec2& max) {
+    grid_.reset(min, max, GRID_CELL_SIZE);
+    for (UnitId i = 0; i < size(); ++i) {
+        next_cell_[i] = grid_.cellAt(position(i));
+        grid_.insert(i, next_cell_[i]);
+    }
+}
+
+void UnitStore::reserve(u32 count) {
+    MEMORY_SCOPE(MemoryTag::Units);
+    type_.reserve(count);
+    owner_.reserve(count);
+    position_x_.reserve(count);
+    position_y_.reserve(count);
+    velocity_x_.reserve(count);
+    velocity_y_.reserve(count);
+    speed_.reserve(count);
+    radius_.reserve(count);
+    next_velocity_x_.reserve(count);
+    next_velocity_y_.reserve(count);
+    target_x_.reserve(count);
+    target_y_.reserve(count);
+    order_active_.reserve(count);
+    arrived_.reserve(count);
+    orders_.reserve(count);
+    path_.reserve(count);
+    flow_field_.reserve(count);
+    waypoint_.reserve(count);
+    next_cell_.reserve(count);
+    site_.reserve(count);
+    next_site_.reserve(count);
+    order_finished_.reserve(count);
+    unit_hash_.reserve(count);
+    hashed_moving_.reserve(count);
+}
+
+UnitId UnitStore::create(UnitTypeId type, const Vec2& position, u32 owner) {
+    MEMORY_SCOPE(MemoryTag::Units);
+    UnitId unit = size();
+    type_.push_back(type);
+    owner_.push_back(owner);
+    position_x_.push_back(position.x);
+    position_y_.push_back(position.y);
+    velocity_x_.push_back(0.0f);
+    velocity_y_.push_back(0.0f);
+    speed_.push_back(unitType(type).speed);
+    radius_.push_back(std::max(unitType(type).size.x, unitType(type).size.y) * 0.5f);
+    next_velocity_x_.push_back(0.0f);
+    next_velocity_y_.push_back(0.0f);
+    target_x_.push_back(position.x);
+    target_y_.push_back(position.y);
+    order_active_.push_back(0.0f);
+    arrived_.push_back(0.0f);
+    orders_.emplace_back();
+    path_.emplace_back();
+    flow_field_.emplace_back();
+    waypoint_.push_back(0);
+    next_cell_.push_back(grid_.cellAt(position));
+    grid_.insert(unit, next_cell_.back());
+    site_.push_back(visibility_ ? visibility_->map().siteIndexAt(position) : INVALID_SITE);
+    next_site_.push_back(site_.back());
+    if (visibility_) {
+        visibility_->addViewer(owner, site_.back());
+    }
+    order_finished_.push_back(0);
+    unit_hash_.push_back(0);
+    hashed_moving_.push_back(0);
+    rehash(unit);
+    return unit;
+}
+
+bool UnitStore::addOrder(UnitId unit, const Order& order, bool queue) {
+    // Queueing behind an existing order leaves the current route alone.
+    bool replaces_front = !queue || orders_[unit].empty();
+    bool added = orders_[unit].add(order, queue);
+    if (replaces_front) {
+        loadOrderCursor(unit);
+    }
+    rehash(unit);
+    return added;
+}
+
+u32 UnitStore::addGroupOrder(const Vector<UnitId>& units, const Order& order, bool queue) {
+    Order group_order = order;
+    if (group_order.type == OrderType::Move) {
+        group_order.move.use_flow_field = units.size() >= FLOW_FIELD_GROUP_SIZE;
+    }
+    u32 accepted = 0;
+    for (UnitId unit : units) {
+        if (addOrder(unit, group_order, queue)) {
+            accepted++;
+        }
+    }
+    return accepted;
+}
+
+void UnitStore::clearOrders(UnitId unit) {
+    orders_[unit].clear();
+    loadOrderCursor(unit);
+    rehash(unit);
+}
+
+const OrderList& UnitStore::orders(UnitId unit) const {
+    return orders_[unit];
+}
+
+void UnitStore::tick(float dt, JobSystem& jobs) {
+    PROFILE_SCOPE("UnitStore::tick");
+
+    // Steering reads the positions and velocities of neighbouring units, so every unit steers
+    // before any of them move.
+    jobs.parallelFor(0, size(), STEERING_BATCH_SIZE, [this, dt](u32 begin, u32 end) {
+        PROFILE_SCOPE("UnitStore::steerBatch");
+        tickSteering(begin, end, dt);
+    });
+    jobs.parallelFor(0, size(), TICK_BATCH_SIZE, [this, dt](u32 begin, u32 end) {
+        PROFILE_SCOPE("UnitStore::tickBatch");
+        tickMovement(begin, end, dt);
+        advanceOrders(begin, end);
+        for (u32 i = begin; i < end; ++i) {
+            next_cell_[i] = grid_.cellAt(position(i));
+        }
+        if (visibility_) {
+            const Map& map = visibility_->map();
+            for (u32 i = begin; i < end; ++i) {
+                bool moved = velocity_x_[i] != 0.0f || velocity_y_[i] != 0.0f;
+                next_site_[i] = moved ? map.siteIndexNear(site_[i], position(i)) : site_[i];
+            }
+        }
+        updateChecksum(begin, end);
+    });
+    finishOrders();
+    updateGrid();
+    updateVisibility();
+}
+
+void UnitStore::finishOrders() {
+    PROFILE_SCOPE("UnitStore::finishOrders");
+    // Starting the next order can share or release flow fields, which other units see, so it's
+    // done in unit order rather than from whichever batch gets there first.
+    for (UnitId i = 0; i < size(); ++i) {
+        if (order_finished_[i]) {
+            order_finished_[i] = 0;
+            orders_[i].popFront();
+            loadOrderCursor(i);
+            rehash(i);
+        }
+    }
+}
+
+u64 UnitStore::unitHash(UnitId unit) const {
+    u64 hash = hashMix(unit);
+    hash = hashCombine(hash, (u64(type_[unit]) << 32) | owner_[unit]);
+    hash = hashCombine(hash, (hashFloat(position_x_[unit]) << 32) | hashFloat(position_y_[unit]));
+    hash = hashCombine(hash, (hashFloat(velocity_x_[unit]) << 32) | hashFloat(velocity_y_[unit]));
+    hash = hashCombine(hash, (hashFloat(target_x_[unit]) << 32) | hashFloat(target_y_[unit]));
+    hash = hashCombine(hash, (u64(waypoint_[unit]) << 32) | orders_[unit].size());
+    return hash;
+}
+
+void UnitStore::updateChecksum(u32 begin, u32 end) {
+    // Only units which moved, or which stopped moving, have changed. The checksum is a wrapping
+    // sum, so batches can add their changes in any order. Velocities are compared by their bits,
+    // as a velocity of -0 hashes differently to 0.
+    u64 delta = 0;
+    for (u32 i = begin; i < end; ++i) {
+        bool moving = (hashFloat(velocity_x_[i]) | hashFloat(velocity_y_[i])) != 0;
+        if (moving || hashed_moving_[i] || arrived_[i] > 0.0f) {
+            u64 hash = unitHash(i);
+            delta += hash - unit_hash_[i];
+            unit_hash_[i] = hash;
+            hashed_moving_[i] = moving;
+        }
+    }
+    checksum_.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void UnitStore::rehash(UnitId unit) {
+    u64 hash = unitHash(unit);
+    checksum_.fetch_add(hash - unit_hash_[unit], std::memory_order_relaxed);
+    unit_hash_[unit] = hash;
+}
+
+void UnitStore::saveState(BinaryWriter& writer) const {
+    PROFILE_SCOPE("UnitStore::saveState");
+    u32 count = size();
+    writer.writeU32(count);
+    writer.writeArray(type_);
+    writer.writeArray(owner_);
+    writer.writeArray(position_x_);
+    writer.writeArray(position_y_);
+    writer.writeArray(velocity_x_);
+    writer.writeArray(velocity_y_);
+    writer.writeArray(target_x_);
+    writer.writeArray(target_y_);
+    writer.writeArray(order_active_);
+    writer.writeArray(arrived_);
+    writer.writeArray(waypoint_);
+    writer.writeArray(site_);
+
+    // Orders, as a count per unit followed by every unit's orders in turn.
+    for (auto& orders : orders_) {
+        writer.writeU8((u8)orders.size());
+    }
+    for (auto& orders : orders_) {
+        for (u32 i = 0; i < orders.size(); ++i) {
+            const Order& order = orders[i];
+            writer.writeU8((u8)order.type);
+            switch (order.type) {
+                case OrderType::Move:
+                    writer.writeFloat(order.move.target_x);
+                    writer.writeFloat(order.move.target_y);
+                    writer.writeU8(order.move.use_flow_field ? 1 : 0);
+                    break;
+            }
+        }
+    }
+
+    // Routes. Paths are numbered in order of first use, and flow fields are rebuilt from their
+    // goal.
+    HashMap<const SitePath*, u32> path_indices;
+    Vector<u32> unit_paths(count, INVALID_PATH);
+    Vector<u32> unit_flow_fields(count, INVALID_SITE);
+    Vector<const SitePath*> paths;
+    for (UnitId i = 0; i < count; ++i) {
+        if (path_[i]) {
+            auto inserted = path_indices.emplace(path_[i].get(), (u32)paths.size());
+            if (inserted.second) {
+                paths.push_back(path_[i].get());
+            }
+            unit_paths[i] = inserted.first->second;
+        }
+        if (flow_field_[i]) {
+            unit_flow_fields[i] = flow_field_[i]->goal();
+        }
+    }
+    writer.writeU32((u32)paths.size());
+    for (const SitePath* path : paths) {
+        writer.writeU32((u32)path->size());
+        writer.writeArray(*path);
+    }
+    writer.writeArray(unit_paths);
+    writer.writeArray(unit_flow_fields);
+
+    grid_.saveState(writer);
+}
+
+bool UnitStore::loadState(BinaryReader& reader) {
+    PROFILE_SCOPE("UnitStore::loadState");
+    MEMORY_SCOPE(MemoryTag::Units);
+    u32 count;
+    if (size() != 0 || !reader.readU32(count)) {
+        return false;
+    }
+    if (!reader.readArray(type_, count) || !reader.readArray(owner_, count) ||
+        !reader.readArray(position_x_, count) || !reader.readArray(position_y_, count) ||
+        !reader.readArray(velocity_x_, count) || !reader.readArray(velocity_y_, count) ||
+        !reader.readArray(target_x_, count) || !reader.readArray(target_y_, count) ||
+        !reader.readArray(order_active_, count) || !reader.readArray(arrived_, count) ||
+        !reader.readArray(waypoint_, count) || !reader.readArray(site_, count)) {
+        return false;
+    }
+    const Map* map = pathfinder_ ? &pathfinder_->map() : visibility_ ? &visibility_->map() : nullptr;
+    u32 site_count = map ? (u32)map->sites().size() : 0;
+    for (UnitId i = 0; i < count; ++i) {
+        if (type_[i] >= UnitTypeId::Count || (visibility_ && site_[i] >= site_count)) {
+            return false;
+        }
+    }
+
+    Vector<u8> order_counts;
+    if (!reader.readArray(order_counts, count)) {
+        return false;
+    }
+    orders_.resize(count);
+    for (UnitId i = 0; i < count; ++i) {
+        if (order_counts[i] > ORDER_QUEUE_CAPACITY) {
+            return false;
+        }
+        for (u32 j = 0; j < order_counts[i]; ++j) {
+            u8 type, use_flow_field;
+            Vec2 target;
+            if (!reader.readU8(type) || type != (u8)OrderType::Move || !reader.readFloat(target.x) ||
+                !reader.readFloat(target.y) || !reader.readU8(use_flow_field)) {
+                return false;
+            }
+            orders_[i].add(Order::moveTo(target, use_flow_field != 0), true);
+        }
+    }
+
+    u32 path_count;
+    if (!reader.readU32(path_count) || path_count > reader.remaining()) {
+        return false;
+    }
+    Vector<SharedPtr<const SitePath>> paths(path_count);
+    for (auto& path : paths) {
+        u32 length;
+        auto sites = std::make_shared<SitePath>();
+        if (!reader.readU32(length) || !reader.readArray(*sites, length)) {
+            return false;
+        }
+        for (u32 site : *sites) {
+            if (site >= site_count) {
+                return false;
+            }
+        }
+        path = std::move(sites);
+    }
+    Vector<u32> unit_paths, unit_flow_fields;
+    if (!reader.readArray(unit_paths, count) || !reader.readArray(unit_flow_fields, count)) {
+        return false;
+    }
+    path_.resize(count);
+    flow_field_.resize(count);
+    for (UnitId i = 0; i < count; ++i) {
+        if (unit_paths[i] != INVALID_PATH) {
+            if (unit_paths[i] >= path_count) {
+                return false;
+            }
+            path_[i] = paths[unit_paths[i]];
+        }
+        if (unit_flow_fields[i] != INVALID_SITE) {
+            if (!pathfinder_ || unit_flow_fields[i] >= site_count) {
+                return false;
+            }
+            flow_field_[i] = pathfinder_->findFlowField(unit_flow_fields[i]);
+        }
+    }
+
+    if (!grid_.loadState(reader, count)) {
+        return false;
+    }
+
+    // Everything else is derived from the saved state.
+    speed_.resize(count);
+    radius_.resize(count);
+    for (UnitId i = 0; i < count; ++i) {
+        const UnitType& type = unitType(type_[i]);
+        speed_[i] = type.speed;
+        radius_[i] = std::max(type.size.x, type.size.y) * 0.5f;
+    }
+    next_velocity_x_.assign(count, 0.0f);
+    next_velocity_y_.assign(count, 0.0f);
+    next_cell_.resize(count);
+    for (UnitId i = 0; i < count; ++i) {
+        next_cell_[i] = grid_.cellOf(i);
+    }
+    next_site_ = site_;
+    if (visibility_) {
+        for (UnitId i = 0; i < count; ++i) {
+            visibility_->addViewer(owner_[i], site_[i]);
+        }
+    }
+    order_finished_.assign(count, 0);
+    unit_hash_.assign(count, 0);
+    hashed_moving_.assign(count, 0);
+    for (UnitId i = 0; i < count; ++i) {
+        rehash(i);
+        hashed_moving_[i] = (hashFloat(velocity_x_[i]) | hashFloat(velocity_y_[i])) != 0;
+    }
+    return true;
 }
 
-Unit::~Unit() {
+void UnitStore::updateGrid() {
+    PROFILE_SCOPE("UnitStore::updateGrid");
+    // The cells were found in parallel above. Relinking is cheap, and only needed for the few
+    // units which crossed into another cell this tick.
+    for (UnitId i = 0; i < size(); ++i) {
+        grid_.move(i, next_cell_[i]);
+    }
 }
 
-void Unit::setOwner(WeakPtr<Player> owner)
-{
-	owner_ = owner;
+void UnitStore::tickSteering(u32 begin, u32 end, float dt) {
+    u32 count = end - begin;
+    SteeringScratch& scratch = tls_steering;
+    scratch.resize(count, MAX_NEIGHBOURS);
+
+    preferVelocities(count, ARRIVAL_RADIUS, &target_x_[begin], &target_y_[begin], &order_active_[begin],
+                     &speed_[begin], &position_x_[begin], &position_y_[begin], scratch.preferred_x.data(),
+                     scratch.preferred_y.data(), scratch.in_range.data());
+
+    // Gather the nearest neighbours of each unit into the slots.
+    for (u32 i = 0; i < count; ++i) {
+        UnitId unit = begin + i;
+        Vec2 centre = position(unit);
+        UnitId nearest[MAX_NEIGHBOURS];
+        float nearest_distance_sq[MAX_NEIGHBOURS];
+        u32 found = 0;
+        u32 candidates = 0;
+        grid_.forEachNear(centre, NEIGHBOUR_RADIUS, [&](UnitId other) {
+            float dx = position_x_[other] - centre.x;
+            float dy = position_y_[other] - centre.y;
+            float distance_sq = dx * dx + dy * dy;
+            if (other != unit && distance_sq < NEIGHBOUR_RADIUS * NEIGHBOUR_RADIUS &&
+                (found < MAX_NEIGHBOURS || distance_sq < nearest_distance_sq[found - 1])) {
+                // Insertion sort, dropping the furthest neighbour when full.
+                u32 slot = std::min(found, MAX_NEIGHBOURS - 1);
+                for (; slot > 0 && nearest_distance_sq[slot - 1] > distance_sq; --slot) {
+                    nearest[slot] = nearest[slot - 1];
+                    nearest_distance_sq[slot] = nearest_distance_sq[slot - 1];
+                }
+                nearest[slot] = other;
+                nearest_distance_sq[slot] = distance_sq;
+                found = std::min(found + 1, MAX_NEIGHBOURS);
+            }
+            return ++candidates < MAX_NEIGHBOUR_CANDIDATES;
+        });
+        for (u32 slot = 0; slot < MAX_NEIGHBOURS; ++slot) {
+            u32 index = slot * count + i;
+            UnitId other = slot < found ? nearest[slot] : unit;
+            float dx = position_x_[other] - centre.x;
+            float dy = position_y_[other] - centre.y;
+            if (dx == 0.0f && dy == 0.0f && other != unit) {
+                // Units on exactly the same spot would never be pushed apart. Split them along x,
+                // in opposite directions for each of the pair.
+                dx = other > unit ? 0.01f : -0.01f;
+            }
+            scratch.neighbour_x[index] = dx;
+            scratch.neighbour_y[index] = dy;
+            scratch.neighbour_vx[index] = velocity_x_[other];
+            scratch.neighbour_vy[index] = velocity_y_[other];
+            scratch.neighbour_radius[index] = radius_[unit] + radius_[other];
+            scratch.neighbour_weight[index] = slot < found ? 1.0f : 0.0f;
+            scratch.neighbour_idle[index] = 1.0f - order_active_[other];
+        }
+    }
+
+    steerVelocities(count, MAX_NEIGHBOURS, dt, scratch.preferred_x.data(), scratch.preferred_y.data(),
+                    &target_x_[begin], &target_y_[begin], &position_x_[begin], &position_y_[begin],
+                    scratch.neighbour_x.data(), scratch.neighbour_y.data(), scratch.neighbour_vx.data(),
+                    scratch.neighbour_vy.data(), scratch.neighbour_radius.data(), scratch.neighbour_weight.data(),
+                    scratch.neighbour_idle.data(), scratch.steer_x.data(), scratch.steer_y.data(),
+                    scratch.blocked.data());
+    resolveVelocities(count, &order_active_[begin], &speed_[begin], scratch.in_range.data(), scratch.blocked.data(),
+                      scratch.steer_x.data(), scratch.steer_y.data(), &next_velocity_x_[begin],
+                      &next_velocity_y_[begin], &arrived_[begin]);
+}
+
+void UnitStore::tickMovement(u32 begin, u32 end, float dt) {
+    integratePositions(begin, end, dt, next_velocity_x_.data(), next_velocity_y_.data(), position_x_.data(),
+                       position_y_.data(), velocity_x_.data(), velocity_y_.data());
+}
+
+void UnitStore::advanceOrders(u32 begin, u32 end) {
+    for (u32 i = begin; i < end; ++i) {
+        if (arrived_[i] > 0.0f) {
+            if (waypointSite(i) != INVALID_SITE) {
+                waypoint_[i] = flow_field_[i] ? flow_field_[i]->nextSite(waypoint_[i]) : waypoint_[i] + 1;
+                loadWaypoint(i);
+            } else {
+                order_finished_[i] = 1;
+            }
+        }
+    }
+}
+
+void UnitStore::loadOrderCursor(UnitId unit) {
+    path_[unit].reset();
+    flow_field_[unit].reset();
+    waypoint_[unit] = 0;
+    const OrderList& orders = orders_[unit];
+    if (orders.empty()) {
+        target_x_[unit] = position_x_[unit];
+        target_y_[unit] = position_y_[unit];
+        order_active_[unit] = 0.0f;
+        return;
+    }
+    const Order& order = orders.front();
+    switch (order.type) {
+        case OrderType::Move:
+            if (pathfinder_) {
+                const Map& map = pathfinder_->map();
+                u32 from = map.siteIndexAt(position(unit));
+                u32 to = map.siteIndexAt(order.endPosition());
+                if (from != to) {
+                    // Follow a flow field if the order asks for one, or if another group is
+                    // already using one to the same site.
+                    flow_field_[unit] = order.move.use_flow_field ? pathfinder_->findFlowField(to)
+                                                                  : pathfinder_->sharedFlowField(to);
+                    if (flow_field_[unit]) {
+                        waypoint_[unit] = flow_field_[unit]->nextSite(from);
+                    } else {
+                        // The unit is already in the first site of the path.
+                        path_[unit] = pathfinder_->findPath(from, to);
+                        waypoint_[unit] = 1;
+                    }
+                }
+            }
+            order_active_[unit] = 1.0f;
+            loadWaypoint(unit);
+            break;
+    }
+}
+
+void UnitStore::loadWaypoint(UnitId unit) {
+    // Move through the centre of each site along the route, then on to the order target once in
+    // the final site.
+    u32 site_index = waypointSite(unit);
+    if (site_index != INVALID_SITE) {
+        const Map::Site& site = pathfinder_->map().sites()[site_index];
+        target_x_[unit] = site.centre.x;
+        target_y_[unit] = site.centre.y;
+    } else {
+        Vec2 target = orders_[unit].front().endPosition();
+        target_x_[unit] = target.x;
+        target_y_[unit] = target.y;
+    }
 }
 
-void Unit::addOrder(UniquePtr<Order> order, bool queue) {
-    orders_.add(std::move(order), queue);
+u32 UnitStore::waypointSite(UnitId unit) const {
+    if (const FlowField* field = flow_field_[unit].get()) {
+        u32 site = waypoint_[unit];
+        return site != field->goal() ? site : INVALID_SITE;
+    }
+    if (const SitePath* path = path_[unit].get()) {
+        return waypoint_[unit] + 1 < path->size() ? (*path)[waypoint_[unit]] : INVALID_SITE;
+    }
+    return INVALID_SITE;
 }
 
-void Unit::stepTowards(float dt, const Vec2& direction, float factor)
-{
-    position_ += direction * factor * speed() * dt;
+void UnitStore::updateVisibility() {
+    if (!visibility_) {
+        return;
+    }
+    PROFILE_SCOPE("UnitStore::updateVisibility");
+    // Only units which crossed into another site this tick change what their owner can see.
+    for (UnitId i = 0; i < size(); ++i) {
+        if (next_site_[i] != site_[i]) {
+            visibility_->moveViewer(owner_[i], site_[i], next_site_[i]);
+            site_[i] = next_site_[i];
+        }
+    }
 }
 
-void Unit::tick(float dt) {
-    orders_.tick(dt);
+bool UnitStore::isHidden(const RenderContext& ctx, UnitId unit) const {
+    return ctx.visibility && site_[unit] != INVALID_SITE && !ctx.visibility->isVisible(ctx.viewer, site_[unit]);
 }
 
-void Unit::draw(RenderContext&) {
+UnitId UnitStore::pick(const Vec2& point) const {
+    // Search far enough to find the largest unit type.
+    float max_radius = 0.0f;
+    for (int t = 0; t < (int)UnitTypeId::Count; ++t) {
+        max_radius = std::max(max_radius, std::max(unit_types[t].size.x, unit_types[t].size.y) * 0.5f);
+    }
+    UnitId picked = INVALID_UNIT;
+    float picked_distance_sq = 0.0f;
+    Vec2 extent{max_radius, max_radius};
+    grid_.forEachInRect(point - extent, point + extent, [&](UnitId unit) {
+        float radius = radius_[unit];
+        float dx = position_x_[unit] - point.x;
+        float dy = position_y_[unit] - point.y;
+        float distance_sq = dx * dx + dy * dy;
+        if (distance_sq <= radius * radius && (picked == INVALID_UNIT || distance_sq < picked_distance_sq)) {
+            picked = unit;
+            picked_distance_sq = distance_sq;
+        }
+    });
+    return picked;
 }
 
-void Unit::drawOrderOverlay(RenderContext& ctx) {
-    orders_.draw(ctx);
+void UnitStore::queryRect(const Vec2& min, const Vec2& max, Vector<UnitId>& units) const {
+    units.clear();
+    grid_.forEachInRect(min, max, [&](UnitId unit) {
+        float x = position_x_[unit], y = position_y_[unit];
+        if (x >= min.x && x <= max.x && y >= min.y && y <= max.y) {
+            units.push_back(unit);
+        }
+    });
+}
+
+void UnitStore::queryRadius(const Vec2& centre, float radius, Vector<UnitId>& units) const {
+    units.clear();
+    float radius_sq = radius * radius;
+    Vec2 extent{radius, radius};
+    grid_.forEachInRect(centre - extent, centre + extent, [&](UnitId unit) {
+        float dx = position_x_[unit] - centre.x;
+        float dy = position_y_[unit] - centre.y;
+        if (dx * dx + dy * dy <= radius_sq) {
+            units.push_back(unit);
+        }
+    });
+}
+
+UnitId UnitStore::findTarget(UnitId unit, float range) const {
+    // Target acquisition scans outwards, so a unit in a crowd only looks at its own neighbourhood.
+    Vector<UnitId> targets;
+    u32 owner = owner_[unit];
+    queryNearest(position(unit), 1, range, targets, [this, owner](UnitId other) { return owner_[other] != owner; });
+    return targets.empty() ? INVALID_UNIT : targets.front();
+}
+
+void UnitStore::draw(RenderContext& ctx) {
+    PROFILE_SCOPE("UnitStore::draw");
+
+    // Batch every unit into a single triangle list.
+    Vector<sf::Vertex>& vertices = draw_vertices_;
+    vertices.clear();
+    for (UnitId i = 0; i < size(); ++i) {
+        if (isHidden(ctx, i)) {
+            continue;
+        }
+        const UnitType& type = unitType(type_[i]);
+        Vec2 centre = position(i);
+        Vec2 half_size = type.size * 0.5f;
+        switch (type.shape) {
+            case UnitShape::Circle:
+                for (int s = 0; s < CIRCLE_SEGMENTS; ++s) {
+                    float a0 = 2.0f * PI * float(s) / CIRCLE_SEGMENTS;
+                    float a1 = 2.0f * PI * float(s + 1) / CIRCLE_SEGMENTS;
+                    vertices.emplace_back(toSFML(centre), type.colour);
+                    vertices.emplace_back(toSFML(centre + Vec2{cos(a0), sin(a0)} * half_size), type.colour);
+                    vertices.emplace_back(toSFML(centre + Vec2{cos(a1), sin(a1)} * half_size), type.colour);
+                }
+                break;
+            case UnitShape::Rectangle: {
+                Vec2 a = centre - half_size;
+                Vec2 b = centre + half_size;
+                vertices.emplace_back(toSFML(a), type.colour);
+                vertices.emplace_back(toSFML(Vec2{b.x, a.y}), type.colour);
+                vertices.emplace_back(toSFML(b), type.colour);
+                vertices.emplace_back(toSFML(a), type.colour);
+                vertices.emplace_back(toSFML(b), type.colour);
+                vertices.emplace_back(toSFML(Vec2{a.x, b.y}), type.colour);
+            } break;
+        }
+    }
+    ctx.window->draw(vertices.data(), vertices.size(), sf::Triangles);
+}
+
+void UnitStore::drawOrderOverlay(RenderContext& ctx) {
+    const sf::Color path_colour{255, 220, 120, 160};
+    Vector<sf::Vertex> path_vertices;
+    for (UnitId i = 0; i < size(); ++i) {
+        if (isHidden(ctx, i)) {
+            continue;
+        }
+        if (!orders_[i].empty()) {
+            orders_[i].draw(ctx, position(i));
+        }
+
+        // Draw the remaining route of the current order.
+        if (path_[i] || flow_field_[i]) {
+            Vec2 previous = position(i);
+            u32 waypoint = waypoint_[i];
+            for (u32 site = waypointSite(i); site != INVALID_SITE;) {
+                Vec2 next = pathfinder_->map().sites()[site].centre;
+                path_vertices.emplace_back(toSFML(previous), path_colour);
+                path_vertices.emplace_back(toSFML(next), path_colour);
+                previous = next;
+                if (const FlowField* field = flow_field_[i].get()) {
+                    waypoint = field->nextSite(waypoint);
+                    site = waypoint != field->goal() ? waypoint : INVALID_SITE;
+                } else {
+                    waypoint++;
+                    site = waypoint + 1 < path_[i]->size() ? (*path_[i])[waypoint] : INVALID_SITE;
+                }
+            }
+            path_vertices.emplace_back(toSFML(previous), path_colour);
+            path_vertices.emplace_back(toSFML(orders_[i].front().endPosition()), path_colour);
+        }
+    }
+    ctx.window->draw(path_vertices.data(), path_vertices.size(), sf::Lines);
 }
@@ -1,32 +1,271 @@
 #pragma once
 
 #include "Orders.h"
+#include "UnitGrid.h"
+#include "world/Pathfinder.h"
 
-class World;
-class Player;
+struct RenderContext;
+class JobSystem;
+class BinaryWriter;
+class BinaryReader;
+class Visibility;
 
-class Unit {
+enum class UnitShape : u8 {
+    Circle,
+    Rectangle
+};
+
+// Static description of a kind of unit. Unit behaviour is driven by this data, rather than by
+// subclassing.
+struct UnitType {
+    String name;
+    float speed;
+    UnitShape shape;
+    Vec2 size;
+    sf::Color colour;
+};
+
+enum class UnitTypeId : u8 {
+    Squad,
+    Tank,
+    Count
+};
+
+const UnitType& unitType(UnitTypeId id);
+
+// Storage for every unit in the game, laid out as parallel arrays indexed by UnitId so that the
+// per-tick movement update is a tight loop over contiguous memory.
+class UnitStore {
 public:
-    Unit(const Vec2& position);
-    virtual ~Unit();
+    UnitStore();
+
+    UnitStore(const UnitStore&) = delete;
+    UnitStore& operator=(const UnitStore&) = delete;
+
+    // Move orders are routed through the site graph with this pathfinder. Without one, units move
+    // in a straight line.
+    void setPathfinder(Pathfinder* pathfinder);
+
+    // Units reveal the sites around them to their owner. Units track the site they are in while
+    // this is set.
+    void setVisibility(Visibility* visibility);
+
+    // Size the spatial grid to cover this area.
+    void setBounds(const Vec2& min, const Vec2& max);
+
+    void reserve(u32 count);
+    UnitId create(UnitTypeId type, const Vec2& position, u32 owner);
 
-	void setOwner(WeakPtr<Player> owner);
+    u32 size() const {
+        return (u32)position_x_.size();
+    }
 
-    void addOrder(UniquePtr<Order> order, bool queue);
+    // Groups at least this large move with a shared flow field rather than a path per unit.
+    static const u32 FLOW_FIELD_GROUP_SIZE = 64;
 
-    void stepTowards(float dt, const Vec2& direction, float factor);
+    bool addOrder(UnitId unit, const Order& order, bool queue);
+    // Returns the number of units which accepted the order. A unit which already has
+    // ORDER_QUEUE_CAPACITY orders queued drops a queued order.
+    u32 addGroupOrder(const Vector<UnitId>& units, const Order& order, bool queue);
+    void clearOrders(UnitId unit);
+    const OrderList& orders(UnitId unit) const;
 
-    virtual void tick(float dt);
-    virtual void draw(RenderContext& ctx) = 0;
+    // Advance every unit by 'dt' seconds, in parallel batches. Units are split into batches of a
+    // fixed size, and anything one unit does which other units can see is done in unit order,
+    // so the result doesn't depend on the number of workers.
+    void tick(float dt, JobSystem& jobs);
+
+    // Hash of the state of every unit, updated as units change.
+    u64 checksum() const {
+        return checksum_.load(std::memory_order_relaxed);
+    }
+
+    // Snapshots. Each array is saved as one block, and read back with one copy. Routes shared by
+    // several units are saved once, and referred to by index. Loading requires an empty store,
+    // set up with the same pathfinder, visibility and bounds as the one saved.
+    void saveState(BinaryWriter& writer) const;
+    bool loadState(BinaryReader& reader);
+
+    void draw(RenderContext& ctx);
     void drawOrderOverlay(RenderContext& ctx);
 
-    virtual float speed() const = 0;
+    Vec2 position(UnitId unit) const {
+        return {position_x_[unit], position_y_[unit]};
+    }
+
+    Vec2 velocity(UnitId unit) const {
+        return {velocity_x_[unit], velocity_y_[unit]};
+    }
+
+    UnitTypeId type(UnitId unit) const {
+        return type_[unit];
+    }
+
+    u32 owner(UnitId unit) const {
+        return owner_[unit];
+    }
+
+    // The site the unit is in, or INVALID_SITE if there's no visibility to track sites for.
+    u32 site(UnitId unit) const {
+        return site_[unit];
+    }
+
+    // Spatial queries. These are answered from a grid which is updated as units move, so only
+    // visit the units near the area being queried.
+    const UnitGrid& grid() const {
+        return grid_;
+    }
+
+    // The unit under 'point', or INVALID_UNIT. The nearest unit wins if shapes overlap.
+    UnitId pick(const Vec2& point) const;
+
+    // Units with their centre inside the rectangle [min, max].
+    void queryRect(const Vec2& min, const Vec2& max, Vector<UnitId>& units) const;
+
+    // Units with their centre within 'radius' of 'centre'.
+    void queryRadius(const Vec2& centre, float radius, Vector<UnitId>& units) const;
+
+    // Up to 'count' units within 'max_radius' of 'centre' which pass 'filter(unit)', nearest first.
+    template <typename Filter>
+    void queryNearest(const Vec2& centre, u32 count, float max_radius, Vector<UnitId>& units, const Filter& filter) const;
+
+    void queryNearest(const Vec2& centre, u32 count, float max_radius, Vector<UnitId>& units) const {
+        queryNearest(centre, count, max_radius, units, [](UnitId) { return true; });
+    }
+
+    // The nearest unit owned by another player within 'range' of 'unit', or INVALID_UNIT.
+    UnitId findTarget(UnitId unit, float range) const;
+
+private:
+    // Units closer than this to their order target have completed the order.
+    static constexpr float ARRIVAL_RADIUS = 5.0f;
+
+    // Number of units ticked by each job.
+    static const u32 TICK_BATCH_SIZE = 4096;
+    static const u32 STEERING_BATCH_SIZE = 1024;
+
+    // Size of each spatial grid cell. A few times larger than a unit.
+    static constexpr float GRID_CELL_SIZE = 16.0f;
+
+    // Steering considers the nearest MAX_NEIGHBOURS units within NEIGHBOUR_RADIUS, found among at
+    // most MAX_NEIGHBOUR_CANDIDATES units from the grid, so each unit does bounded work however
+    // dense the crowd.
+    static const u32 MAX_NEIGHBOURS = 8;
+    static const u32 MAX_NEIGHBOUR_CANDIDATES = 32;
+    static constexpr float NEIGHBOUR_RADIUS = 20.0f;
+
+    Vector<UnitTypeId> type_;
+    Vector<u32> owner_;
+    Vector<float> position_x_;
+    Vector<float> position_y_;
+    Vector<float> velocity_x_;
+    Vector<float> velocity_y_;
+    Vector<float> speed_;
+    Vector<float> radius_;
+
+    // Velocity chosen by steering this tick. Kept apart from 'velocity_' until every unit has
+    // steered, as neighbours read each other's velocity from the previous tick.
+    Vector<float> next_velocity_x_;
+    Vector<float> next_velocity_y_;
+
+    // Order cursor. The target of the order at the front of each unit's queue is cached here so
+    // the movement kernel never touches the order queues. 'order_active_' and 'arrived_' are 1.0
+    // or 0.0.
+    Vector<float> target_x_;
+    Vector<float> target_y_;
+    Vector<float> order_active_;
+    Vector<float> arrived_;
+    Vector<OrderList> orders_;
+
+    // Route of the order at the front of each unit's queue. Units follow either a path of their
+    // own, or a flow field shared with every unit heading to the same site. 'waypoint_' is the
+    // index of the path entry being moved towards, or the site when following a flow field. With
+    // neither, units move directly to the order target.
+    Pathfinder* pathfinder_;
+    Vector<SharedPtr<const SitePath>> path_;
+    Vector<SharedPtr<const FlowField>> flow_field_;
+    Vector<u32> waypoint_;
+
+    // Spatial grid, and the cell each unit moved into during the last tick.
+    UnitGrid grid_;
+    Vector<u32> next_cell_;
+
+    // Set when a unit completes its current order. The next order is started after the batches
+    // finish.
+    Vector<u8> order_finished_;
+
+    // The checksum is the wrapping sum of a hash of each unit. 'hashed_moving_' is set if the
+    // unit was moving when it was last hashed.
+    std::atomic<u64> checksum_;
+    Vector<u64> unit_hash_;
+    Vector<u8> hashed_moving_;
+
+    // Site each unit is in, and the site it moved into during the last tick.
+    Visibility* visibility_;
+    Vector<u32> site_;
+    Vector<u32> next_site_;
+
+    // Rendering data.
+    Vector<sf::Vertex> draw_vertices_;
 
-    const Vec2& position() const { return position_; }
+    void tickSteering(u32 begin, u32 end, float dt);
+    void tickMovement(u32 begin, u32 end, float dt);
+    void advanceOrders(u32 begin, u32 end);
+    void loadOrderCursor(UnitId unit);
+    void loadWaypoint(UnitId unit);
+    u32 waypointSite(UnitId unit) const;
+    void finishOrders();
+    void updateGrid();
+    void updateVisibility();
+    u64 unitHash(UnitId unit) const;
+    void updateChecksum(u32 begin, u32 end);
+    void rehash(UnitId unit);
+    bool isHidden(const RenderContext& ctx, UnitId unit) const;
+};
 
-protected:
-    Vec2 position_;
-    OrderList orders_;
+template <typename Filter>
+void UnitStore::queryNearest(const Vec2& centre, u32 count, float max_radius, Vector<UnitId>& units,
+                             const Filter& filter) const {
+    units.clear();
+    if (count == 0) {
+        return;
+    }
 
-	WeakPtr<Player> owner_;
-};
\ No newline at end of file
+    // Search outwards a ring of cells at a time, keeping the best 'count' candidates in a max-heap
+    // on distance. Every unit in ring r is at least (r - 1) cells away, so stop once that is
+    // further than the worst candidate.
+    Vector<Pair<float, UnitId>> nearest;
+    float max_distance_sq = max_radius * max_radius;
+    auto visit = [&](UnitId unit) {
+        float dx = position_x_[unit] - centre.x;
+        float dy = position_y_[unit] - centre.y;
+        float distance_sq = dx * dx + dy * dy;
+        if (distance_sq > max_distance_sq || !filter(unit)) {
+            return;
+        }
+        if (nearest.size() < count) {
+            nearest.emplace_back(distance_sq, unit);
+            std::push_heap(nearest.begin(), nearest.end());
+        } else if (distance_sq < nearest.front().first) {
+            std::pop_heap(nearest.begin(), nearest.end());
+            nearest.back() = {distance_sq, unit};
+            std::push_heap(nearest.begin(), nearest.end());
+        }
+    };
+    for (u32 ring = 0;; ++ring) {
+        float ring_distance = float(ring > 0 ? ring - 1 : 0) * grid_.cellSize();
+        if (ring_distance > max_radius) {
+            break;
+        }
+        if (nearest.size() == count && ring_distance * ring_distance > nearest.front().first) {
+            break;
+        }
+        if (!grid_.forEachInRing(centre, ring, visit)) {
+            break;
+        }
+    }
+    std::sort_heap(nearest.begin(), nearest.end());
+    for (auto& entry : nearest) {
+        units.push_back(entry.second);
+    }
+}
@@ -0,0 +1,106 @@
+#include "Common.h"
+#include "UnitGrid.h"
+#include "core/Binary.h"
+
+const u32 UnitGrid::INVALID_CELL;
+
+UnitGrid::UnitGrid() {
+    reset({0.0f, 0.0f}, {1.0f, 1.0f}, 1.0f);
+}
+
+void UnitGrid::reset(const Vec2& min, const Vec2& max, float cell_size) {
+    MEMORY_SCOPE(MemoryTag::Units);
+    min_ = min;
+    cell_size_ = cell_size;
+    inv_cell_size_ = 1.0f / cell_size;
+    width_ = std::max(u32(std::ceil((max.x - min.x) * inv_cell_size_)), 1u);
+    height_ = std::max(u32(std::ceil((max.y - min.y) * inv_cell_size_)), 1u);
+    cell_head_.assign(width_ * height_, INVALID_UNIT);
+    unit_cell_.clear();
+    unit_next_.clear();
+    unit_prev_.clear();
+}
+
+void UnitGrid::insert(UnitId unit, u32 cell) {
+    if (unit >= unit_cell_.size()) {
+        MEMORY_SCOPE(MemoryTag::Units);
+        unit_cell_.resize(unit + 1, INVALID_CELL);
+        unit_next_.resize(unit + 1, INVALID_UNIT);
+        unit_prev_.resize(unit + 1, INVALID_UNIT);
+    }
+    unit_cell_[unit] = cell;
+    unit_prev_[unit] = INVALID_UNIT;
+    unit_next_[unit] = cell_head_[cell];
+    if (cell_head_[cell] != INVALID_UNIT) {
+        unit_prev_[cell_head_[cell]] = unit;
+    }
+    cell_head_[cell] = unit;
+}
+
+void UnitGrid::move(UnitId unit, u32 cell) {
+    if (unit_cell_[unit] != cell) {
+        unlink(unit);
+        insert(unit, cell);
+    }
+}
+
+void UnitGrid::saveState(BinaryWriter& writer) const {
+    writer.writeU32((u32)cell_head_.size());
+    writer.writeArray(cell_head_);
+    writer.writeU32((u32)unit_cell_.size());
+    writer.writeArray(unit_cell_);
+    writer.writeArray(unit_next_);
+    writer.writeArray(unit_prev_);
+}
+
+bool UnitGrid::loadState(BinaryReader& reader, u32 unit_count) {
+    MEMORY_SCOPE(MemoryTag::Units);
+    u32 cell_count, unit_cell_count;
+    if (!reader.readU32(cell_count) || cell_count != cell_head_.size() || !reader.readArray(cell_head_, cell_count) ||
+        !reader.readU32(unit_cell_count) || unit_cell_count != unit_count ||
+        !reader.readArray(unit_cell_, unit_count) || !reader.readArray(unit_next_, unit_count) ||
+        !reader.readArray(unit_prev_, unit_count)) {
+        return false;
+    }
+    // Check every link stays in range, so a bad snapshot can't send queries off the end.
+    for (UnitId head : cell_head_) {
+        if (head != INVALID_UNIT && head >= unit_count) {
+            return false;
+        }
+    }
+    for (u32 i = 0; i < unit_count; ++i) {
+        if (unit_cell_[i] >= cell_count || (unit_next_[i] != INVALID_UNIT && unit_next_[i] >= unit_count) ||
+            (unit_prev_[i] != INVALID_UNIT && unit_prev_[i] >= unit_count)) {
+            return false;
+        }
+    }
+    // Check the lists are consistent too, as a cycle would make every query on that cell loop
+    // forever. Each unit must be linked into its own cell exactly once, with matching back links.
+    Vector<bool> visited(unit_count, false);
+    u32 visited_count = 0;
+    for (u32 cell = 0; cell < cell_count; ++cell) {
+        UnitId prev = INVALID_UNIT;
+        for (UnitId unit = cell_head_[cell]; unit != INVALID_UNIT; unit = unit_next_[unit]) {
+            if (visited[unit] || unit_cell_[unit] != cell || unit_prev_[unit] != prev) {
+                return false;
+            }
+            visited[unit] = true;
+            visited_count++;
+            prev = unit;
+        }
+    }
+    return visited_count == unit_count;
+}
+
+void UnitGrid::unlink(UnitId unit) {
+    UnitId prev = unit_prev_[unit];
+    UnitId next = unit_next_[unit];
+    if (prev != INVALID_UNIT) {
+        unit_next_[prev] = next;
+    } else {
+        cell_head_[unit_cell_[unit]] = next;
+    }
+    if (next != INVALID_UNIT) {
+        unit_prev_[next] = prev;
+    }
+}
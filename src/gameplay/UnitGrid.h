@@ -0,0 +1,131 @@
+#pragma once
+
+class BinaryWriter;
+class BinaryReader;
+
+using UnitId = u32;
+const UnitId INVALID_UNIT = ~0u;
+
+// A uniform grid over the world, with each cell holding an intrusive list of the units inside it.
+// Moving a unit between cells is O(1) and never allocates, so the grid is kept up to date
+// incrementally as units move. Units outside of the bounds are kept in the nearest edge cell.
+//
+// The grid only knows which cell each unit is in. Queries visit every unit in the cells which
+// overlap an area, and callers filter by the unit's actual position.
+class UnitGrid {
+public:
+    static const u32 INVALID_CELL = ~0u;
+
+    UnitGrid();
+
+    // Remove every unit and change the area covered by the grid.
+    void reset(const Vec2& min, const Vec2& max, float cell_size);
+
+    void insert(UnitId unit, u32 cell);
+    void move(UnitId unit, u32 cell);
+
+    // Snapshots. The lists are saved as they are, so queries visit units in the same order after
+    // loading. Loading requires the grid to have been reset to the same area.
+    void saveState(BinaryWriter& writer) const;
+    bool loadState(BinaryReader& reader, u32 unit_count);
+
+    u32 cellAt(const Vec2& position) const {
+        return cellY(position.y) * width_ + cellX(position.x);
+    }
+
+    u32 cellOf(UnitId unit) const {
+        return unit_cell_[unit];
+    }
+
+    float cellSize() const {
+        return cell_size_;
+    }
+
+    // Call 'fn(unit)' for every unit in the cells overlapping the rectangle [min, max].
+    template <typename F>
+    void forEachInRect(const Vec2& min, const Vec2& max, const F& fn) const {
+        u32 x0 = cellX(min.x), x1 = cellX(max.x);
+        u32 y0 = cellY(min.y), y1 = cellY(max.y);
+        for (u32 y = y0; y <= y1; ++y) {
+            for (u32 x = x0; x <= x1; ++x) {
+                forEachInCell(y * width_ + x, fn);
+            }
+        }
+    }
+
+    // Call 'fn(unit)' for every unit in the ring of cells 'ring' cells away from the cell
+    // containing 'centre'. Returns false once the ring lies entirely outside of the grid.
+    template <typename F>
+    bool forEachInRing(const Vec2& centre, u32 ring, const F& fn) const {
+        int cx = (int)cellX(centre.x), cy = (int)cellY(centre.y), r = (int)ring;
+        if (cx - r < 0 && cy - r < 0 && cx + r >= (int)width_ && cy + r >= (int)height_) {
+            return false;
+        }
+        for (int y = cy - r; y <= cy + r; ++y) {
+            if (y < 0 || y >= (int)height_) {
+                continue;
+            }
+            bool edge_row = y == cy - r || y == cy + r;
+            for (int x = cx - r; x <= cx + r; x += edge_row || r == 0 ? 1 : 2 * r) {
+                if (x >= 0 && x < (int)width_) {
+                    forEachInCell(u32(y * (int)width_ + x), fn);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Call 'fn(unit)' for units in the cells within 'radius' of the cell containing 'centre',
+    // nearest cells first, until it returns false. Used where the work per query must be bounded
+    // however crowded the area is.
+    template <typename F>
+    void forEachNear(const Vec2& centre, float radius, const F& fn) const {
+        int cx = (int)cellX(centre.x), cy = (int)cellY(centre.y);
+        int rings = (int)std::ceil(radius * inv_cell_size_);
+        for (int r = 0; r <= rings; ++r) {
+            for (int y = std::max(cy - r, 0); y <= std::min(cy + r, (int)height_ - 1); ++y) {
+                bool edge_row = y == cy - r || y == cy + r;
+                for (int x = cx - r; x <= cx + r; x += edge_row || r == 0 ? 1 : 2 * r) {
+                    if (x < 0 || x >= (int)width_) {
+                        continue;
+                    }
+                    for (UnitId unit = cell_head_[y * width_ + x]; unit != INVALID_UNIT; unit = unit_next_[unit]) {
+                        if (!fn(unit)) {
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename F>
+    void forEachInCell(u32 cell, const F& fn) const {
+        for (UnitId unit = cell_head_[cell]; unit != INVALID_UNIT; unit = unit_next_[unit]) {
+            fn(unit);
+        }
+    }
+
+private:
+    Vec2 min_;
+    float cell_size_;
+    float inv_cell_size_;
+    u32 width_;
+    u32 height_;
+
+    // First unit in each cell, and the doubly linked list of units through each cell.
+    Vector<UnitId> cell_head_;
+    Vector<u32> unit_cell_;
+    Vector<UnitId> unit_next_;
+    Vector<UnitId> unit_prev_;
+
+    u32 cellX(float x) const {
+        return (u32)std::min(std::max(int((x - min_.x) * inv_cell_size_), 0), (int)width_ - 1);
+    }
+
+    u32 cellY(float y) const {
+        return (u32)std::min(std::max(int((y - min_.y) * inv_cell_size_), 0), (int)height_ - 1);
+    }
+
+    void unlink(UnitId unit);
+};
@@ -5,9 +5,263 @@
 #include "Common.h"
 
 #include "math/Noise.h"
+#include "math/Simd.h"
 
 #include <random>
 #include <numeric>
+#include <mutex>
+
+const u32 PermutationTable::SIZE;
+const u32 PermutationTable::PADDING;
+
+namespace {
+// Permutation vector from the reference implementation.
+constexpr u8 REFERENCE_PERMUTATION[256] = {
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,   225, 140, 36,
+    103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190, 6,   148, 247, 120, 234, 75,
+    0,   26,  197, 62,  94,  252, 219, 203, 117, 35,  11,  32,  57,  177, 33,  88,  237, 149,
+    56,  87,  174, 20,  125, 136, 171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166,
+    77,  146, 158, 231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
+    245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209, 76,  132, 187,
+    208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,  164, 100, 109, 198, 173, 186,
+    3,   64,  52,  217, 226, 250, 124, 123, 5,   202, 38,  147, 118, 126, 255, 82,  85,  212,
+    207, 206, 59,  227, 47,  16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248,
+    152, 2,   44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
+    19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,  228, 251, 34,
+    242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,  145, 235, 249, 14,  239, 107,
+    49,  192, 214, 31,  181, 199, 106, 157, 184, 84,  204, 176, 115, 121, 50,  45,  127, 4,
+    150, 254, 138, 236, 205, 93,  222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,
+    215, 61,  156, 180};
+
+// Fill the second half of a table with a copy of the first.
+void repeatPermutation(PermutationTable& table) {
+    std::copy(table.values, table.values + 256, table.values + 256);
+    std::fill(table.values + PermutationTable::SIZE, std::end(table.values), 0);
+}
+
+// Seeded tables in use, by seed.
+std::mutex seeded_tables_mutex;
+HashMap<uint, WeakPtr<const PermutationTable>> seeded_tables;
+
+// Expired entries are pruned whenever the registry grows to this size, which then doubles the
+// live count so pruning stays amortised constant time per lookup.
+const size_t SEEDED_TABLES_MIN_PRUNE_SIZE = 16;
+size_t seeded_tables_prune_size = SEEDED_TABLES_MIN_PRUNE_SIZE;
+
+// Samples per block in batched fBm.
+const size_t FBM_BLOCK_SIZE = 256;
+
+// Float versions of the reference functions, for batches.
+float fadeFloat(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float lerpFloat(float t, float a, float b) {
+    return a + t * (b - a);
+}
+
+float gradFloat(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    float u = h < 8 ? x : y, v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+}
+
+void perlinScalar(const u8* p, const float* xs, const float* ys, const float* zs, float* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        float fx = std::floor(xs[i]), fy = std::floor(ys[i]), fz = std::floor(zs[i]);
+        int X = (int)fx & 255, Y = (int)fy & 255, Z = (int)fz & 255;
+        float x = xs[i] - fx, y = ys[i] - fy, z = zs[i] - fz;
+        float u = fadeFloat(x), v = fadeFloat(y), w = fadeFloat(z);
+        int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+        int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+        float res = lerpFloat(
+            w,
+            lerpFloat(v, lerpFloat(u, gradFloat(p[AA], x, y, z), gradFloat(p[BA], x - 1, y, z)),
+                      lerpFloat(u, gradFloat(p[AB], x, y - 1, z), gradFloat(p[BB], x - 1, y - 1, z))),
+            lerpFloat(v, lerpFloat(u, gradFloat(p[AA + 1], x, y, z - 1), gradFloat(p[BA + 1], x - 1, y, z - 1)),
+                      lerpFloat(u, gradFloat(p[AB + 1], x, y - 1, z - 1), gradFloat(p[BB + 1], x - 1, y - 1, z - 1))));
+        out[i] = (res + 1.0f) * 0.5f;
+    }
+}
+
+#ifdef SIMD_X86
+// The kernels below follow perlinScalar lane for lane, and return how many samples they did,
+// leaving any remainder smaller than a vector to it. Gradients are selected with blends rather
+// than branches, and negated by flipping the sign bit.
+SIMD_TARGET_SSE41 inline __m128i gather4(const u8* table, __m128i indices) {
+    alignas(16) int i[4];
+    _mm_store_si128((__m128i*)i, indices);
+    return _mm_setr_epi32(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+}
+
+SIMD_TARGET_SSE41 inline __m128 fade4(__m128 t) {
+    __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))),
+                              _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+SIMD_TARGET_SSE41 inline __m128 lerp4(__m128 t, __m128 a, __m128 b) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+SIMD_TARGET_SSE41 inline __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z) {
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    __m128 below_8 = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(8), h));
+    __m128 below_4 = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(4), h));
+    __m128 is_12_or_14 = _mm_castsi128_ps(
+        _mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+    __m128 u = _mm_blendv_ps(y, x, below_8);
+    __m128 v = _mm_blendv_ps(_mm_blendv_ps(z, x, is_12_or_14), y, below_4);
+    __m128 u_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128 v_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, u_sign), _mm_xor_ps(v, v_sign));
+}
+
+SIMD_TARGET_SSE41 size_t perlinSSE41(const u8* p, const float* xs, const float* ys, const float* zs, float* out,
+                                     size_t count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i one_i = _mm_set1_epi32(1);
+    const __m128i mask = _mm_set1_epi32(255);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i), y = _mm_loadu_ps(ys + i), z = _mm_loadu_ps(zs + i);
+        __m128 fx = _mm_floor_ps(x), fy = _mm_floor_ps(y), fz = _mm_floor_ps(z);
+        __m128i X = _mm_and_si128(_mm_cvttps_epi32(fx), mask);
+        __m128i Y = _mm_and_si128(_mm_cvttps_epi32(fy), mask);
+        __m128i Z = _mm_and_si128(_mm_cvttps_epi32(fz), mask);
+        x = _mm_sub_ps(x, fx);
+        y = _mm_sub_ps(y, fy);
+        z = _mm_sub_ps(z, fz);
+        __m128 u = fade4(x), v = fade4(y), w = fade4(z);
+        __m128i A = _mm_add_epi32(gather4(p, X), Y);
+        __m128i AA = _mm_add_epi32(gather4(p, A), Z);
+        __m128i AB = _mm_add_epi32(gather4(p, _mm_add_epi32(A, one_i)), Z);
+        __m128i B = _mm_add_epi32(gather4(p, _mm_add_epi32(X, one_i)), Y);
+        __m128i BA = _mm_add_epi32(gather4(p, B), Z);
+        __m128i BB = _mm_add_epi32(gather4(p, _mm_add_epi32(B, one_i)), Z);
+        __m128 x1 = _mm_sub_ps(x, one), y1 = _mm_sub_ps(y, one), z1 = _mm_sub_ps(z, one);
+        __m128 res = lerp4(
+            w,
+            lerp4(v, lerp4(u, grad4(gather4(p, AA), x, y, z), grad4(gather4(p, BA), x1, y, z)),
+                  lerp4(u, grad4(gather4(p, AB), x, y1, z), grad4(gather4(p, BB), x1, y1, z))),
+            lerp4(v,
+                  lerp4(u, grad4(gather4(p, _mm_add_epi32(AA, one_i)), x, y, z1),
+                        grad4(gather4(p, _mm_add_epi32(BA, one_i)), x1, y, z1)),
+                  lerp4(u, grad4(gather4(p, _mm_add_epi32(AB, one_i)), x, y1, z1),
+                        grad4(gather4(p, _mm_add_epi32(BB, one_i)), x1, y1, z1))));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(res, one), _mm_set1_ps(0.5f)));
+    }
+    return i;
+}
+
+// Gathers 4 bytes from each entry and keeps the first, which is why tables are padded.
+SIMD_TARGET_AVX2 inline __m256i gather8(const u8* table, __m256i indices) {
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int*)table, indices, 1), _mm256_set1_epi32(0xff));
+}
+
+SIMD_TARGET_AVX2 inline __m256 fade8(__m256 t) {
+    __m256 inner = _mm256_add_ps(
+        _mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))),
+        _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+SIMD_TARGET_AVX2 inline __m256 lerp8(__m256 t, __m256 a, __m256 b) {
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+SIMD_TARGET_AVX2 inline __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+    __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+    __m256 below_8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+    __m256 below_4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    __m256 is_12_or_14 = _mm256_castsi256_ps(
+        _mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+    __m256 u = _mm256_blendv_ps(y, x, below_8);
+    __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, is_12_or_14), y, below_4);
+    __m256 u_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    __m256 v_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, u_sign), _mm256_xor_ps(v, v_sign));
+}
+
+SIMD_TARGET_AVX2 size_t perlinAVX2(const u8* p, const float* xs, const float* ys, const float* zs, float* out,
+                                   size_t count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i one_i = _mm256_set1_epi32(1);
+    const __m256i mask = _mm256_set1_epi32(255);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i), z = _mm256_loadu_ps(zs + i);
+        __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y), fz = _mm256_floor_ps(z);
+        __m256i X = _mm256_and_si256(_mm256_cvttps_epi32(fx), mask);
+        __m256i Y = _mm256_and_si256(_mm256_cvttps_epi32(fy), mask);
+        __m256i Z = _mm256_and_si256(_mm256_cvttps_epi32(fz), mask);
+        x = _mm256_sub_ps(x, fx);
+        y = _mm256_sub_ps(y, fy);
+        z = _mm256_sub_ps(z, fz);
+        __m256 u = fade8(x), v = fade8(y), w = fade8(z);
+        __m256i A = _mm256_add_epi32(gather8(p, X), Y);
+        __m256i AA = _mm256_add_epi32(gather8(p, A), Z);
+        __m256i AB = _mm256_add_epi32(gather8(p, _mm256_add_epi32(A, one_i)), Z);
+        __m256i B = _mm256_add_epi32(gather8(p, _mm256_add_epi32(X, one_i)), Y);
+        __m256i BA = _mm256_add_epi32(gather8(p, B), Z);
+        __m256i BB = _mm256_add_epi32(gather8(p, _mm256_add_epi32(B, one_i)), Z);
+        __m256 x1 = _mm256_sub_ps(x, one), y1 = _mm256_sub_ps(y, one), z1 = _mm256_sub_ps(z, one);
+        __m256 res = lerp8(
+            w,
+            lerp8(v, lerp8(u, grad8(gather8(p, AA), x, y, z), grad8(gather8(p, BA), x1, y, z)),
+                  lerp8(u, grad8(gather8(p, AB), x, y1, z), grad8(gather8(p, BB), x1, y1, z))),
+            lerp8(v,
+                  lerp8(u, grad8(gather8(p, _mm256_add_epi32(AA, one_i)), x, y, z1),
+                        grad8(gather8(p, _mm256_add_epi32(BA, one_i)), x1, y, z1)),
+                  lerp8(u, grad8(gather8(p, _mm256_add_epi32(AB, one_i)), x, y1, z1),
+                        grad8(gather8(p, _mm256_add_epi32(BB, one_i)), x1, y1, z1))));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(res, one), _mm256_set1_ps(0.5f)));
+    }
+    return i;
+}
+#endif
+}
+
+SharedPtr<const PermutationTable> referencePermutationTable() {
+    static const SharedPtr<const PermutationTable> table = [] {
+        auto table = make_shared<PermutationTable>();
+        std::copy(REFERENCE_PERMUTATION, REFERENCE_PERMUTATION + 256, table->values);
+        repeatPermutation(*table);
+        return table;
+    }();
+    return table;
+}
+
+SharedPtr<const PermutationTable> seededPermutationTable(uint seed) {
+    std::lock_guard<std::mutex> lock{seeded_tables_mutex};
+    if (seeded_tables.size() >= seeded_tables_prune_size) {
+        for (auto it = seeded_tables.begin(); it != seeded_tables.end();) {
+            it = it->second.expired() ? seeded_tables.erase(it) : std::next(it);
+        }
+        seeded_tables_prune_size =
+            std::max(SEEDED_TABLES_MIN_PRUNE_SIZE, seeded_tables.size() * 2);
+    }
+    WeakPtr<const PermutationTable>& shared = seeded_tables[seed];
+    SharedPtr<const PermutationTable> existing = shared.lock();
+    if (existing) {
+        return existing;
+    }
+    auto table = make_shared<PermutationTable>();
+
+    // Fill p with values from 0 to 255.
+    std::iota(table->values, table->values + 256, 0);
+
+    // Initialize a random engine with seed.
+    std::default_random_engine engine(seed);
+
+    // Shuffle using the above random engine.
+    std::shuffle(table->values, table->values + 256, engine);
+
+    // Duplicate the permutation vector.
+    repeatPermutation(*table);
+    shared = table;
+    return table;
+}
 
 fBmNoise::fBmNoise(uint octaves, float frequency, float amplitude, float lacunarity,
                    float persistence)
@@ -42,42 +296,34 @@ double fBmNoise::noise(double x, double y, double z) {
     return noise_value;
 }
 
-PerlinNoise::PerlinNoise() {
-    // Initialize the permutation vector with the reference values.
-    p = {151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,   225, 140, 36,
-         103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190, 6,   148, 247, 120, 234, 75,
-         0,   26,  197, 62,  94,  252, 219, 203, 117, 35,  11,  32,  57,  177, 33,  88,  237, 149,
-         56,  87,  174, 20,  125, 136, 171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166,
-         77,  146, 158, 231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
-         245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209, 76,  132, 187,
-         208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,  164, 100, 109, 198, 173, 186,
-         3,   64,  52,  217, 226, 250, 124, 123, 5,   202, 38,  147, 118, 126, 255, 82,  85,  212,
-         207, 206, 59,  227, 47,  16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248,
-         152, 2,   44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
-         19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,  228, 251, 34,
-         242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,  145, 235, 249, 14,  239, 107,
-         49,  192, 214, 31,  181, 199, 106, 157, 184, 84,  204, 176, 115, 121, 50,  45,  127, 4,
-         150, 254, 138, 236, 205, 93,  222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,
-         215, 61,  156, 180};
-
-    // Duplicate the permutation vector.
-    p.insert(p.end(), p.begin(), p.end());
+void fBmNoise::noise(const float* x, const float* y, const float* z, float* out, size_t count) const {
+    float octave_x[FBM_BLOCK_SIZE], octave_y[FBM_BLOCK_SIZE], octave_z[FBM_BLOCK_SIZE];
+    float sample[FBM_BLOCK_SIZE];
+    for (size_t begin = 0; begin < count; begin += FBM_BLOCK_SIZE) {
+        size_t size = std::min(FBM_BLOCK_SIZE, count - begin);
+        std::fill(out + begin, out + begin + size, 0.0f);
+        float frequency = frequency_;
+        float amplitude = amplitude_;
+        for (uint octave = 0; octave < octaves_; ++octave) {
+            for (size_t i = 0; i < size; ++i) {
+                octave_x[i] = x[begin + i] * frequency;
+                octave_y[i] = y[begin + i] * frequency;
+                octave_z[i] = z[begin + i] * frequency;
+            }
+            noise_function_.noise(octave_x, octave_y, octave_z, sample, size);
+            for (size_t i = 0; i < size; ++i) {
+                out[begin + i] += amplitude * sample[i];
+            }
+            frequency *= lacunarity_;
+            amplitude *= persistence_;
+        }
+    }
 }
 
-PerlinNoise::PerlinNoise(uint seed) {
-    p.resize(256);
-
-    // Fill p with values from 0 to 255.
-    std::iota(p.begin(), p.end(), 0);
-
-    // Initialize a random engine with seed.
-    std::default_random_engine engine(seed);
-
-    // Shuffle using the above random engine.
-    std::shuffle(p.begin(), p.end(), engine);
+PerlinNoise::PerlinNoise() : table_(referencePermutationTable()), p(table_->values) {
+}
 
-    // Duplicate the permutation vector.
-    p.insert(p.end(), p.begin(), p.end());
+PerlinNoise::PerlinNoise(uint seed) : table_(seededPermutationTable(seed)), p(table_->values) {
 }
 
 double PerlinNoise::noise(double x, double y, double z) {
@@ -114,6 +360,23 @@ double PerlinNoise::noise(double x, double y, double z) {
     return (res + 1.0) / 2.0;
 }
 
+void PerlinNoise::noise(const float* x, const float* y, const float* z, float* out, size_t count) const {
+    size_t done = 0;
+#ifdef SIMD_X86
+    switch (simdLevel()) {
+        case SimdLevel::AVX2:
+            done = perlinAVX2(p, x, y, z, out, count);
+            break;
+        case SimdLevel::SSE41:
+            done = perlinSSE41(p, x, y, z, out, count);
+            break;
+        default:
+            break;
+    }
+#endif
+    perlinScalar(p, x + done, y + done, z + done, out + done, count - done);
+}
+
 double PerlinNoise::fade(double t) {
     return t * t * t * (t * (t * 6 - 15) + 10);
 }
@@ -129,3 +392,258 @@ double PerlinNoise::grad(int hash, double x, double y, double z) {
     double u = h < 8 ? x : y, v = h < 4 ? y : h == 12 || h == 14 ? x : z;
     return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
+
+namespace {
+// Skew from the input space to the grid of squares split into triangles, and unskew back.
+const double SIMPLEX_F2 = 0.36602540378443864676;
+const double SIMPLEX_G2 = 0.21132486540518711775;
+
+// Scales the sum of the corner contributions to about [-1, 1].
+const double SIMPLEX_SCALE = 40.0;
+
+// One of 8 gradients, (+-1, +-2) and (+-2, +-1), dotted with (x, y).
+float simplexGradFloat(int hash, float x, float y) {
+    int h = hash & 7;
+    float u = h < 4 ? x : y, v = h < 4 ? y : x;
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? 2.0f * v : -2.0f * v);
+}
+
+// Contribution of a corner at offset (x, y) from the sample, which falls to zero at a distance of
+// sqrt(0.5).
+float simplexCornerFloat(int hash, float x, float y) {
+    float t = std::max(0.5f - (x * x + y * y), 0.0f);
+    t *= t;
+    return t * t * simplexGradFloat(hash, x, y);
+}
+
+void simplexScalar(const u8* p, const float* xs, const float* ys, float* out, size_t count) {
+    const float f2 = (float)SIMPLEX_F2, g2 = (float)SIMPLEX_G2;
+    for (size_t k = 0; k < count; ++k) {
+        float s = (xs[k] + ys[k]) * f2;
+        float fi = std::floor(xs[k] + s), fj = std::floor(ys[k] + s);
+        float t = (fi + fj) * g2;
+        float x0 = xs[k] - (fi - t), y0 = ys[k] - (fj - t);
+        int i1 = x0 > y0 ? 1 : 0, j1 = 1 - i1;
+        float x1 = x0 - i1 + g2, y1 = y0 - j1 + g2;
+        float x2 = x0 - (1.0f - 2.0f * g2), y2 = y0 - (1.0f - 2.0f * g2);
+        int i = (int)fi & 255, j = (int)fj & 255;
+        float res = simplexCornerFloat(p[i + p[j]], x0, y0) + simplexCornerFloat(p[i + i1 + p[j + j1]], x1, y1) +
+                    simplexCornerFloat(p[i + 1 + p[j + 1]], x2, y2);
+        out[k] = ((float)SIMPLEX_SCALE * res + 1.0f) * 0.5f;
+    }
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET_SSE41 inline __m128 simplexCorner4(__m128i hash, __m128 x, __m128 y) {
+    __m128 t = _mm_sub_ps(_mm_set1_ps(0.5f), _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(7));
+    __m128 below_4 = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(4), h));
+    __m128 u = _mm_blendv_ps(y, x, below_4);
+    __m128 v = _mm_blendv_ps(x, y, below_4);
+    __m128 u_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128 v_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    __m128 grad = _mm_add_ps(_mm_xor_ps(u, u_sign), _mm_xor_ps(_mm_mul_ps(_mm_set1_ps(2.0f), v), v_sign));
+    return _mm_mul_ps(_mm_mul_ps(t, t), grad);
+}
+
+SIMD_TARGET_SSE41 size_t simplexSSE41(const u8* p, const float* xs, const float* ys, float* out, size_t count) {
+    const __m128 f2 = _mm_set1_ps((float)SIMPLEX_F2), g2 = _mm_set1_ps((float)SIMPLEX_G2);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 corner_2 = _mm_set1_ps(1.0f - 2.0f * (float)SIMPLEX_G2);
+    const __m128i one_i = _mm_set1_epi32(1);
+    const __m128i mask = _mm_set1_epi32(255);
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m128 x = _mm_loadu_ps(xs + k), y = _mm_loadu_ps(ys + k);
+        __m128 s = _mm_mul_ps(_mm_add_ps(x, y), f2);
+        __m128 fi = _mm_floor_ps(_mm_add_ps(x, s)), fj = _mm_floor_ps(_mm_add_ps(y, s));
+        __m128 t = _mm_mul_ps(_mm_add_ps(fi, fj), g2);
+        __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(fi, t)), y0 = _mm_sub_ps(y, _mm_sub_ps(fj, t));
+        __m128 x_greater = _mm_cmpgt_ps(x0, y0);
+        __m128 i1 = _mm_and_ps(x_greater, one), j1 = _mm_andnot_ps(x_greater, one);
+        __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, i1), g2), y1 = _mm_add_ps(_mm_sub_ps(y0, j1), g2);
+        __m128 x2 = _mm_sub_ps(x0, corner_2), y2 = _mm_sub_ps(y0, corner_2);
+        __m128i i = _mm_and_si128(_mm_cvttps_epi32(fi), mask), j = _mm_and_si128(_mm_cvttps_epi32(fj), mask);
+        __m128i i1_i = _mm_cvttps_epi32(i1), j1_i = _mm_cvttps_epi32(j1);
+        __m128i h0 = gather4(p, _mm_add_epi32(i, gather4(p, j)));
+        __m128i h1 = gather4(p, _mm_add_epi32(_mm_add_epi32(i, i1_i), gather4(p, _mm_add_epi32(j, j1_i))));
+        __m128i h2 = gather4(p, _mm_add_epi32(_mm_add_epi32(i, one_i), gather4(p, _mm_add_epi32(j, one_i))));
+        __m128 res = _mm_add_ps(_mm_add_ps(simplexCorner4(h0, x0, y0), simplexCorner4(h1, x1, y1)),
+                                simplexCorner4(h2, x2, y2));
+        res = _mm_mul_ps(res, _mm_set1_ps((float)SIMPLEX_SCALE));
+        _mm_storeu_ps(out + k, _mm_mul_ps(_mm_add_ps(res, one), _mm_set1_ps(0.5f)));
+    }
+    return k;
+}
+
+SIMD_TARGET_AVX2 inline __m256 simplexCorner8(__m256i hash, __m256 x, __m256 y) {
+    __m256 t = _mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+    t = _mm256_max_ps(t, _mm256_setzero_ps());
+    t = _mm256_mul_ps(t, t);
+    __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(7));
+    __m256 below_4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    __m256 u = _mm256_blendv_ps(y, x, below_4);
+    __m256 v = _mm256_blendv_ps(x, y, below_4);
+    __m256 u_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    __m256 v_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    __m256 grad =
+        _mm256_add_ps(_mm256_xor_ps(u, u_sign), _mm256_xor_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), v), v_sign));
+    return _mm256_mul_ps(_mm256_mul_ps(t, t), grad);
+}
+
+SIMD_TARGET_AVX2 size_t simplexAVX2(const u8* p, const float* xs, const float* ys, float* out, size_t count) {
+    const __m256 f2 = _mm256_set1_ps((float)SIMPLEX_F2), g2 = _mm256_set1_ps((float)SIMPLEX_G2);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 corner_2 = _mm256_set1_ps(1.0f - 2.0f * (float)SIMPLEX_G2);
+    const __m256i one_i = _mm256_set1_epi32(1);
+    const __m256i mask = _mm256_set1_epi32(255);
+    size_t k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256 x = _mm256_loadu_ps(xs + k), y = _mm256_loadu_ps(ys + k);
+        __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), f2);
+        __m256 fi = _mm256_floor_ps(_mm256_add_ps(x, s)), fj = _mm256_floor_ps(_mm256_add_ps(y, s));
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(fi, fj), g2);
+        __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(fi, t)), y0 = _mm256_sub_ps(y, _mm256_sub_ps(fj, t));
+        __m256 x_greater = _mm256_cmp_ps(x0, y0, _CMP_GT_OQ);
+        __m256 i1 = _mm256_and_ps(x_greater, one), j1 = _mm256_andnot_ps(x_greater, one);
+        __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, i1), g2), y1 = _mm256_add_ps(_mm256_sub_ps(y0, j1), g2);
+        __m256 x2 = _mm256_sub_ps(x0, corner_2), y2 = _mm256_sub_ps(y0, corner_2);
+        __m256i i = _mm256_and_si256(_mm256_cvttps_epi32(fi), mask);
+        __m256i j = _mm256_and_si256(_mm256_cvttps_epi32(fj), mask);
+        __m256i i1_i = _mm256_cvttps_epi32(i1), j1_i = _mm256_cvttps_epi32(j1);
+        __m256i h0 = gather8(p, _mm256_add_epi32(i, gather8(p, j)));
+        __m256i h1 =
+            gather8(p, _mm256_add_epi32(_mm256_add_epi32(i, i1_i), gather8(p, _mm256_add_epi32(j, j1_i))));
+        __m256i h2 =
+            gather8(p, _mm256_add_epi32(_mm256_add_epi32(i, one_i), gather8(p, _mm256_add_epi32(j, one_i))));
+        __m256 res = _mm256_add_ps(_mm256_add_ps(simplexCorner8(h0, x0, y0), simplexCorner8(h1, x1, y1)),
+                                   simplexCorner8(h2, x2, y2));
+        res = _mm256_mul_ps(res, _mm256_set1_ps((float)SIMPLEX_SCALE));
+        _mm256_storeu_ps(out + k, _mm256_mul_ps(_mm256_add_ps(res, one), _mm256_set1_ps(0.5f)));
+    }
+    return k;
+}
+#endif
+}
+
+SimplexNoise::SimplexNoise() : table_(referencePermutationTable()), p(table_->values) {
+}
+
+SimplexNoise::SimplexNoise(uint seed) : table_(seededPermutationTable(seed)), p(table_->values) {
+}
+
+double SimplexNoise::noise(double x, double y) const {
+    // Skew the input space to find the square containing the point, and so the two triangles.
+    double s = (x + y) * SIMPLEX_F2;
+    double fi = floor(x + s);
+    double fj = floor(y + s);
+
+    // Unskew the square origin back, and find the point relative to it.
+    double t = (fi + fj) * SIMPLEX_G2;
+    double x0 = x - (fi - t);
+    double y0 = y - (fj - t);
+
+    // The middle corner is (1, 0) in the lower triangle and (0, 1) in the upper.
+    int i1 = x0 > y0 ? 1 : 0;
+    int j1 = 1 - i1;
+
+    // Offsets of the point from the middle and far corners.
+    double x1 = x0 - i1 + SIMPLEX_G2;
+    double y1 = y0 - j1 + SIMPLEX_G2;
+    double x2 = x0 - 1.0 + 2.0 * SIMPLEX_G2;
+    double y2 = y0 - 1.0 + 2.0 * SIMPLEX_G2;
+
+    // Hash the three corners, and add their contributions.
+    int i = (int)fi & 255;
+    int j = (int)fj & 255;
+    double res = corner(p[i + p[j]], x0, y0) + corner(p[i + i1 + p[j + j1]], x1, y1) +
+                 corner(p[i + 1 + p[j + 1]], x2, y2);
+    return (SIMPLEX_SCALE * res + 1.0) / 2.0;
+}
+
+void SimplexNoise::noise(const float* x, const float* y, float* out, size_t count) const {
+    size_t done = 0;
+#ifdef SIMD_X86
+    switch (simdLevel()) {
+        case SimdLevel::AVX2:
+            done = simplexAVX2(p, x, y, out, count);
+            break;
+        case SimdLevel::SSE41:
+            done = simplexSSE41(p, x, y, out, count);
+            break;
+        default:
+            break;
+    }
+#endif
+    simplexScalar(p, x + done, y + done, out + done, count - done);
+}
+
+double SimplexNoise::corner(int hash, double x, double y) const {
+    double t = 0.5 - x * x - y * y;
+    if (t < 0.0) {
+        return 0.0;
+    }
+    t *= t;
+
+    // Convert lower 3 bits of hash into 8 gradient directions.
+    int h = hash & 7;
+    double u = h < 4 ? x : y, v = h < 4 ? y : x;
+    return t * t * (((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? 2.0 * v : -2.0 * v));
+}
+
+fBmSimplexNoise::fBmSimplexNoise(uint octaves, float frequency, float amplitude, float lacunarity,
+                                 float persistence)
+    : octaves_{octaves},
+      frequency_{frequency},
+      amplitude_{amplitude},
+      lacunarity_{lacunarity},
+      persistence_{persistence},
+      noise_function_{} {
+}
+
+fBmSimplexNoise::fBmSimplexNoise(uint seed, uint octaves, float frequency, float amplitude, float lacunarity,
+                                 float persistence)
+    : octaves_{octaves},
+      frequency_{frequency},
+      amplitude_{amplitude},
+      lacunarity_{lacunarity},
+      persistence_{persistence},
+      noise_function_{seed} {
+}
+
+double fBmSimplexNoise::noise(double x, double y) const {
+    double frequency = frequency_;
+    double amplitude = amplitude_;
+    double noise_value = 0.0;
+    for (uint octave = 0; octave < octaves_; ++octave) {
+        noise_value += amplitude * noise_function_.noise(x * frequency, y * frequency);
+        frequency *= lacunarity_;
+        amplitude *= persistence_;
+    }
+    return noise_value;
+}
+
+void fBmSimplexNoise::noise(const float* x, const float* y, float* out, size_t count) const {
+    float octave_x[FBM_BLOCK_SIZE], octave_y[FBM_BLOCK_SIZE];
+    float sample[FBM_BLOCK_SIZE];
+    for (size_t begin = 0; begin < count; begin += FBM_BLOCK_SIZE) {
+        size_t size = std::min(FBM_BLOCK_SIZE, count - begin);
+        std::fill(out + begin, out + begin + size, 0.0f);
+        float frequency = frequency_;
+        float amplitude = amplitude_;
+        for (uint octave = 0; octave < octaves_; ++octave) {
+            for (size_t i = 0; i < size; ++i) {
+                octave_x[i] = x[begin + i] * frequency;
+                octave_y[i] = y[begin + i] * frequency;
+            }
+            noise_function_.noise(octave_x, octave_y, sample, size);
+            for (size_t i = 0; i < size; ++i) {
+                out[begin + i] += amplitude * sample[i];
+            }
+            frequency *= lacunarity_;
+            amplitude *= persistence_;
+        }
+    }
+}
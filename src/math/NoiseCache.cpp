@@ -0,0 +1,120 @@
+#include "Common.h"
+#include "math/NoiseCache.h"
+
+const u32 NoiseTileCache::TILE_SIZE;
+const size_t NoiseTileCache::DEFAULT_BUDGET_BYTES;
+const u32 NoiseTileCache::TILE_SAMPLES;
+
+u64 NoiseField::hash() const {
+    u64 hash = hashCombine(seed, octaves);
+    hash = hashCombine(hash, hashFloat(frequency));
+    hash = hashCombine(hash, hashFloat(amplitude));
+    hash = hashCombine(hash, hashFloat(lacunarity));
+    return hashCombine(hash, hashFloat(persistence));
+}
+
+NoiseTileCache::NoiseTileCache(float spacing, size_t budget_bytes)
+    : spacing_{spacing}, budget_bytes_{budget_bytes}, size_bytes_{0}, hit_count_{0}, miss_count_{0} {
+}
+
+float NoiseTileCache::sample(const NoiseField& field, const Vec2& position) {
+    float value;
+    sample(field, &position, &value, 1);
+    return value;
+}
+
+void NoiseTileCache::sample(const NoiseField& field, const Vec2* positions, float* out, size_t count) {
+    NoiseTileKey key{field, 0, 0};
+    SharedPtr<const Tile> tile;
+    for (size_t i = 0; i < count; ++i) {
+        // Position in samples, split into the tile and the position within it.
+        float gx = positions[i].x / spacing_;
+        float gy = positions[i].y / spacing_;
+        int tile_x = (int)std::floor(gx / TILE_SIZE);
+        int tile_y = (int)std::floor(gy / TILE_SIZE);
+        if (!tile || tile_x != key.x || tile_y != key.y) {
+            key.x = tile_x;
+            key.y = tile_y;
+            tile = findTile(key);
+        }
+        float local_x = glm::clamp(gx - float(tile_x * (int)TILE_SIZE), 0.0f, float(TILE_SIZE));
+        float local_y = glm::clamp(gy - float(tile_y * (int)TILE_SIZE), 0.0f, float(TILE_SIZE));
+        u32 x0 = std::min((u32)local_x, TILE_SIZE - 1);
+        u32 y0 = std::min((u32)local_y, TILE_SIZE - 1);
+        float tx = local_x - x0;
+        float ty = local_y - y0;
+        const float* row0 = &(*tile)[y0 * TILE_SAMPLES + x0];
+        const float* row1 = row0 + TILE_SAMPLES;
+        out[i] = lerp(lerp(row0[0], row0[1], tx), lerp(row1[0], row1[1], tx), ty);
+    }
+}
+
+size_t NoiseTileCache::sizeBytes() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return size_bytes_;
+}
+
+SharedPtr<const NoiseTileCache::Tile> NoiseTileCache::findTile(const NoiseTileKey& key) {
+    const fBmSimplexNoise* noise;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto it = tile_index_.find(key);
+        if (it != tile_index_.end()) {
+            tiles_.splice(tiles_.begin(), tiles_, it->second);
+            hit_count_.fetch_add(1, std::memory_order_relaxed);
+            return it->second->tile;
+        }
+        auto& noise_function = noise_functions_[key.field];
+        if (!noise_function) {
+            MEMORY_SCOPE(MemoryTag::Map);
+            noise_function = make_unique<fBmSimplexNoise>(key.field.seed, key.field.octaves, key.field.frequency,
+                                                          key.field.amplitude, key.field.lacunarity,
+                                                          key.field.persistence);
+        }
+        noise = noise_function.get();
+    }
+
+    // Build without holding the lock. Two threads may build the same tile at once, in which case
+    // the first to be cached wins. Noise functions are never removed, so 'noise' stays valid.
+    SharedPtr<const Tile> tile = buildTile(key, *noise);
+    miss_count_.fetch_add(1, std::memory_order_relaxed);
+
+    MEMORY_SCOPE(MemoryTag::Map);
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = tile_index_.find(key);
+    if (it != tile_index_.end()) {
+        return it->second->tile;
+    }
+    tiles_.push_front({key, tile});
+    tile_index_[key] = tiles_.begin();
+    size_bytes_ += tileBytes();
+
+    // Tiles still held by a reader stay alive until it's done with them.
+    while (size_bytes_ > budget_bytes_ && tiles_.size() > 1) {
+        tile_index_.erase(tiles_.back().key);
+        tiles_.pop_back();
+        size_bytes_ -= tileBytes();
+    }
+    return tile;
+}
+
+SharedPtr<const NoiseTileCache::Tile> NoiseTileCache::buildTile(const NoiseTileKey& key,
+                                                                const fBmSimplexNoise& noise) const {
+    PROFILE_SCOPE("NoiseTileCache::buildTile");
+    MEMORY_SCOPE(MemoryTag::Map);
+    const u32 sample_count = TILE_SAMPLES * TILE_SAMPLES;
+    Vector<float> xs(sample_count), ys(sample_count);
+    for (u32 y = 0; y < TILE_SAMPLES; ++y) {
+        for (u32 x = 0; x < TILE_SAMPLES; ++x) {
+            xs[y * TILE_SAMPLES + x] = float(key.x * (int)TILE_SIZE + (int)x) * spacing_;
+            ys[y * TILE_SAMPLES + x] = float(key.y * (int)TILE_SIZE + (int)y) * spacing_;
+        }
+    }
+    auto tile = make_shared<Tile>(sample_count);
+    noise.noise(xs.data(), ys.data(), tile->data(), sample_count);
+    return tile;
+}
+
+size_t NoiseTileCache::tileBytes() {
+    return TILE_SAMPLES * TILE_SAMPLES * sizeof(float) + sizeof(CacheEntry);
+}
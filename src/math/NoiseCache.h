@@ -0,0 +1,118 @@
+#pragma once
+
+#include "math/Noise.h"
+
+#include <mutex>
+
+// A 2D fBm simplex noise field. See fBmNoise for the parameters.
+struct NoiseField {
+    uint seed;
+    uint octaves;
+    float frequency;
+    float amplitude;
+    float lacunarity;
+    float persistence;
+
+    bool operator==(const NoiseField& other) const {
+        return seed == other.seed && octaves == other.octaves && frequency == other.frequency &&
+               amplitude == other.amplitude && lacunarity == other.lacunarity && persistence == other.persistence;
+    }
+
+    u64 hash() const;
+};
+
+// A tile of a noise field, by position in tiles from the origin.
+struct NoiseTileKey {
+    NoiseField field;
+    int x;
+    int y;
+
+    bool operator==(const NoiseTileKey& other) const {
+        return x == other.x && y == other.y && field == other.field;
+    }
+};
+
+namespace std {
+template <>
+struct hash<NoiseField> {
+    size_t operator()(const NoiseField& field) const {
+        return (size_t)field.hash();
+    }
+};
+
+template <>
+struct hash<NoiseTileKey> {
+    size_t operator()(const NoiseTileKey& key) const {
+        return (size_t)hashCombine(hashCombine(key.field.hash(), (u32)key.x), (u32)key.y);
+    }
+};
+}
+
+// Noise fields sampled on a grid and cached in square tiles, for places which read the same area
+// of a field over and over, such as overlays while the view scrolls and AI evaluating positions.
+//
+// Tiles hold TILE_SIZE + 1 samples along each side, 'spacing' world units apart, so neighbouring
+// tiles share their edge samples and any position can be interpolated from a single tile. Tiles
+// are generated with the batch noise kernels the first time they are read, and the least recently
+// used ones are dropped once the cache holds more than its budget.
+class NoiseTileCache {
+public:
+    static const u32 TILE_SIZE = 64;
+    static const size_t DEFAULT_BUDGET_BYTES = 16 << 20;
+
+    explicit NoiseTileCache(float spacing, size_t budget_bytes = DEFAULT_BUDGET_BYTES);
+
+    NoiseTileCache(const NoiseTileCache&) = delete;
+    NoiseTileCache& operator=(const NoiseTileCache&) = delete;
+
+    // The field at 'position', interpolated bilinearly between the surrounding samples. Safe to
+    // call from multiple threads.
+    float sample(const NoiseField& field, const Vec2& position);
+
+    // As sample, for 'count' positions at once. Runs of positions in the same tile only look the
+    // tile up once, so positions close together should be next to each other.
+    void sample(const NoiseField& field, const Vec2* positions, float* out, size_t count);
+
+    float spacing() const {
+        return spacing_;
+    }
+
+    // Statistics.
+    size_t sizeBytes() const;
+
+    u64 hitCount() const {
+        return hit_count_.load(std::memory_order_relaxed);
+    }
+
+    u64 missCount() const {
+        return miss_count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const u32 TILE_SAMPLES = TILE_SIZE + 1;
+
+    // Samples, row by row.
+    using Tile = Vector<float>;
+
+    struct CacheEntry {
+        NoiseTileKey key;
+        SharedPtr<const Tile> tile;
+    };
+
+    float spacing_;
+    size_t budget_bytes_;
+
+    // Most recently used at the front.
+    mutable std::mutex mutex_;
+    List<CacheEntry> tiles_;
+    HashMap<NoiseTileKey, List<CacheEntry>::iterator> tile_index_;
+    size_t size_bytes_;
+    HashMap<NoiseField, UniquePtr<fBmSimplexNoise>> noise_functions_;
+
+    std::atomic<u64> hit_count_;
+    std::atomic<u64> miss_count_;
+
+    SharedPtr<const Tile> findTile(const NoiseTileKey& key);
+    SharedPtr<const Tile> buildTile(const NoiseTileKey& key, const fBmSimplexNoise& noise) const;
+    static size_t tileBytes();
+};
@@ -0,0 +1,64 @@
+#include "Common.h"
+#include "math/Simd.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace {
+SimdLevel detectSimdLevel() {
+#if defined(SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    // AVX state must be enabled by the OS as well as supported.
+    bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (avx && max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? SimdLevel::AVX2 : sse41 ? SimdLevel::SSE41 : SimdLevel::Scalar;
+#elif defined(SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE41;
+    }
+    return SimdLevel::Scalar;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+std::atomic<SimdLevel>& currentLevel() {
+    static std::atomic<SimdLevel> level{cpuSimdLevel()};
+    return level;
+}
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Scalar: return "Scalar";
+        case SimdLevel::SSE41: return "SSE4.1";
+        case SimdLevel::AVX2: return "AVX2";
+        default: return "Unknown";
+    }
+}
+
+SimdLevel cpuSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+SimdLevel simdLevel() {
+    return currentLevel().load(std::memory_order_relaxed);
+}
+
+void setSimdLevel(SimdLevel level) {
+    currentLevel().store(std::min(level, cpuSimdLevel()), std::memory_order_relaxed);
+}
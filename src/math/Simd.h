@@ -0,0 +1,35 @@
+#pragma once
+
+// Runtime selection of SIMD kernels. The build targets the baseline instruction set, and kernels
+// using anything newer are compiled for it with SIMD_TARGET_* and only called once the CPU has
+// been checked for support. Kernels at every level must give the same results bit for bit, as
+// generated terrain feeds the simulation, which has to play out the same on every machine.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET_SSE41
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Instruction sets with kernels, from least to most capable.
+enum class SimdLevel : u8 {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+const char* simdLevelName(SimdLevel level);
+
+// The most capable level this CPU supports. Detected once.
+SimdLevel cpuSimdLevel();
+
+// The level batch kernels run at. This is the CPU's level, unless lowered to compare kernels.
+SimdLevel simdLevel();
+
+// Clamped to the CPU's level.
+void setSimdLevel(SimdLevel level);
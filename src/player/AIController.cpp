@@ -0,0 +1,178 @@
+#include "Common.h"
+#include "player/AIController.h"
+#include "player/Player.h"
+#include "gameplay/Simulation.h"
+#include "core/JobSystem.h"
+
+const u32 AIController::UNITS_PER_GOAL;
+const u32 AIController::MAX_SEARCH_SITES;
+constexpr float AIScheduler::DEFAULT_BUDGET_MS;
+const u32 AIScheduler::MAX_COMMANDS_PER_TICK;
+
+AIController::AIController(u32 player, const Map& map)
+    : player_{player}, map_(map), phase_{Phase::Finished}, next_unit_{0}, search_{0}, applied_commands_{0} {
+    reached_.assign(map_.sites().size(), ~0u);
+    goal_counts_.assign(map_.sites().size(), 0);
+}
+
+void AIController::perceive(const Simulation& sim) {
+    PROFILE_SCOPE("AIController::perceive");
+    const UnitStore& units = sim.units();
+    const Visibility& visibility = sim.visibility();
+    u32 word_count = ((u32)map_.sites().size() + 63) / 64;
+    if (player_ < visibility.playerCount()) {
+        const u64* visible = visibility.visibleSites(player_);
+        visible_.assign(visible, visible + word_count);
+    } else {
+        visible_.assign(word_count, 0);
+    }
+    idle_units_.clear();
+    idle_sites_.clear();
+    if (possessed_) {
+        for (UnitId unit : possessed_->units()) {
+            if (units.owner(unit) == player_ && units.orders(unit).empty()) {
+                idle_units_.push_back(unit);
+                idle_sites_.push_back(map_.siteIndexNear(units.site(unit), units.position(unit)));
+            }
+        }
+    }
+    next_unit_ = 0;
+    goals_.clear();
+    commands_.clear();
+    applied_commands_ = 0;
+    std::fill(goal_counts_.begin(), goal_counts_.end(), 0);
+    phase_ = Phase::Planning;
+}
+
+bool AIController::step() {
+    switch (phase_) {
+        case Phase::Planning:
+            // One unit per step.
+            if (next_unit_ < idle_units_.size()) {
+                u32 goal = findGoal(idle_sites_[next_unit_]);
+                if (goal != INVALID_SITE) {
+                    goal_counts_[goal]++;
+                    goals_.emplace_back(goal, idle_units_[next_unit_]);
+                }
+                next_unit_++;
+            } else {
+                phase_ = Phase::Ordering;
+            }
+            break;
+        case Phase::Ordering: {
+            // Send the units with the same goal as a group.
+            std::sort(goals_.begin(), goals_.end());
+            for (size_t begin = 0; begin < goals_.size();) {
+                u32 goal = goals_[begin].first;
+                Vector<UnitId> group;
+                size_t end = begin;
+                for (; end < goals_.size() && goals_[end].first == goal; ++end) {
+                    group.push_back(goals_[end].second);
+                }
+                commands_.emplace_back(
+                    Command::groupOrder(player_, group, Order::moveTo(map_.sites()[goal].centre), false));
+                begin = end;
+            }
+            phase_ = Phase::Finished;
+        } break;
+        case Phase::Finished:
+            break;
+    }
+    return phase_ == Phase::Finished;
+}
+
+bool AIController::applyCommands(Simulation& sim, u32& budget) {
+    for (; applied_commands_ < commands_.size() && budget > 0; ++applied_commands_, --budget) {
+        sim.apply(commands_[applied_commands_]);
+    }
+    return applied_commands_ == commands_.size();
+}
+
+u32 AIController::findGoal(u32 from_site) {
+    // Breadth first search for the nearest usable site which the player can't see, and which
+    // doesn't already have enough units heading to it.
+    if (from_site == INVALID_SITE) {
+        return INVALID_SITE;
+    }
+    auto& sites = map_.sites();
+    search_++;
+    frontier_.assign(1, from_site);
+    reached_[from_site] = search_;
+    for (size_t i = 0; i < frontier_.size() && i < MAX_SEARCH_SITES; ++i) {
+        const Map::Site& site = sites[frontier_[i]];
+        if (site.usable && !isVisible(site.index) && goal_counts_[site.index] < UNITS_PER_GOAL) {
+            return site.index;
+        }
+        for (auto& edge : site.edges) {
+            if (edge.neighbour && edge.neighbour->usable && reached_[edge.neighbour->index] != search_) {
+                reached_[edge.neighbour->index] = search_;
+                frontier_.push_back(edge.neighbour->index);
+            }
+        }
+    }
+    return INVALID_SITE;
+}
+
+AIScheduler::AIScheduler(JobSystem& jobs, float budget_ms)
+    : jobs_(jobs), budget_ms_{budget_ms}, counter_{make_unique<JobCounter>()}, thinking_{false}, next_controller_{0} {
+}
+
+AIScheduler::~AIScheduler() {
+    wait();
+}
+
+void AIScheduler::add(UniquePtr<AIController> controller) {
+    wait();
+    controllers_.emplace_back(std::move(controller));
+}
+
+void AIScheduler::tick(Simulation& sim) {
+    PROFILE_SCOPE("AIScheduler::tick");
+    if (thinking_ && !counter_->done()) {
+        return;
+    }
+    thinking_ = false;
+    u32 command_budget = MAX_COMMANDS_PER_TICK;
+    for (auto& controller : controllers_) {
+        if (controller->finished() && controller->applyCommands(sim, command_budget)) {
+            controller->perceive(sim);
+        }
+    }
+    if (jobs_.workerCount() > 1) {
+        jobs_.runBackground(*counter_, &AIScheduler::think, this);
+        thinking_ = true;
+    } else {
+        think(this, 0, 0);
+    }
+}
+
+void AIScheduler::wait() {
+    if (thinking_) {
+        jobs_.wait(*counter_);
+        thinking_ = false;
+    }
+}
+
+void AIScheduler::think(void* data, u32, u32) {
+    PROFILE_SCOPE("AIScheduler::think");
+    // Step the controllers in turn until they have all finished or the budget runs out. Carry on
+    // from the same controller next time, so every controller gets a share of the budget.
+    auto scheduler = static_cast<AIScheduler*>(data);
+    auto& controllers = scheduler->controllers_;
+    auto start = std::chrono::steady_clock::now();
+    u32 unfinished = (u32)controllers.size();
+    while (unfinished > 0) {
+        unfinished = 0;
+        for (size_t i = 0; i < controllers.size(); ++i) {
+            u32 index = scheduler->next_controller_;
+            scheduler->next_controller_ = (index + 1) % (u32)controllers.size();
+            if (!controllers[index]->step()) {
+                unfinished++;
+            }
+        }
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed_ms >= scheduler->budget_ms_) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Controller.h"
+#include "gameplay/CommandLog.h"
+#include "world/Map.h"
+
+class JobSystem;
+class JobCounter;
+class Simulation;
+
+// A computer player. Sends idle units to scout the nearest land the player can't see, a few units
+// to each site.
+//
+// Thinking is split into small steps which can stop and resume at any point, so that it can be
+// spread over as many ticks as it needs. Each round of thinking starts from a view of the game
+// copied at a tick boundary, runs on a worker thread without touching the simulation, and ends
+// with the commands to issue, which are applied at the next tick boundary.
+class AIController : public Controller {
+public:
+    AIController(u32 player, const Map& map);
+
+    // Main thread, at a tick boundary, while not thinking. Copy what the next round of thinking
+    // needs to know about the game.
+    void perceive(const Simulation& sim);
+
+    // Any thread. Do a small, bounded piece of thinking. Returns true once the round is finished.
+    bool step();
+
+    bool finished() const {
+        return phase_ == Phase::Finished;
+    }
+
+    // Main thread, at a tick boundary, once finished. Apply up to 'budget' of the commands
+    // decided on, reducing the budget by the number applied. Returns true once every command has
+    // been applied.
+    bool applyCommands(Simulation& sim, u32& budget);
+
+private:
+    enum class Phase : u8 {
+        Planning,
+        Ordering,
+        Finished
+    };
+
+    // Most units sent to the same site.
+    static const u32 UNITS_PER_GOAL = 3;
+
+    // Most sites searched for a goal per unit, which bounds the work done by each step.
+    static const u32 MAX_SEARCH_SITES = 512;
+
+    u32 player_;
+    const Map& map_;
+    Phase phase_;
+
+    // View of the game: the sites the player can see, one bit per site, and the units waiting
+    // for orders.
+    Vector<u64> visible_;
+    Vector<UnitId> idle_units_;
+    Vector<u32> idle_sites_;
+
+    // Planning progress. A goal site for each idle unit, and the number of units sent to each site.
+    u32 next_unit_;
+    Vector<Pair<u32, UnitId>> goals_;
+    Vector<u8> goal_counts_;
+
+    // Search scratch space. Sites are stamped with the search they were last reached by.
+    Vector<u32> reached_;
+    u32 search_;
+    Vector<u32> frontier_;
+
+    Vector<Command> commands_;
+    u32 applied_commands_;
+
+    bool isVisible(u32 site) const {
+        return (visible_[site / 64] >> (site % 64)) & 1;
+    }
+
+    u32 findGoal(u32 from_site);
+};
+
+// Runs the thinking of a group of AI controllers as a background job, a few steps at a time, under
+// a time budget per tick. Background jobs never run on the main thread, even while it waits on
+// other jobs, so the simulation never waits for the AI: if a round of thinking hasn't finished by
+// the next tick boundary it carries on, and its commands are applied at a later one. Commands are
+// applied a limited number per tick, since each one may search for a path.
+//
+// With a single worker there is no other thread to think on, so the AI thinks at the tick
+// boundary instead, still within its budget.
+class AIScheduler {
+public:
+    static constexpr float DEFAULT_BUDGET_MS = 1.0f;
+    static const u32 MAX_COMMANDS_PER_TICK = 8;
+
+    AIScheduler(JobSystem& jobs, float budget_ms = DEFAULT_BUDGET_MS);
+    ~AIScheduler();
+
+    AIScheduler(const AIScheduler&) = delete;
+    AIScheduler& operator=(const AIScheduler&) = delete;
+
+    void add(UniquePtr<AIController> controller);
+
+    // Call at each tick boundary. Applies the commands of controllers which have finished
+    // thinking, and starts them thinking again from the current state.
+    void tick(Simulation& sim);
+
+    // Block until the thinking in progress, if any, has stopped.
+    void wait();
+
+private:
+    JobSystem& jobs_;
+    float budget_ms_;
+    Vector<UniquePtr<AIController>> controllers_;
+    UniquePtr<JobCounter> counter_;
+    bool thinking_;
+    u32 next_controller_;
+
+    static void think(void* data, u32 begin, u32 end);
+};
@@ -3,7 +3,7 @@
 #include "world/State.h"
 #include "gameplay/Unit.h"
 
-Player::Player(const String& name, WeakPtr<State> state, Vector<WeakPtr<Unit>> units) : name_{name}, state_{state}, units_(units) {
+Player::Player(const String& name, WeakPtr<State> state, Vector<UnitId> units) : name_{name}, state_{state}, units_(units) {
 
 }
 
@@ -1,19 +1,24 @@
 #pragma once
 
+#include "gameplay/Unit.h"
+
 class State;
-class Unit;
 
 class Player : public EnableSharedFromThis<Player> {
 public:
-    Player(const String& name, WeakPtr<State> state, Vector<WeakPtr<Unit>> units);
+    Player(const String& name, WeakPtr<State> state, Vector<UnitId> units);
     ~Player() = default;
 
     void tick(float dt);
 
     WeakPtr<State> state() const;
 
+    const Vector<UnitId>& units() const {
+        return units_;
+    }
+
 private:
     String name_;
     WeakPtr<State> state_;
-    Vector<WeakPtr<Unit>> units_;
+    Vector<UnitId> units_;
 };
\ No newline at end of file
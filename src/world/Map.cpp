@@ -2,19 +2,29 @@
 #include "world/State.h"
 #include "world/Map.h"
 #include "math/Noise.h"
+#include "core/JobSystem.h"
+
+const u32 Map::NOISY_EDGE_LEVELS;
 
 namespace {
-void subdivide(Vector<Vec2>& points, std::mt19937& rng, const Vec2& A, const Vec2& B, const Vec2& C, const Vec2& D, float min_length) {
-    //std::cout << "A " << A << " B " << B << " C " << C << " D " << D << std::endl;
-    //std::cout << "Distance AC: " << vecDistance(A, C) << " Distance BD: " << vecDistance(B, D) << "Min: " << min_length << std::endl;
-    if (vecDistance(A, C) < min_length || vecDistance(B, D) < min_length) {
+// Noisy edges are only split while both diagonals of the quadrilateral being split are at least
+// this long.
+const float NOISY_EDGE_MIN_LENGTH = 2.0f;
+
+// Adds the points between A and C of a noisy line from A to C, which stays within the
+// quadrilateral ABCD, splitting it at most 'depth' more times. Each split is placed by a hash of
+// the line's seed and the split's position in the tree of splits, rather than by drawing from a
+// random sequence, so the points at each depth are a subset of the points at the next.
+void subdivide(Vector<Vec2>& points, u64 seed, u64 node, u32 depth, const Vec2& A, const Vec2& B, const Vec2& C,
+               const Vec2& D) {
+    if (depth == 0 || vecDistance(A, C) < NOISY_EDGE_MIN_LENGTH || vecDistance(B, D) < NOISY_EDGE_MIN_LENGTH) {
         return;
     }
 
     // Subdivide the quadrilateral
-    std::uniform_real_distribution<float> subdivide_range{0.3f, 0.7f};
-    float p = subdivide_range(rng);  // vertical (along A-D and B-C)
-    float q = subdivide_range(rng);  // horizontal (along A-B and D-C)
+    u64 hash = hashCombine(seed, node);
+    float p = 0.3f + 0.4f * float(hash & 0xffffff) / float(0x1000000);          // vertical (along A-D and B-C)
+    float q = 0.3f + 0.4f * float((hash >> 24) & 0xffffff) / float(0x1000000);  // horizontal (along A-B and D-C)
 
     // Midpoints
     Vec2 E = lerp(A, D, p);
@@ -26,23 +36,9 @@ void subdivide(Vector<Vec2>& points, std::mt19937& rng, const Vec2& A, const Vec
     Vec2 H = lerp(E, F, q);
 
     // Divide the quad into subquads, but meet at H
-    std::uniform_real_distribution<float> subquad_range{-0.4f, 0.4f};
-    float s = 1.0f - subquad_range(rng);
-    float t = 1.0f - subquad_range(rng);
-
-    subdivide(points, rng, A, G, H, E, min_length);
-    //subdivide(points, rng, A, lerp(G, B, s), H, lerp(E, D, t), min_length);
+    subdivide(points, seed, node * 2, depth - 1, A, G, H, E);
     points.push_back(H);
-    subdivide(points, rng, H, F, C, I, min_length);
-    //subdivide(points, rng, H, lerp(F, C, s), C, lerp(I, D, t), min_length);
-}
-
-Vector<Vec2> buildNoisyLineSegments(std::mt19937& rng, const Vec2& A, const Vec2& B, const Vec2& C, const Vec2& D, float min_length) {
-    Vector<Vec2> points;
-    points.push_back(A);
-    //subdivide(points, rng, A, B, C, D, min_length);
-    points.push_back(C);
-    return points;
+    subdivide(points, seed, node * 2 + 1, depth - 1, H, F, C, I);
 }
 }
 
@@ -87,7 +83,11 @@ double Map::Site::vertexAngle(const Vec2 &v) const {
     return atan2(v.y - centre.y, v.x - centre.x);
 }
 
-Map::Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng) {
+Map::Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng, JobSystem& jobs,
+         const String& terrain_cache_path)
+    : bounds_min_(min), bounds_max_(max) {
+    PROFILE_SCOPE("Map::Map");
+    MEMORY_SCOPE(MemoryTag::Map);
     const int relax_count = 100;
 
     // Seed RNG.
@@ -112,47 +112,68 @@ Map::Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng) {
     jcv_diagram diagram = {};
     jcv_diagram_generate(num_points, points.data(), &rect, &diagram);
     for (int i = 0; i < relax_count; ++i) {
-        points.clear();
+        PROFILE_SCOPE("Map::relax");
+
+        // Move each point to the centroid of its cell. Each cell is independent, so split the
+        // sites across the job system.
         const jcv_site* sites = jcv_diagram_get_sites(&diagram);
-        for (int j = 0; j < diagram.numsites; ++j) {
-            jcv_point p = {0.0f, 0.0f};
-            float edge_count = 0.0f;
-            for (jcv_graphedge* e = sites[j].edges; e; e = e->next) {
-                p.x += e->pos[0].x + e->pos[1].x;
-                p.y += e->pos[0].y + e->pos[1].y;
-                edge_count++;
+        points.resize(static_cast<size_t>(diagram.numsites));
+        jobs.parallelFor(0, (u32)diagram.numsites, 1024, [&points, sites](u32 begin, u32 end) {
+            PROFILE_SCOPE("Map::centroids");
+            for (u32 j = begin; j < end; ++j) {
+                jcv_point p = {0.0f, 0.0f};
+                float edge_count = 0.0f;
+                for (jcv_graphedge* e = sites[j].edges; e; e = e->next) {
+                    p.x += e->pos[0].x + e->pos[1].x;
+                    p.y += e->pos[0].y + e->pos[1].y;
+                    edge_count++;
+                }
+                p.x /= edge_count * 2;
+                p.y /= edge_count * 2;
+                points[j] = p;
             }
-            p.x /= edge_count * 2;
-            p.y /= edge_count * 2;
-            points.emplace_back(p);
-        }
-        jcv_diagram_generate(num_points, points.data(), &rect, &diagram);
+        });
+        jcv_diagram_generate((int)points.size(), points.data(), &rect, &diagram);
     }
 
-    // Build voronoi data structure from jcv_diagram.
+    // Build voronoi data structure from jcv_diagram. The diagram's sites are sorted by position
+    // (with duplicates removed), and 'jcv_site::index' refers to the input point, so map input
+    // points to sites before following neighbour links.
     HashMap<const jcv_edge*, SharedPtr<Edge>> edge_map;
     sites_.resize(static_cast<size_t>(diagram.numsites));
     const jcv_site* diagram_sites = jcv_diagram_get_sites(&diagram);
+    Vector<Site*> input_sites(points.size(), nullptr);
+    for (int i = 0; i < diagram.numsites; ++i) {
+        input_sites[diagram_sites[i].index] = &sites_[i];
+    }
     for (auto e = jcv_diagram_get_edges(&diagram); e; e = e->next) {
         auto new_edge = make_shared<Edge>();
         new_edge->points = {{e->pos[0].x, e->pos[0].y}, {e->pos[1].x, e->pos[1].y}};
-        new_edge->d[0] = &sites_[e->sites[0]->index];
-        new_edge->d[1] = &sites_[e->sites[1]->index];
+        new_edge->d[0] = e->sites[0] ? input_sites[e->sites[0]->index] : nullptr;
+        new_edge->d[1] = e->sites[1] ? input_sites[e->sites[1]->index] : nullptr;
         edge_map.emplace(e, new_edge);
     }
     for (int i = 0; i < diagram.numsites; ++i) {
+        sites_[i].index = (u32)i;
         sites_[i].usable = true;
         sites_[i].centre = {diagram_sites[i].p.x, diagram_sites[i].p.y};
         for (auto e = diagram_sites[i].edges; e; e = e->next) {
             sites_[i].edges.emplace_back();
             auto& new_edge = sites_[i].edges.back();
-            new_edge.edge = edge_map.at(e->edge);
             new_edge.points = {{e->pos[0].x, e->pos[0].y}, {e->pos[1].x, e->pos[1].y}};
             new_edge.next = nullptr;
             new_edge.angle = e->angle;
             if (e->neighbor) {
-                new_edge.neighbour = &sites_[e->neighbor->index];
+                new_edge.edge = edge_map.at(e->edge);
+                new_edge.neighbour = input_sites[e->neighbor->index];
             } else {
+                // Edges along the edge of the map are added to close off the outline of the site,
+                // and refer to the 'jcv_edge' of another edge, so they get one of their own.
+                new_edge.edge = make_shared<Edge>();
+                new_edge.edge->points = new_edge.points;
+                new_edge.edge->d[0] = &sites_[i];
+                new_edge.edge->d[1] = nullptr;
+
                 // An edge not having a neighbour site indicates that this is a site on
                 // the edges of the map. Therefore, it's not usable.
                 new_edge.neighbour = nullptr;
@@ -166,6 +187,17 @@ Map::Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng) {
     }
     edge_map.clear();
     jcv_diagram_free(&diagram);
+    buildSiteLocator(min, max);
+
+    // The map is generated the same way every time, so its terrain can be cached between runs.
+    u32 terrain_seed = (u32)hashMix(seedval);
+    u64 terrain_key = Terrain::cacheKey(*this, terrain_seed);
+    if (terrain_cache_path.empty() || !terrain_.load(terrain_cache_path, terrain_key, sites_.size())) {
+        terrain_.generate(*this, terrain_seed, jobs);
+        if (!terrain_cache_path.empty()) {
+            terrain_.save(terrain_cache_path, terrain_key);
+        }
+    }
 
 
 #if 0
@@ -357,6 +389,32 @@ Map::Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng) {
 #endif
 }
 
+const Vector<Vec2>& Map::noisyEdgePoints(const Edge& edge, u32 level) const {
+    level = std::min(level, NOISY_EDGE_LEVELS - 1);
+    if (level == 0 || !edge.d[0] || !edge.d[1]) {
+        return edge.points;
+    }
+    if (!edge.noisy_points) {
+        MEMORY_SCOPE(MemoryTag::Map);
+        edge.noisy_points.reset(new Vector<Vec2>[NOISY_EDGE_LEVELS]);
+    }
+    Vector<Vec2>& points = edge.noisy_points[level];
+    if (points.empty()) {
+        MEMORY_SCOPE(MemoryTag::Map);
+        u64 seed = hashCombine((hashFloat(edge.v0().x) << 32) | hashFloat(edge.v0().y),
+                               (hashFloat(edge.v1().x) << 32) | hashFloat(edge.v1().y));
+        points.push_back(edge.v0());
+        subdivide(points, seed, 1, level, edge.v0(), edge.d[0]->centre, edge.v1(), edge.d[1]->centre);
+        points.push_back(edge.v1());
+    }
+    return points;
+}
+
+bool Map::hasNoisyEdgePoints(const Edge& edge, u32 level) const {
+    level = std::min(level, NOISY_EDGE_LEVELS - 1);
+    return level == 0 || !edge.d[0] || !edge.d[1] || (edge.noisy_points && !edge.noisy_points[level].empty());
+}
+
 Vector<Map::Site> &Map::sites() {
     return sites_;
 }
@@ -365,7 +423,101 @@ const Vector<Map::Site> &Map::sites() const {
     return sites_;
 }
 
-Vector<Vector<Map::Map::GraphEdge*>> Map::unorderedBoundaries(const HashSet<Site*>& sites)
+u32 Map::siteIndexAt(const Vec2& position) const {
+    int cx = std::min(std::max(int((position.x - locator_min_.x) / locator_cell_size_), 0), locator_width_ - 1);
+    int cy = std::min(std::max(int((position.y - locator_min_.y) / locator_cell_size_), 0), locator_height_ - 1);
+
+    // Search rings of cells around the cell containing the position. Once a site has been found,
+    // any site in a ring further out than it is must be further away.
+    u32 best_site = 0;
+    float best_distance = std::numeric_limits<float>::max();
+    int max_ring = std::max(locator_width_, locator_height_);
+    for (int ring = 0; ring <= max_ring; ++ring) {
+        if (best_distance < std::numeric_limits<float>::max()) {
+            float ring_distance = float(ring - 1) * locator_cell_size_;
+            if (ring_distance > 0.0f && ring_distance * ring_distance > best_distance) {
+                break;
+            }
+        }
+        for (int y = cy - ring; y <= cy + ring; ++y) {
+            if (y < 0 || y >= locator_height_) {
+                continue;
+            }
+            bool edge_row = y == cy - ring || y == cy + ring;
+            for (int x = cx - ring; x <= cx + ring; x += edge_row ? 1 : ring * 2) {
+                if (x >= 0 && x < locator_width_) {
+                    int cell = y * locator_width_ + x;
+                    for (u32 i = locator_cell_start_[cell]; i < locator_cell_start_[cell + 1]; ++i) {
+                        u32 site = locator_sites_[i];
+                        Vec2 offset = sites_[site].centre - position;
+                        float distance = glm::dot(offset, offset);
+                        if (distance < best_distance) {
+                            best_distance = distance;
+                            best_site = site;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return best_site;
+}
+
+u32 Map::siteIndexNear(u32 hint, const Vec2& position) const {
+    // Greedy walk: step to whichever neighbour is nearer to the position, until none are. Each
+    // site's neighbours are its Delaunay neighbours, so this ends at the nearest site. Give up
+    // and use the locator if the position turns out to be far away.
+    const int max_steps = 8;
+    u32 site = hint;
+    float distance = glm::distance2(sites_[site].centre, position);
+    for (int step = 0; step < max_steps; ++step) {
+        u32 nearest = site;
+        for (auto& edge : sites_[site].edges) {
+            if (edge.neighbour) {
+                float neighbour_distance = glm::distance2(edge.neighbour->centre, position);
+                if (neighbour_distance < distance) {
+                    distance = neighbour_distance;
+                    nearest = edge.neighbour->index;
+                }
+            }
+        }
+        if (nearest == site) {
+            return site;
+        }
+        site = nearest;
+    }
+    return siteIndexAt(position);
+}
+
+void Map::buildSiteLocator(const Vec2& min, const Vec2& max) {
+    // Aim for about two sites per cell.
+    Vec2 extent = max - min;
+    locator_min_ = min;
+    locator_cell_size_ = std::max(std::sqrt(extent.x * extent.y * 2.0f / std::max((float)sites_.size(), 1.0f)), 1.0f);
+    locator_width_ = std::max(int(std::ceil(extent.x / locator_cell_size_)), 1);
+    locator_height_ = std::max(int(std::ceil(extent.y / locator_cell_size_)), 1);
+
+    // Bucket sites by cell using a counting sort.
+    auto cell_of = [this](const Vec2& p) {
+        int x = std::min(std::max(int((p.x - locator_min_.x) / locator_cell_size_), 0), locator_width_ - 1);
+        int y = std::min(std::max(int((p.y - locator_min_.y) / locator_cell_size_), 0), locator_height_ - 1);
+        return y * locator_width_ + x;
+    };
+    locator_cell_start_.assign((size_t)(locator_width_ * locator_height_ + 1), 0);
+    for (auto& site : sites_) {
+        locator_cell_start_[cell_of(site.centre) + 1]++;
+    }
+    for (size_t i = 1; i < locator_cell_start_.size(); ++i) {
+        locator_cell_start_[i] += locator_cell_start_[i - 1];
+    }
+    locator_sites_.resize(sites_.size());
+    Vector<u32> cursor{locator_cell_start_.begin(), locator_cell_start_.end() - 1};
+    for (auto& site : sites_) {
+        locator_sites_[cursor[cell_of(site.centre)]++] = site.index;
+    }
+}
+
+Vector<Vector<Map::Map::GraphEdge*>> Map::unorderedBoundaries(const SiteSet& sites)
 {
 	// Build edge list containing site boundaries.
 	Vector<Vector<Map::GraphEdge*>> exclave_boundaries;
@@ -382,3 +534,19 @@ Vector<Vector<Map::Map::GraphEdge*>> Map::unorderedBoundaries(const HashSet<Site
 	}
 	return exclave_boundaries;
 }
+
+Map::Site* Map::edgeSite(const GraphEdge& edge) {
+    return edge.edge->d[0] == edge.neighbour ? edge.edge->d[1] : edge.edge->d[0];
+}
+
+Map::GraphEdge* Map::oppositeEdge(const GraphEdge& edge) {
+    if (!edge.neighbour) {
+        return nullptr;
+    }
+    for (auto& other : edge.neighbour->edges) {
+        if (other.edge == edge.edge) {
+            return &other;
+        }
+    }
+    return nullptr;
+}
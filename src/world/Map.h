@@ -2,10 +2,12 @@
 
 #include <random>
 #include "math/voronoi/voronoi.h"
+#include "world/Terrain.h"
 
 const float VORONOI_EPSILON = 1e-2f;
 
 class State;
+class JobSystem;
 
 // Structured as a voronoi graph.
 class Map {
@@ -15,6 +17,9 @@ public:
         Vector<Vec2> points;
         Site* d[2];
 
+        // Noisy versions of the edge by level of detail, built on demand by noisyEdgePoints.
+        mutable UniquePtr<Vector<Vec2>[]> noisy_points;
+
         // Delunay Triangulation can be made from edges:
         //  sites[0].centre -> sites[1].centre
 
@@ -40,6 +45,7 @@ public:
     };
 
     struct Site {
+        u32 index;
         Vec2 centre;
         Vector<GraphEdge> edges;
         bool usable;
@@ -52,13 +58,81 @@ public:
         double vertexAngle(const Vec2& v) const;
     };
 
-    explicit Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng);
+    // Orders sites by index, so sets of sites iterate in the same order on every run.
+    struct SiteOrder {
+        bool operator()(const Site* a, const Site* b) const {
+            return a->index < b->index;
+        }
+    };
+    using SiteSet = OrderedSet<Site*, SiteOrder>;
+
+    // Levels of detail of noisy edges. Level 0 is the straight edge, and each level splits every
+    // segment of the level before in two, so level n has at most 2^n + 1 points.
+    static const u32 NOISY_EDGE_LEVELS = 6;
+
+    // Terrain is loaded from 'terrain_cache_path' if it holds terrain for this map, and otherwise
+    // generated and saved there. Nothing is read or written if the path is empty.
+    explicit Map(int num_points, const Vec2& min, const Vec2& max, std::mt19937& rng, JobSystem& jobs,
+                 const String& terrain_cache_path = "");
 
     Vector<Site>& sites();
     const Vector<Site>& sites() const;
 
-	static Vector<Vector<Map::GraphEdge*>> unorderedBoundaries(const HashSet<Map::Site*>& sites);
+    // Elevation, moisture and movement cost of each site.
+    const Terrain& terrain() const {
+        return terrain_;
+    }
+
+    // The area covered by the map.
+    const Vec2& boundsMin() const {
+        return bounds_min_;
+    }
+
+    const Vec2& boundsMax() const {
+        return bounds_max_;
+    }
+
+    // The edge between two sites, made irregular: a line from v0 to v1 wandering within the
+    // quadrilateral formed by the edge and the two site centres, so it never crosses another
+    // edge. Edges on the edge of the map stay straight. Each level is built the first time it is
+    // asked for and kept, so this is only safe to call from multiple threads for different edges,
+    // or once hasNoisyEdgePoints is true.
+    const Vector<Vec2>& noisyEdgePoints(const Edge& edge, u32 level) const;
+    bool hasNoisyEdgePoints(const Edge& edge, u32 level) const;
+
+    // The index of the site containing 'position'. Positions outside the map resolve to the
+    // nearest site.
+    u32 siteIndexAt(const Vec2& position) const;
+
+    // As siteIndexAt, but walks from the neighbouring sites of 'hint' towards the position. Much
+    // cheaper for positions which are at or near the hint, such as a unit which was in 'hint'
+    // last tick.
+    u32 siteIndexNear(u32 hint, const Vec2& position) const;
+
+	static Vector<Vector<Map::GraphEdge*>> unorderedBoundaries(const SiteSet& sites);
+
+    // The site whose outline 'edge' is part of.
+    static Site* edgeSite(const GraphEdge& edge);
+
+    // The same edge as part of the outline of the neighbouring site, running the other way, or
+    // null for edges on the edge of the map.
+    static GraphEdge* oppositeEdge(const GraphEdge& edge);
 
 private:
     Vector<Site> sites_;
+    Vec2 bounds_min_;
+    Vec2 bounds_max_;
+    Terrain terrain_;
+
+    // Site locator. A uniform grid over the map, with the sites whose centres lie in each cell.
+    // As each site is a voronoi cell, the site containing a point is the one with the nearest
+    // centre.
+    Vec2 locator_min_;
+    float locator_cell_size_;
+    int locator_width_;
+    int locator_height_;
+    Vector<u32> locator_cell_start_;
+    Vector<u32> locator_sites_;
+
+    void buildSiteLocator(const Vec2& min, const Vec2& max);
 };
@@ -0,0 +1,695 @@
+#include "Common.h"
+#include "world/Pathfinder.h"
+#include "core/JobSystem.h"
+
+namespace {
+const float INFINITE_COST = std::numeric_limits<float>::infinity();
+
+// Longest stretch of border, in neighbouring site pairs, served by a single entrance. Shorter
+// stretches give straighter paths, at the cost of more portals.
+const u32 MAX_ENTRANCE_WIDTH = 16;
+
+struct OpenNode {
+    float estimate;
+    float cost;
+    u32 node;
+};
+
+// Orders the open set as a min-heap on the estimated total cost.
+bool operator<(const OpenNode& a, const OpenNode& b) {
+    return a.estimate > b.estimate;
+}
+
+// Search state for one thread. Sized to the map on first use and reused by every search after
+// that. Per-site entries are only valid when their generation matches the current search, so they
+// never need clearing.
+struct SearchScratch {
+    Vector<float> cost;
+    Vector<u32> parent;
+    Vector<u32> generation;
+    Vector<OpenNode> open;
+    u32 current_generation = 0;
+
+    void prepare(size_t site_count) {
+        if (generation.size() != site_count) {
+            MEMORY_SCOPE(MemoryTag::Navigation);
+            cost.assign(site_count, 0.0f);
+            parent.assign(site_count, INVALID_SITE);
+            generation.assign(site_count, 0);
+            open.clear();
+            open.reserve(site_count);
+            current_generation = 0;
+        }
+        if (++current_generation == 0) {
+            std::fill(generation.begin(), generation.end(), 0);
+            current_generation = 1;
+        }
+        open.clear();
+    }
+
+    // Returns true if 'node' was reached more cheaply than 'new_cost' in the current search.
+    bool reachedCheaper(u32 node, float new_cost) const {
+        return generation[node] == current_generation && cost[node] <= new_cost;
+    }
+
+    void reach(u32 node, u32 from, float new_cost, float estimate) {
+        generation[node] = current_generation;
+        cost[node] = new_cost;
+        parent[node] = from;
+        open.push_back({estimate, new_cost, node});
+        std::push_heap(open.begin(), open.end());
+    }
+
+    bool pop(OpenNode& node) {
+        while (!open.empty()) {
+            std::pop_heap(open.begin(), open.end());
+            node = open.back();
+            open.pop_back();
+
+            // Skip stale entries for nodes which have since been reached more cheaply.
+            if (node.cost <= cost[node.node]) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+thread_local SearchScratch tls_scratch;
+
+u64 cacheKey(u32 from, u32 to) {
+    return (u64(from) << 32) | to;
+}
+
+u64 clusterPairKey(u32 a, u32 b) {
+    return a < b ? (u64(a) << 32) | b : (u64(b) << 32) | a;
+}
+}
+
+const u32 Pathfinder::INVALID_CLUSTER;
+const u32 Pathfinder::UNOWNED_CLUSTER;
+
+Pathfinder::Pathfinder(const Map& map, JobSystem& jobs, size_t cache_capacity)
+    : map_(map),
+      jobs_(jobs),
+      clusters_changed_{false},
+      cache_capacity_{cache_capacity},
+      search_count_{0},
+      cache_hit_count_{0},
+      flow_field_count_{0} {
+    MEMORY_SCOPE(MemoryTag::Navigation);
+
+    // Everything starts out unowned.
+    u32 site_count = (u32)map_.sites().size();
+    clusters_.emplace_back();
+    Cluster& unowned = clusters_.back();
+    unowned.state = nullptr;
+    unowned.first_portal = 0;
+    unowned.land_changed = false;
+    unowned.portals_changed = false;
+    site_cluster_.assign(site_count, UNOWNED_CLUSTER);
+    cluster_slot_.resize(site_count);
+    unowned.sites.resize(site_count);
+    for (u32 i = 0; i < site_count; ++i) {
+        unowned.sites[i] = i;
+        cluster_slot_[i] = i;
+    }
+}
+
+SharedPtr<const SitePath> Pathfinder::findPath(u32 from, u32 to) {
+    u64 key = cacheKey(from, to);
+    {
+        std::lock_guard<std::mutex> lock{cache_mutex_};
+        auto it = cache_index_.find(key);
+        if (it != cache_index_.end()) {
+            cache_.splice(cache_.begin(), cache_, it->second);
+            cache_hit_count_.fetch_add(1, std::memory_order_relaxed);
+            return it->second->path;
+        }
+    }
+
+    // Search without holding the lock. Two threads may search for the same path at once, in which
+    // case the first result to be cached wins.
+    SharedPtr<const SitePath> path;
+    if (site_cluster_[from] != site_cluster_[to]) {
+        path = hierarchicalSearch(from, to);
+    }
+    if (!path) {
+        path = search(from, to, INVALID_CLUSTER);
+    }
+    search_count_.fetch_add(1, std::memory_order_relaxed);
+
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    std::lock_guard<std::mutex> lock{cache_mutex_};
+    auto it = cache_index_.find(key);
+    if (it != cache_index_.end()) {
+        return it->second->path;
+    }
+    cache_.push_front({key, path});
+    cache_index_[key] = cache_.begin();
+    if (cache_.size() > cache_capacity_) {
+        cache_index_.erase(cache_.back().key);
+        cache_.pop_back();
+    }
+    return path;
+}
+
+SharedPtr<const FlowField> Pathfinder::findFlowField(u32 goal) {
+    // Build while holding the lock, so a group of units starting the same order at once wait for
+    // one field rather than each building their own.
+    std::lock_guard<std::mutex> lock{flow_field_mutex_};
+    auto it = flow_fields_.find(goal);
+    if (it != flow_fields_.end()) {
+        if (auto field = it->second.lock()) {
+            return field;
+        }
+    }
+
+    // Forget fields which are no longer in use.
+    for (auto field = flow_fields_.begin(); field != flow_fields_.end();) {
+        field = field->second.expired() ? flow_fields_.erase(field) : std::next(field);
+    }
+
+    SharedPtr<const FlowField> field = buildFlowField(goal);
+    flow_field_count_.fetch_add(1, std::memory_order_relaxed);
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    flow_fields_[goal] = field;
+    return field;
+}
+
+SharedPtr<const FlowField> Pathfinder::sharedFlowField(u32 goal) {
+    std::lock_guard<std::mutex> lock{flow_field_mutex_};
+    auto it = flow_fields_.find(goal);
+    return it != flow_fields_.end() ? it->second.lock() : nullptr;
+}
+
+void Pathfinder::onSiteOwnerChanged(const Map::Site& site) {
+    u32 next = clusterForState(site.owning_state);
+    u32 previous = site_cluster_[site.index];
+    if (next == previous) {
+        return;
+    }
+
+    // Swap remove from the previous cluster.
+    Vector<u32>& previous_sites = clusters_[previous].sites;
+    u32 slot = cluster_slot_[site.index];
+    previous_sites[slot] = previous_sites.back();
+    cluster_slot_[previous_sites[slot]] = slot;
+    previous_sites.pop_back();
+
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    Vector<u32>& next_sites = clusters_[next].sites;
+    cluster_slot_[site.index] = (u32)next_sites.size();
+    next_sites.push_back(site.index);
+    site_cluster_[site.index] = next;
+
+    clusters_[previous].land_changed = true;
+    clusters_[next].land_changed = true;
+    clusters_changed_ = true;
+}
+
+void Pathfinder::refresh() {
+    if (!clusters_changed_) {
+        return;
+    }
+    PROFILE_SCOPE("Pathfinder::refresh");
+    MEMORY_SCOPE(MemoryTag::Navigation);
+
+    // Drop the entrances on every border of a cluster whose land has changed.
+    Vector<u32> changed_clusters;
+    for (u32 c = 0; c < clusters_.size(); ++c) {
+        if (clusters_[c].land_changed) {
+            changed_clusters.push_back(c);
+        }
+    }
+    HashMap<u64, Vector<Entrance>> previous_entrances;
+    for (u32 c : changed_clusters) {
+        for (u32 neighbour : clusters_[c].neighbours) {
+            u64 key = clusterPairKey(c, neighbour);
+            auto it = entrances_.find(key);
+            if (it != entrances_.end()) {
+                previous_entrances[key] = std::move(it->second);
+                entrances_.erase(it);
+            }
+            clusters_[neighbour].neighbours.erase(c);
+        }
+        clusters_[c].neighbours.clear();
+    }
+
+    // Find them again. A border between two changed clusters only needs to be found from one side.
+    Vector<bool> already_found(clusters_.size(), false);
+    for (u32 c : changed_clusters) {
+        findEntrances(c, already_found);
+        already_found[c] = true;
+    }
+
+    // The clusters on the other side of a border only need new portal links if its entrances
+    // have moved.
+    auto same_entrances = [](const Vector<Entrance>& a, const Vector<Entrance>& b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const Entrance& x, const Entrance& y) {
+            return x.sites[0] == y.sites[0] && x.sites[1] == y.sites[1];
+        });
+    };
+    for (auto& border : previous_entrances) {
+        auto it = entrances_.find(border.first);
+        if (it == entrances_.end() || !same_entrances(border.second, it->second)) {
+            clusters_[u32(border.first >> 32)].portals_changed = true;
+            clusters_[u32(border.first)].portals_changed = true;
+        }
+    }
+    for (u32 c : changed_clusters) {
+        for (u32 neighbour : clusters_[c].neighbours) {
+            if (previous_entrances.count(clusterPairKey(c, neighbour)) == 0) {
+                clusters_[neighbour].portals_changed = true;
+            }
+        }
+    }
+
+    // Collect the portals of each affected cluster, and cost the links between them in parallel.
+    Vector<u32> portal_changes;
+    for (u32 c = 0; c < clusters_.size(); ++c) {
+        Cluster& cluster = clusters_[c];
+        if (!cluster.land_changed && !cluster.portals_changed) {
+            continue;
+        }
+        cluster.portal_sites.clear();
+        for (u32 neighbour : cluster.neighbours) {
+            for (auto& entrance : entrances_.at(clusterPairKey(c, neighbour))) {
+                cluster.portal_sites.push_back(entrance.sites[c < neighbour ? 0 : 1]);
+            }
+        }
+        std::sort(cluster.portal_sites.begin(), cluster.portal_sites.end());
+        cluster.portal_sites.erase(std::unique(cluster.portal_sites.begin(), cluster.portal_sites.end()),
+                                   cluster.portal_sites.end());
+        cluster.land_changed = false;
+        cluster.portals_changed = false;
+        portal_changes.push_back(c);
+    }
+    jobs_.parallelFor(0, (u32)portal_changes.size(), 1, [this, &portal_changes](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i) {
+            computePortalCosts(clusters_[portal_changes[i]]);
+        }
+    });
+
+    buildPortalGraph();
+    clusters_changed_ = false;
+}
+
+u32 Pathfinder::clusterForState(const State* state) {
+    if (!state) {
+        return UNOWNED_CLUSTER;
+    }
+    auto it = state_clusters_.find(state);
+    if (it != state_clusters_.end()) {
+        return it->second;
+    }
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    u32 index = (u32)clusters_.size();
+    clusters_.emplace_back();
+    Cluster& cluster = clusters_.back();
+    cluster.state = state;
+    cluster.first_portal = 0;
+    cluster.land_changed = false;
+    cluster.portals_changed = false;
+    state_clusters_.emplace(state, index);
+    return index;
+}
+
+void Pathfinder::findEntrances(u32 cluster_index, const Vector<bool>& already_found) {
+    struct Crossing {
+        u32 inner;
+        u32 outer;
+    };
+
+    // Find every pair of neighbouring sites which crosses out of this cluster, grouped by the
+    // cluster on the other side.
+    const Vector<Map::Site>& sites = map_.sites();
+    Cluster& cluster = clusters_[cluster_index];
+    HashMap<u32, Vector<Crossing>> crossings;
+    for (u32 s : cluster.sites) {
+        if (!sites[s].usable) {
+            continue;
+        }
+        for (auto& edge : sites[s].edges) {
+            if (!edge.neighbour || !edge.neighbour->usable) {
+                continue;
+            }
+            u32 other = site_cluster_[edge.neighbour->index];
+            if (other != cluster_index && !already_found[other]) {
+                crossings[other].push_back({s, edge.neighbour->index});
+            }
+        }
+    }
+
+    for (auto& border : crossings) {
+        u32 other = border.first;
+
+        // Sort the crossings, so the same border always splits into the same stretches.
+        Vector<Crossing>& list = border.second;
+        std::sort(list.begin(), list.end(), [](const Crossing& a, const Crossing& b) {
+            return a.inner != b.inner ? a.inner < b.inner : a.outer < b.outer;
+        });
+
+        // Split the border into contiguous stretches of at most MAX_ENTRANCE_WIDTH crossings. Two
+        // crossings are adjacent if they share a site, or their sites on the same side are
+        // neighbours. Walking the crossings breadth first keeps each stretch contiguous.
+        HashMap<u32, Vector<u32>> site_crossings;
+        for (u32 i = 0; i < list.size(); ++i) {
+            site_crossings[list[i].inner].push_back(i);
+            site_crossings[list[i].outer].push_back(i);
+        }
+        Vector<Vector<u32>> stretches;
+        Vector<bool> visited(list.size(), false);
+        Queue<u32> frontier;
+        for (u32 seed = 0; seed < list.size(); ++seed) {
+            if (visited[seed]) {
+                continue;
+            }
+            stretches.emplace_back();
+            visited[seed] = true;
+            frontier.push(seed);
+            while (!frontier.empty()) {
+                u32 i = frontier.front();
+                frontier.pop();
+                if (stretches.back().size() == MAX_ENTRANCE_WIDTH) {
+                    stretches.emplace_back();
+                }
+                stretches.back().push_back(i);
+                auto visit = [&](u32 site) {
+                    auto it = site_crossings.find(site);
+                    if (it != site_crossings.end()) {
+                        for (u32 j : it->second) {
+                            if (!visited[j]) {
+                                visited[j] = true;
+                                frontier.push(j);
+                            }
+                        }
+                    }
+                };
+                for (u32 s : {list[i].inner, list[i].outer}) {
+                    visit(s);
+                    for (auto& edge : sites[s].edges) {
+                        if (edge.neighbour) {
+                            visit(edge.neighbour->index);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Place one entrance in the middle of each stretch.
+        Vector<Entrance>& entrances = entrances_[clusterPairKey(cluster_index, other)];
+        for (auto& stretch : stretches) {
+            auto midpoint = [&](u32 i) {
+                return (sites[list[i].inner].centre + sites[list[i].outer].centre) * 0.5f;
+            };
+            Vec2 centre{0.0f, 0.0f};
+            for (u32 i : stretch) {
+                centre += midpoint(i);
+            }
+            centre /= (float)stretch.size();
+            u32 best = stretch.front();
+            for (u32 i : stretch) {
+                if (glm::distance(midpoint(i), centre) < glm::distance(midpoint(best), centre)) {
+                    best = i;
+                }
+            }
+            Entrance entrance;
+            entrance.sites[0] = cluster_index < other ? list[best].inner : list[best].outer;
+            entrance.sites[1] = cluster_index < other ? list[best].outer : list[best].inner;
+            entrances.push_back(entrance);
+        }
+        std::sort(entrances.begin(), entrances.end(), [](const Entrance& a, const Entrance& b) {
+            return a.sites[0] != b.sites[0] ? a.sites[0] < b.sites[0] : a.sites[1] < b.sites[1];
+        });
+        cluster.neighbours.insert(other);
+        clusters_[other].neighbours.insert(cluster_index);
+    }
+}
+
+void Pathfinder::computePortalCosts(Cluster& cluster) const {
+    PROFILE_SCOPE("Pathfinder::computePortalCosts");
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    const Vector<Map::Site>& sites = map_.sites();
+    u32 portal_count = (u32)cluster.portal_sites.size();
+    cluster.portal_costs.assign(portal_count * portal_count, INFINITE_COST);
+    if (portal_count == 0) {
+        return;
+    }
+    u32 cluster_index = site_cluster_[cluster.portal_sites.front()];
+    HashMap<u32, u32> portal_indices;
+    for (u32 i = 0; i < portal_count; ++i) {
+        portal_indices.emplace(cluster.portal_sites[i], i);
+    }
+
+    // Dijkstra from each portal, without leaving the cluster, until every other portal is reached.
+    SearchScratch& scratch = tls_scratch;
+    for (u32 i = 0; i < portal_count; ++i) {
+        scratch.prepare(sites.size());
+        scratch.reach(cluster.portal_sites[i], INVALID_SITE, 0.0f, 0.0f);
+        u32 portals_reached = 0;
+        OpenNode node;
+        while (portals_reached < portal_count && scratch.pop(node)) {
+            auto portal = portal_indices.find(node.node);
+            if (portal != portal_indices.end()) {
+                cluster.portal_costs[i * portal_count + portal->second] = node.cost;
+                portals_reached++;
+            }
+            const Map::Site& site = sites[node.node];
+            for (auto& edge : site.edges) {
+                const Map::Site* neighbour = edge.neighbour;
+                if (!neighbour || !neighbour->usable || site_cluster_[neighbour->index] != cluster_index) {
+                    continue;
+                }
+                float cost = node.cost + stepCost(site, *neighbour);
+                if (!scratch.reachedCheaper(neighbour->index, cost)) {
+                    scratch.reach(neighbour->index, node.node, cost, cost);
+                }
+            }
+        }
+    }
+}
+
+void Pathfinder::buildPortalGraph() {
+    const Vector<Map::Site>& sites = map_.sites();
+    portals_.clear();
+    site_portals_.clear();
+    for (u32 c = 0; c < clusters_.size(); ++c) {
+        clusters_[c].first_portal = (u32)portals_.size();
+        for (u32 site : clusters_[c].portal_sites) {
+            site_portals_.emplace(site, (u32)portals_.size());
+            portals_.push_back({site, c, {}});
+        }
+    }
+
+    // Links within clusters.
+    for (auto& cluster : clusters_) {
+        u32 portal_count = (u32)cluster.portal_sites.size();
+        for (u32 i = 0; i < portal_count; ++i) {
+            for (u32 j = 0; j < portal_count; ++j) {
+                float cost = cluster.portal_costs[i * portal_count + j];
+                if (i != j && cost < INFINITE_COST) {
+                    portals_[cluster.first_portal + i].links.push_back({cluster.first_portal + j, cost});
+                }
+            }
+        }
+    }
+
+    // Links across borders.
+    for (auto& border : entrances_) {
+        for (auto& entrance : border.second) {
+            u32 a = site_portals_.at(entrance.sites[0]);
+            u32 b = site_portals_.at(entrance.sites[1]);
+            float cost = stepCost(sites[entrance.sites[0]], sites[entrance.sites[1]]);
+            portals_[a].links.push_back({b, cost});
+            portals_[b].links.push_back({a, cost});
+        }
+    }
+}
+
+SharedPtr<const SitePath> Pathfinder::hierarchicalSearch(u32 from, u32 to) const {
+    PROFILE_SCOPE("Pathfinder::hierarchicalSearch");
+    const Vector<Map::Site>& sites = map_.sites();
+    const Cluster& from_cluster = clusters_[site_cluster_[from]];
+    const u32 to_cluster = site_cluster_[to];
+    if (from_cluster.portal_sites.empty() || clusters_[to_cluster].portal_sites.empty()) {
+        return nullptr;
+    }
+
+    // Search the portal graph, with two extra nodes for the start and goal. The start links to
+    // every portal of its cluster, and every portal in the goal's cluster links to the goal, with
+    // straight line costs.
+    const u32 portal_count = (u32)portals_.size();
+    const u32 start = portal_count;
+    const u32 goal = portal_count + 1;
+    auto site_of = [&](u32 node) {
+        return node < portal_count ? portals_[node].site : (node == start ? from : to);
+    };
+    const Vec2 goal_position = sites[to].centre;
+    Vector<float> cost(portal_count + 2, INFINITE_COST);
+    Vector<u32> parent(portal_count + 2, INVALID_SITE);
+    Vector<OpenNode> open;
+    auto reach = [&](u32 node, u32 previous, float new_cost) {
+        if (new_cost < cost[node]) {
+            cost[node] = new_cost;
+            parent[node] = previous;
+            open.push_back({new_cost + glm::distance(sites[site_of(node)].centre, goal_position), new_cost, node});
+            std::push_heap(open.begin(), open.end());
+        }
+    };
+    reach(start, INVALID_SITE, 0.0f);
+    while (!open.empty()) {
+        std::pop_heap(open.begin(), open.end());
+        OpenNode node = open.back();
+        open.pop_back();
+        if (node.cost > cost[node.node]) {
+            continue;
+        }
+        if (node.node == goal) {
+            break;
+        }
+        const Vec2& position = sites[site_of(node.node)].centre;
+        if (node.node == start) {
+            for (u32 i = 0; i < from_cluster.portal_sites.size(); ++i) {
+                u32 portal = from_cluster.first_portal + i;
+                reach(portal, start, glm::distance(position, sites[portals_[portal].site].centre));
+            }
+            continue;
+        }
+        for (auto& link : portals_[node.node].links) {
+            reach(link.portal, node.node, node.cost + link.cost);
+        }
+        if (portals_[node.node].cluster == to_cluster) {
+            reach(goal, node.node, node.cost + glm::distance(position, goal_position));
+        }
+    }
+    if (cost[goal] == INFINITE_COST) {
+        return nullptr;
+    }
+
+    // Refine the route through the portals into a path between neighbouring sites.
+    Vector<u32> route;
+    for (u32 node = goal; node != INVALID_SITE; node = parent[node]) {
+        route.push_back(site_of(node));
+    }
+    std::reverse(route.begin(), route.end());
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    auto path = make_shared<SitePath>();
+    path->push_back(from);
+    for (u32 i = 1; i < route.size(); ++i) {
+        u32 a = route[i - 1];
+        u32 b = route[i];
+        if (a == b) {
+            continue;
+        }
+        bool neighbours = std::any_of(sites[a].edges.begin(), sites[a].edges.end(), [b](const Map::GraphEdge& edge) {
+            return edge.neighbour && edge.neighbour->index == b;
+        });
+        if (neighbours) {
+            path->push_back(b);
+            continue;
+        }
+        u32 cluster = site_cluster_[a] == site_cluster_[b] ? site_cluster_[a] : INVALID_CLUSTER;
+        if (!appendSearch(*path, a, b, cluster)) {
+            return nullptr;
+        }
+    }
+    return path;
+}
+
+SharedPtr<const SitePath> Pathfinder::search(u32 from, u32 to, u32 cluster) const {
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    auto path = make_shared<SitePath>();
+    path->push_back(from);
+    if (!appendSearch(*path, from, to, cluster)) {
+        return nullptr;
+    }
+    return path;
+}
+
+bool Pathfinder::appendSearch(SitePath& path, u32 from, u32 to, u32 cluster) const {
+    PROFILE_SCOPE("Pathfinder::search");
+    const Vector<Map::Site>& sites = map_.sites();
+    SearchScratch& scratch = tls_scratch;
+    scratch.prepare(sites.size());
+
+    // Site centres are joined by straight lines, and movement costs are at least 1, so the
+    // straight line distance to the goal never overestimates.
+    const Vec2 goal = sites[to].centre;
+    scratch.reach(from, INVALID_SITE, 0.0f, glm::distance(sites[from].centre, goal));
+    OpenNode node;
+    while (scratch.pop(node)) {
+        if (node.node == to) {
+            // Append the path, excluding 'from' which is already on the end.
+            size_t first = path.size();
+            for (u32 site = to; site != from; site = scratch.parent[site]) {
+                path.push_back(site);
+            }
+            std::reverse(path.begin() + first, path.end());
+            return true;
+        }
+
+        const Map::Site& site = sites[node.node];
+        for (auto& edge : site.edges) {
+            const Map::Site* neighbour = edge.neighbour;
+
+            // Sites on the edge of the map can't be entered, except as the destination.
+            if (!neighbour || (!neighbour->usable && neighbour->index != to)) {
+                continue;
+            }
+            if (cluster != INVALID_CLUSTER && site_cluster_[neighbour->index] != cluster) {
+                continue;
+            }
+            float cost = node.cost + stepCost(site, *neighbour);
+            if (!scratch.reachedCheaper(neighbour->index, cost)) {
+                scratch.reach(neighbour->index, node.node, cost, cost + glm::distance(neighbour->centre, goal));
+            }
+        }
+    }
+
+    // Refining within a cluster can fail when it's split in two. Try again without restriction.
+    if (cluster != INVALID_CLUSTER) {
+        return appendSearch(path, from, to, INVALID_CLUSTER);
+    }
+    return false;
+}
+
+float Pathfinder::stepCost(const Map::Site& from, const Map::Site& to) const {
+    const Terrain& terrain = map_.terrain();
+    float movement_cost = (terrain.movementCost(from.index) + terrain.movementCost(to.index)) * 0.5f;
+    return glm::distance(from.centre, to.centre) * movement_cost;
+}
+
+SharedPtr<const FlowField> Pathfinder::buildFlowField(u32 goal) const {
+    PROFILE_SCOPE("Pathfinder::buildFlowField");
+    MEMORY_SCOPE(MemoryTag::Navigation);
+    const Vector<Map::Site>& sites = map_.sites();
+    Vector<u32> next_sites(sites.size(), INVALID_SITE);
+
+    // Dijkstra outwards from the goal. The site graph is undirected, so the site each site was
+    // reached from is the next step towards the goal.
+    SearchScratch& scratch = tls_scratch;
+    scratch.prepare(sites.size());
+    scratch.reach(goal, goal, 0.0f, 0.0f);
+    OpenNode node;
+    while (scratch.pop(node)) {
+        next_sites[node.node] = scratch.parent[node.node];
+
+        // Sites on the edge of the map can be left, but not passed through.
+        const Map::Site& site = sites[node.node];
+        if (!site.usable && node.node != goal) {
+            continue;
+        }
+        for (auto& edge : site.edges) {
+            const Map::Site* neighbour = edge.neighbour;
+            if (!neighbour) {
+                continue;
+            }
+            float cost = node.cost + stepCost(site, *neighbour);
+            if (!scratch.reachedCheaper(neighbour->index, cost)) {
+                scratch.reach(neighbour->index, node.node, cost, cost);
+            }
+        }
+    }
+    return make_shared<FlowField>(goal, std::move(next_sites));
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "world/Map.h"
+
+class JobSystem;
+
+const u32 INVALID_SITE = ~0u;
+
+// A route through the site graph, as site indices from the start site to the goal site inclusive.
+using SitePath = Vector<u32>;
+
+// The next site to move to from every site on the map, to reach a single goal site by the
+// cheapest route. Built with one search outwards from the goal, so any number of units can share
+// it.
+class FlowField {
+public:
+    FlowField(u32 goal, Vector<u32> next_sites) : goal_{goal}, next_sites_(std::move(next_sites)) {}
+
+    u32 goal() const {
+        return goal_;
+    }
+
+    // INVALID_SITE if the goal can't be reached from 'site'. The goal leads to itself.
+    u32 nextSite(u32 site) const {
+        return next_sites_[site];
+    }
+
+private:
+    u32 goal_;
+    Vector<u32> next_sites_;
+};
+
+// Hierarchical A* search over the neighbour links between map sites.
+//
+// Sites are grouped into clusters by the state which owns them, with one more cluster for unowned
+// land. Where two clusters share a border, each contiguous stretch of it gets a pair of portal
+// sites, one either side. The portals form a small graph, with links across each border and
+// links between the portals of a cluster weighted by the cost of travelling between them. Paths
+// between clusters are found by searching the portal graph and then refining each stretch within
+// a cluster with a search restricted to that cluster.
+//
+// Paths are shared and immutable, and the most recently used ones are kept in an LRU cache keyed
+// by (from site, to site), so units which are ordered to the same place from the same site only
+// cost one search.
+class Pathfinder {
+public:
+    static const size_t DEFAULT_CACHE_CAPACITY = 4096;
+
+    Pathfinder(const Map& map, JobSystem& jobs, size_t cache_capacity = DEFAULT_CACHE_CAPACITY);
+
+    Pathfinder(const Pathfinder&) = delete;
+    Pathfinder& operator=(const Pathfinder&) = delete;
+
+    // Find a path between two sites, or null if 'to' can't be reached. Safe to call from multiple
+    // threads, but not at the same time as onSiteOwnerChanged or refresh.
+    SharedPtr<const SitePath> findPath(u32 from, u32 to);
+
+    // The flow field towards 'goal'. Fields are shared while any unit holds a reference, and
+    // freed once the last order using one finishes. Safe to call from multiple threads.
+    SharedPtr<const FlowField> findFlowField(u32 goal);
+
+    // The flow field towards 'goal' if one is already in use, otherwise null.
+    SharedPtr<const FlowField> sharedFlowField(u32 goal);
+
+    // Moves the site into the cluster of its new owner. The clusters either side are rebuilt by
+    // the next refresh.
+    void onSiteOwnerChanged(const Map::Site& site);
+
+    // Rebuild the portals and portal links of clusters which have changed since the last refresh.
+    void refresh();
+
+    const Map& map() const {
+        return map_;
+    }
+
+    // Statistics.
+    u64 searchCount() const {
+        return search_count_.load(std::memory_order_relaxed);
+    }
+
+    u64 cacheHitCount() const {
+        return cache_hit_count_.load(std::memory_order_relaxed);
+    }
+
+    u32 portalCount() const {
+        return (u32)portals_.size();
+    }
+
+    u64 flowFieldCount() const {
+        return flow_field_count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const u32 INVALID_CLUSTER = ~0u;
+    static const u32 UNOWNED_CLUSTER = 0;
+
+    struct Cluster {
+        const State* state;
+
+        // Member sites, in no particular order. 'cluster_slot_' gives each site's position.
+        Vector<u32> sites;
+        HashSet<u32> neighbours;
+
+        // Portal sites on this side of the cluster's borders, and the cost of travelling between
+        // each pair of them without leaving the cluster (row-major, infinite if unreachable).
+        Vector<u32> portal_sites;
+        Vector<float> portal_costs;
+        u32 first_portal;
+
+        bool land_changed;
+        bool portals_changed;
+    };
+
+    // A crossing between two clusters. sites[0] is in the cluster with the lower index.
+    struct Entrance {
+        u32 sites[2];
+    };
+
+    struct PortalLink {
+        u32 portal;
+        float cost;
+    };
+
+    struct Portal {
+        u32 site;
+        u32 cluster;
+        Vector<PortalLink> links;
+    };
+
+    struct CacheEntry {
+        u64 key;
+        SharedPtr<const SitePath> path;
+    };
+
+    const Map& map_;
+    JobSystem& jobs_;
+
+    // Cluster graph.
+    Vector<Cluster> clusters_;
+    HashMap<const State*, u32> state_clusters_;
+    Vector<u32> site_cluster_;
+    Vector<u32> cluster_slot_;
+    // Ordered, so the portal graph links are always built in the same order and searches break
+    // ties the same way on every run.
+    OrderedMap<u64, Vector<Entrance>> entrances_;
+    Vector<Portal> portals_;
+    HashMap<u32, u32> site_portals_;
+    bool clusters_changed_;
+
+    // Most recently used at the front.
+    std::mutex cache_mutex_;
+    size_t cache_capacity_;
+    List<CacheEntry> cache_;
+    HashMap<u64, List<CacheEntry>::iterator> cache_index_;
+
+    std::atomic<u64> search_count_;
+    std::atomic<u64> cache_hit_count_;
+
+    // Flow fields in use, by goal site.
+    std::mutex flow_field_mutex_;
+    HashMap<u32, WeakPtr<const FlowField>> flow_fields_;
+    std::atomic<u64> flow_field_count_;
+
+    u32 clusterForState(const State* state);
+    void findEntrances(u32 cluster, const Vector<bool>& already_found);
+    void computePortalCosts(Cluster& cluster) const;
+    void buildPortalGraph();
+
+    SharedPtr<const SitePath> hierarchicalSearch(u32 from, u32 to) const;
+    bool appendSearch(SitePath& path, u32 from, u32 to, u32 cluster) const;
+    SharedPtr<const SitePath> search(u32 from, u32 to, u32 cluster) const;
+    SharedPtr<const FlowField> buildFlowField(u32 goal) const;
+
+    // Cost of moving between neighbouring sites: the distance between their centres, at the
+    // average movement cost of the two.
+    float stepCost(const Map::Site& from, const Map::Site& to) const;
+};
@@ -2,6 +2,42 @@
 #include "world/State.h"
 #include "world/World.h"
 
+namespace {
+// Marks a border edge which hasn't been traced into a loop yet.
+const u32 NO_LOOP = ~0u;
+
+// Sites meet three to a corner, so this many turns about a corner without leaving the state
+// means the sites are malformed.
+const u32 MAX_CORNER_TURNS = 16;
+
+// Labels are left behind as parts join and split. They are compacted once there are more than
+// this many beyond twice the number of sites.
+const u32 LABEL_SLACK = 64;
+
+// Depth of sites not yet given one.
+const u32 NO_DEPTH = ~0u;
+
+// Area of a site, and its centre of area, as a fan of triangles about its centre.
+float siteArea(const Map::Site& site, Vec2& centre) {
+    float area = 0.0f;
+    Vec2 weighted_centre{0.0f, 0.0f};
+    for (auto& edge : site.edges) {
+        Vec2 a = edge.v0() - site.centre;
+        Vec2 b = edge.v1() - site.centre;
+        float triangle_area = (a.x * b.y - b.x * a.y) * 0.5f;
+        area += triangle_area;
+        weighted_centre += (a + b) * (triangle_area / 3.0f);
+    }
+    centre = site.centre + (area != 0.0f ? weighted_centre / area : Vec2{0.0f, 0.0f});
+    return std::abs(area);
+}
+
+// The contribution of an edge to twice the signed area enclosed by a loop of edges.
+float windingArea(const Map::GraphEdge& edge) {
+    return edge.v0().x * edge.v1().y - edge.v1().x * edge.v0().y;
+}
+}
+
 City::City(const String& name, Map::Site* site, Vec2& position) : site_{site}, position_{position}
 {
 	gui_name_.setString(name);
@@ -17,18 +53,14 @@ void City::draw(RenderContext& ctx, sf::Shape& shape)
 	ctx.window->draw(shape);
 }
 
-State::State(sf::Color colour, const String& name, const HashSet<Map::Site*>& land) : colour_(colour), name_(name), land_(land) {
+State::State(World* world, int id, sf::Color colour, const String& name, const Map::SiteSet& land)
+    : world_(world), id_(id), colour_(colour), name_(name), area_{0.0}, weighted_x_{0.0}, weighted_y_{0.0},
+      capital_{nullptr} {
     colour_.a = 100;
     gui_name_.setString(name);
-
-    // Calculate centre.
-    centre_ = {0.0f, 0.0f};
-    for (auto& tile : land_) {
-        centre_ += tile->centre;
+    for (auto& tile : land) {
+        addLandTile(tile);
     }
-    centre_ /= (float)land_.size();
-
-    gui_name_.setPosition(toSFML(centre_));
     gui_name_.setCharacterSize(20);
 }
 
@@ -38,19 +70,36 @@ void State::setName(const String &name) {
 }
 
 void State::addLandTile(Map::Site *tile) {
+    MEMORY_SCOPE(MemoryTag::States);
+    if (tile->owning_state == this) {
+        return;
+    }
     if (tile->owning_state) {
         tile->owning_state->removeLandTile(tile);
     }
     land_.insert(tile);
     tile->owning_state = this;
+    updateBorder(tile);
+    joinComponents(tile);
+    updateShape(tile, true);
+    raiseDepths(tile);
+    world_->onSiteOwnerChanged(tile);
 }
 
 void State::removeLandTile(Map::Site *tile) {
-    land_.erase(tile);
+    if (land_.erase(tile) == 0) {
+        return;
+    }
     tile->owning_state = nullptr;
+    updateBorder(tile);
+    splitComponents(tile);
+    updateShape(tile, false);
+    lowerDepths(tile);
+    world_->onSiteOwnerChanged(tile);
 }
 
 void State::draw(RenderContext& ctx, bool highlighted) {
+    PROFILE_SCOPE("State::draw");
     sf::Color colour = colour_;
     if (!highlighted) {
         colour.a = 40;
@@ -62,34 +111,49 @@ void State::draw(RenderContext& ctx, bool highlighted) {
 }
 
 void State::drawBorders(RenderContext& ctx) {
-	ctx.world->drawBorder(ctx, Map::unorderedBoundaries(land_), colour_);
+    for (auto& loop : border_loops_) {
+        ctx.world->drawBorder(ctx, loop.edges, colour_);
+    }
 }
 
 void State::drawOverlays(RenderContext& ctx) {
 	gui_name_.setFont(ctx.font);
+    if (!land_.empty()) {
+        gui_name_.setPosition(toSFML(labelAnchor()));
+    }
     ctx.window->draw(gui_name_);
 }
 
-Vector<Vector<Map::GraphEdge*>> State::unorderedBoundary() const {
-    // Build edge list containing state boundaries.
-    Vector<Vector<Map::GraphEdge*>> exclave_boundaries;
-    exclave_boundaries.emplace_back();
-    for (auto &state_tile : land_) {
-        for (int i = 0; i < state_tile->edges.size(); ++i) {
-            if (land_.count(state_tile->edges[i].neighbour) == 0) {
-                exclave_boundaries.back().push_back(&state_tile->edges[i]);
-            }
-        }
-    }
-    return exclave_boundaries;
+const Map::SiteSet& State::land() const {
+    return land_;
 }
 
-const HashSet<Map::Site*>& State::land() const {
-    return land_;
+u32 State::componentOf(const Map::Site* site) const {
+    return rootLabel(site_label_.at(site));
+}
+
+bool State::isConnectedToCapital(const Map::Site* site) const {
+    return site->owning_state == this && capital_ && componentOf(site) == componentOf(capital_);
 }
 
 const Vec2 State::midpoint() const {
-    return centre_;
+    return area_ > 0.0 ? Vec2{(float)(weighted_x_ / area_), (float)(weighted_y_ / area_)} : Vec2{0.0f, 0.0f};
+}
+
+Vec2 State::boundsMin() const {
+    return land_.empty() ? Vec2{0.0f, 0.0f} : Vec2{site_min_x_.begin()->first, site_min_y_.begin()->first};
+}
+
+Vec2 State::boundsMax() const {
+    return land_.empty() ? Vec2{0.0f, 0.0f} : Vec2{site_max_x_.rbegin()->first, site_max_y_.rbegin()->first};
+}
+
+Vec2 State::labelAnchor() const {
+    if (depth_order_.empty()) {
+        return {0.0f, 0.0f};
+    }
+    u32 deepest = depth_order_.lower_bound({depth_order_.rbegin()->first, 0})->second;
+    return world_->mapSites()[deepest].centre;
 }
 
 sf::Color State::colour() const
@@ -97,3 +161,428 @@ sf::Color State::colour() const
 	return colour_;
 }
 
+
+bool State::isBorderEdge(const Map::GraphEdge& edge) const {
+    return !edge.neighbour || edge.neighbour->owning_state != this;
+}
+
+Map::GraphEdge* State::nextBorderEdge(const Map::GraphEdge& edge) const {
+    // Turn about the end of the edge, crossing into the neighbouring sites of the state, until an
+    // edge leaves the state. Each site's edges run the same way around it, so the edge after
+    // 'edge' in its site starts where it ends, as does the edge after the opposite of any edge
+    // ending there.
+    Map::Site* site = Map::edgeSite(edge);
+    size_t index = &edge - site->edges.data();
+    for (u32 turn = 0; turn < MAX_CORNER_TURNS; ++turn) {
+        Map::GraphEdge& candidate = site->edges[(index + 1) % site->edges.size()];
+        Map::GraphEdge* opposite = Map::oppositeEdge(candidate);
+        if (isBorderEdge(candidate) || !opposite) {
+            return &candidate;
+        }
+        site = candidate.neighbour;
+        index = opposite - site->edges.data();
+    }
+    return nullptr;
+}
+
+void State::updateBorder(Map::Site* site) {
+    MEMORY_SCOPE(MemoryTag::States);
+    // Only the edges of the site and of its neighbours can have joined or left the border, and as
+    // sites meet three to a corner, only their border edges can end at a corner of the site and
+    // so be followed by a different edge.
+    Vector<Map::Site*> nearby{site};
+    for (auto& edge : site->edges) {
+        if (edge.neighbour && edge.neighbour->owning_state == this) {
+            nearby.push_back(edge.neighbour);
+        }
+    }
+    Vector<u32> stale_loops;
+    Vector<Map::GraphEdge*> untraced;
+    for (Map::Site* nearby_site : nearby) {
+        for (auto& edge : nearby_site->edges) {
+            bool border = nearby_site->owning_state == this && isBorderEdge(edge);
+            auto link = border_links_.find(&edge);
+            if (link != border_links_.end()) {
+                stale_loops.push_back(link->second.loop);
+                if (!border) {
+                    border_links_.erase(link);
+                }
+            }
+            if (border) {
+                border_links_[&edge] = {nextBorderEdge(edge), NO_LOOP};
+                untraced.push_back(&edge);
+            }
+        }
+    }
+
+    // Loops which lost or relinked an edge are traced again, from the edges they have left.
+    // Removing a loop moves the last loop into its place, so the highest are removed first.
+    std::sort(stale_loops.begin(), stale_loops.end(), std::greater<u32>());
+    stale_loops.erase(std::unique(stale_loops.begin(), stale_loops.end()), stale_loops.end());
+    for (u32 loop : stale_loops) {
+        if (loop == NO_LOOP) {
+            continue;
+        }
+        for (Map::GraphEdge* edge : border_loops_[loop].edges) {
+            auto link = border_links_.find(edge);
+            if (link != border_links_.end() && link->second.loop == loop) {
+                link->second.loop = NO_LOOP;
+                untraced.push_back(edge);
+            }
+        }
+        if (loop != border_loops_.size() - 1) {
+            border_loops_[loop] = std::move(border_loops_.back());
+            for (Map::GraphEdge* edge : border_loops_[loop].edges) {
+                border_links_.at(edge).loop = loop;
+            }
+        }
+        border_loops_.pop_back();
+    }
+
+    for (Map::GraphEdge* start : untraced) {
+        if (border_links_.at(start).loop != NO_LOOP) {
+            continue;
+        }
+        u32 loop = (u32)border_loops_.size();
+        border_loops_.emplace_back();
+        BorderLoop& border_loop = border_loops_.back();
+        float area = 0.0f;
+        auto link = border_links_.find(start);
+        while (link != border_links_.end() && link->second.loop == NO_LOOP) {
+            link->second.loop = loop;
+            border_loop.edges.push_back(link->first);
+            area += windingArea(*link->first);
+            link = border_links_.find(link->second.next);
+        }
+
+        // Compare the winding with that of a site on the loop.
+        float site_area = 0.0f;
+        for (auto& edge : Map::edgeSite(*start)->edges) {
+            site_area += windingArea(edge);
+        }
+        border_loop.hole = (area < 0.0f) != (site_area < 0.0f);
+    }
+}
+
+u32 State::rootLabel(u32 label) const {
+    u32 root = label;
+    while (label_parent_[root] != root) {
+        root = label_parent_[root];
+    }
+    while (label_parent_[label] != root) {
+        u32 parent = label_parent_[label];
+        label_parent_[label] = root;
+        label = parent;
+    }
+    return root;
+}
+
+u32 State::addComponent(u32 size) {
+    u32 label = (u32)label_parent_.size();
+    label_parent_.push_back(label);
+    label_size_.push_back(size);
+    label_slot_.push_back((u32)components_.size());
+    components_.push_back(label);
+    return label;
+}
+
+void State::removeComponent(u32 root) {
+    u32 slot = label_slot_[root];
+    components_[slot] = components_.back();
+    label_slot_[components_[slot]] = slot;
+    components_.pop_back();
+}
+
+void State::joinComponents(Map::Site* site) {
+    MEMORY_SCOPE(MemoryTag::States);
+    // Join the parts of the neighbours, and the site, into the largest of them.
+    u32 joined = ~0u;
+    for (auto& edge : site->edges) {
+        if (!edge.neighbour || edge.neighbour->owning_state != this) {
+            continue;
+        }
+        u32 root = componentOf(edge.neighbour);
+        if (joined == ~0u) {
+            joined = root;
+        } else if (root != joined) {
+            if (label_size_[root] > label_size_[joined]) {
+                std::swap(root, joined);
+            }
+            label_parent_[root] = joined;
+            label_size_[joined] += label_size_[root];
+            removeComponent(root);
+        }
+    }
+    if (joined == ~0u) {
+        joined = addComponent(0);
+    }
+    label_size_[joined]++;
+    site_label_[site] = joined;
+    if (!capital_) {
+        capital_ = site;
+    }
+    compactLabels();
+}
+
+void State::splitComponents(Map::Site* site) {
+    MEMORY_SCOPE(MemoryTag::States);
+    u32 root = componentOf(site);
+    site_label_.erase(site);
+    if (--label_size_[root] == 0) {
+        removeComponent(root);
+    }
+
+    // Search out from each neighbour of the site left in the state, a site at a time from each
+    // in turn. Searches which reach each other are merged, and a search which runs out of sites
+    // without meeting another has found a part which has split off. Once one search is left, it
+    // holds whatever remains of the old part, which keeps its label.
+    struct Search {
+        Vector<Map::Site*> sites;
+        Vector<Map::Site*> queue;
+        size_t next;
+        u32 merged_into;
+        bool finished;
+    };
+    Vector<Search> searches;
+    HashMap<const Map::Site*, u32> reached;
+    for (auto& edge : site->edges) {
+        if (edge.neighbour && edge.neighbour->owning_state == this && reached.count(edge.neighbour) == 0) {
+            reached[edge.neighbour] = (u32)searches.size();
+            searches.push_back({{edge.neighbour}, {edge.neighbour}, 0, (u32)searches.size(), false});
+        }
+    }
+    auto find_search = [&searches](u32 search) {
+        while (searches[search].merged_into != search) {
+            search = searches[search].merged_into;
+        }
+        return search;
+    };
+    u32 unfinished = (u32)searches.size();
+    while (unfinished > 1) {
+        for (u32 i = 0; i < searches.size() && unfinished > 1; ++i) {
+            Search& search = searches[i];
+            if (search.merged_into != i || search.finished) {
+                continue;
+            }
+            if (search.next == search.queue.size()) {
+                search.finished = true;
+                unfinished--;
+                continue;
+            }
+            Map::Site* current = search.queue[search.next++];
+            for (auto& edge : current->edges) {
+                if (!edge.neighbour || edge.neighbour->owning_state != this) {
+                    continue;
+                }
+                auto other = reached.find(edge.neighbour);
+                if (other == reached.end()) {
+                    reached[edge.neighbour] = i;
+                    search.sites.push_back(edge.neighbour);
+                    search.queue.push_back(edge.neighbour);
+                    continue;
+                }
+                u32 other_search = find_search(other->second);
+                if (other_search != i) {
+                    // Searches which have finished can't be reached, as they found every site
+                    // connected to them.
+                    Search& merged = searches[other_search];
+                    merged.merged_into = i;
+                    search.sites.insert(search.sites.end(), merged.sites.begin(), merged.sites.end());
+                    search.queue.insert(search.queue.end(), merged.queue.begin() + merged.next, merged.queue.end());
+                    unfinished--;
+                }
+            }
+        }
+    }
+
+    // Give each part which split off a label of its own.
+    for (u32 i = 0; i < searches.size(); ++i) {
+        Search& search = searches[i];
+        if (search.merged_into != i || !search.finished) {
+            continue;
+        }
+        u32 label = addComponent((u32)search.sites.size());
+        label_size_[root] -= (u32)search.sites.size();
+        for (Map::Site* part_site : search.sites) {
+            site_label_[part_site] = label;
+        }
+    }
+
+    if (site == capital_) {
+        capital_ = nullptr;
+        u32 largest = 0;
+        for (Map::Site* land_site : land_) {
+            u32 size = componentSize(componentOf(land_site));
+            if (size > largest) {
+                largest = size;
+                capital_ = land_site;
+            }
+        }
+    }
+    compactLabels();
+}
+
+void State::compactLabels() {
+    if (label_parent_.size() <= 2 * land_.size() + LABEL_SLACK) {
+        return;
+    }
+    Vector<u32> compact(label_parent_.size(), ~0u);
+    Vector<u32> sizes;
+    sizes.reserve(components_.size());
+    for (u32 root : components_) {
+        compact[root] = (u32)sizes.size();
+        sizes.push_back(label_size_[root]);
+    }
+    for (auto& site_label : site_label_) {
+        site_label.second = compact[rootLabel(site_label.second)];
+    }
+    label_size_ = std::move(sizes);
+    label_parent_.resize(label_size_.size());
+    label_slot_.resize(label_size_.size());
+    components_.resize(label_size_.size());
+    for (u32 label = 0; label < label_size_.size(); ++label) {
+        label_parent_[label] = label;
+        label_slot_[label] = label;
+        components_[label] = label;
+    }
+}
+
+void State::updateShape(const Map::Site* site, bool added) {
+    MEMORY_SCOPE(MemoryTag::States);
+    if (land_.empty()) {
+        // Start again from nothing, rather than from what's left of the rounding errors.
+        area_ = weighted_x_ = weighted_y_ = 0.0;
+    } else {
+        Vec2 centre;
+        double area = siteArea(*site, centre);
+        double sign = added ? 1.0 : -1.0;
+        area_ += sign * area;
+        weighted_x_ += sign * area * centre.x;
+        weighted_y_ += sign * area * centre.y;
+    }
+
+    Vec2 min = site->centre;
+    Vec2 max = site->centre;
+    for (auto& edge : site->edges) {
+        for (auto& point : edge.points) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+    }
+    if (added) {
+        site_min_x_.emplace(min.x, site->index);
+        site_min_y_.emplace(min.y, site->index);
+        site_max_x_.emplace(max.x, site->index);
+        site_max_y_.emplace(max.y, site->index);
+    } else {
+        site_min_x_.erase({min.x, site->index});
+        site_min_y_.erase({min.y, site->index});
+        site_max_x_.erase({max.x, site->index});
+        site_max_y_.erase({max.y, site->index});
+    }
+}
+
+u32 State::depthOf(const Map::Site* site) const {
+    if (!site || site->owning_state != this) {
+        return 0;
+    }
+    auto depth = site_depth_.find(site);
+    return depth != site_depth_.end() ? depth->second : NO_DEPTH;
+}
+
+void State::setDepth(const Map::Site* site, u32 depth) {
+    auto old_depth = site_depth_.find(site);
+    if (old_depth != site_depth_.end()) {
+        depth_order_.erase({old_depth->second, site->index});
+        old_depth->second = depth;
+    } else {
+        site_depth_.emplace(site, depth);
+    }
+    depth_order_.emplace(depth, site->index);
+}
+
+void State::raiseDepths(Map::Site* site) {
+    MEMORY_SCOPE(MemoryTag::States);
+    // The site's neighbours may have been as shallow as they were because the site was outside.
+    // Find every site whose depth came through the site: those left with no neighbour one
+    // shallower than them, once the sites found so far are discounted.
+    HashSet<const Map::Site*> affected{site};
+    Vector<Map::Site*> affected_sites{site};
+    Vector<Map::Site*> candidates;
+    for (auto& edge : site->edges) {
+        if (edge.neighbour && edge.neighbour->owning_state == this) {
+            candidates.push_back(edge.neighbour);
+        }
+    }
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        Map::Site* candidate = candidates[i];
+        if (affected.count(candidate) != 0) {
+            continue;
+        }
+        u32 depth = site_depth_.at(candidate);
+        bool supported = std::any_of(candidate->edges.begin(), candidate->edges.end(), [&](const Map::GraphEdge& edge) {
+            return affected.count(edge.neighbour) == 0 && depthOf(edge.neighbour) == depth - 1;
+        });
+        if (supported) {
+            continue;
+        }
+        affected.insert(candidate);
+        affected_sites.push_back(candidate);
+        for (auto& edge : candidate->edges) {
+            if (depthOf(edge.neighbour) == depth + 1 && affected.count(edge.neighbour) == 0) {
+                candidates.push_back(edge.neighbour);
+            }
+        }
+    }
+
+    // Work out their depths again, shallowest first, starting from the neighbours whose depths
+    // stand.
+    HashMap<const Map::Site*, u32> tentative;
+    std::priority_queue<Pair<u32, u32>, Vector<Pair<u32, u32>>, std::greater<Pair<u32, u32>>> open;
+    for (Map::Site* affected_site : affected_sites) {
+        u32 depth = NO_DEPTH;
+        for (auto& edge : affected_site->edges) {
+            if (affected.count(edge.neighbour) == 0) {
+                depth = std::min(depth, depthOf(edge.neighbour) + 1);
+            }
+        }
+        tentative[affected_site] = depth;
+        if (depth != NO_DEPTH) {
+            open.emplace(depth, affected_site->index);
+        }
+    }
+    auto& sites = world_->mapSites();
+    while (!open.empty()) {
+        u32 depth = open.top().first;
+        Map::Site& current = sites[open.top().second];
+        open.pop();
+        if (depth != tentative.at(&current)) {
+            continue;
+        }
+        setDepth(&current, depth);
+        for (auto& edge : current.edges) {
+            auto neighbour = tentative.find(edge.neighbour);
+            if (neighbour != tentative.end() && depth + 1 < neighbour->second) {
+                neighbour->second = depth + 1;
+                open.emplace(depth + 1, edge.neighbour->index);
+            }
+        }
+    }
+}
+
+void State::lowerDepths(Map::Site* site) {
+    MEMORY_SCOPE(MemoryTag::States);
+    // The site is now outside, so sites around it may be shallower than they were.
+    depth_order_.erase({site_depth_.at(site), site->index});
+    site_depth_.erase(site);
+    Vector<Map::Site*> frontier{site};
+    for (size_t i = 0; i < frontier.size(); ++i) {
+        u32 depth = depthOf(frontier[i]) + 1;
+        for (auto& edge : frontier[i]->edges) {
+            if (edge.neighbour && edge.neighbour->owning_state == this && depth < site_depth_.at(edge.neighbour)) {
+                setDepth(edge.neighbour, depth);
+                frontier.push_back(edge.neighbour);
+            }
+        }
+    }
+}
@@ -5,56 +5,6 @@
 class World;
 struct RenderContext;
 
-inline Vector<HashSet<Vec2i>> getExclaves(HashSet<Vec2i> points) {
-    /*
-        Example point set:
-        ### ##
-        ### ###
-        ##   #
-
-        Exclaves are found with the following algorithm:
-
-        1) Remove point A from the input.
-        2) Create a new exclave E.
-        3) Add A to exclave E.
-        4) Do a breadth first search from A, treating immediate neighbours as edges, removing
-           from input set when visited.
-        5) If more points exist, goto 1.
-    */
-
-    // Find exclaves.
-    Vector<HashSet<Vec2i>> exclaves;
-    while (!points.empty()) {
-        // Create exclave.
-        exclaves.emplace_back(HashSet<Vec2i>{});
-        auto& exclave = exclaves.back();
-
-        // Search for neighbours.
-        Queue<Vec2i> bfs_queue;
-        bfs_queue.push(*points.begin());
-        points.erase(points.begin());
-        while (!bfs_queue.empty()) {
-            // Dequeue and add to exclave.
-            Vec2i p = bfs_queue.front();
-            exclave.insert(p);
-            bfs_queue.pop();
-
-            // Traverse neighbours.
-            /*
-            for (int d = 0; d < D_COUNT; ++d) {
-                Vec2i neighbour = p + getDirectionOffset((Direction)d);
-                auto neighbour_it = points.find(neighbour);
-                if (neighbour_it != points.end()) {
-                    bfs_queue.push(neighbour);
-                    points.erase(neighbour_it);
-                }
-            }
-             */
-        }
-    }
-    return exclaves;
-}
-
 class City
 {
 public:
@@ -70,7 +20,20 @@ private:
 
 class State {
 public:
-    State(sf::Color colour, const String& name, const HashSet<Map::Site*>& land);
+    // A closed loop of border edges, each starting where the one before ends, so the points of
+    // the edges in order trace part of the border. Loops around the outside of the mainland or an
+    // exclave wind the same way as the outlines of sites, and loops around holes wind the other
+    // way.
+    struct BorderLoop {
+        Vector<Map::GraphEdge*> edges;
+        bool hole;
+    };
+
+    State(World* world, int id, sf::Color colour, const String& name, const Map::SiteSet& land);
+
+    int id() const {
+        return id_;
+    }
 
     void setName(const String& name);
 
@@ -81,21 +44,125 @@ public:
     void drawBorders(RenderContext& ctx);
     void drawOverlays(RenderContext& ctx);
 
-    Vector<Vector<Map::GraphEdge*>> unorderedBoundary() const;
-    const HashSet<Map::Site*>& land() const;
+    // The border of the state, as one loop around each connected part of it and one around each
+    // hole. Border edges are linked to the next edge along the border as sites change hands, by
+    // looking only at the sites around the one which changed, so updates cost the length of the
+    // loops touched rather than the size of the state.
+    const Vector<BorderLoop>& borderLoops() const {
+        return border_loops_;
+    }
+
+    const Map::SiteSet& land() const;
+
+    // The connected parts of the state: the mainland and any exclaves. Sites are labelled by
+    // part, and parts are joined with union-find as sites join them together. When a site
+    // leaves, searches go out from each of its neighbours in the state at once, until all but
+    // one have either met or run out of sites, so only the parts which split off are explored.
+    //
+    // Ids identify parts between changes of ownership, and are invalidated by them.
+    const Vector<u32>& components() const {
+        return components_;
+    }
+
+    // 'site' must belong to the state.
+    u32 componentOf(const Map::Site* site) const;
+
+    u32 componentSize(u32 component) const {
+        return label_size_[component];
+    }
+
+    // The capital starts as the first site of the state. If it is lost, the capital moves to the
+    // lowest indexed site of the largest part left, and a state left with no land takes the next
+    // site it gains.
+    Map::Site* capital() const {
+        return capital_;
+    }
 
+    // True if 'site' belongs to the state, and is connected to the capital through its land.
+    bool isConnectedToCapital(const Map::Site* site) const;
+
+    // Shape of the land, kept up to date as sites change hands. None of these mean anything for a
+    // state with no land.
+    //
+    // The area weighted centre of the land, from running sums of the area and centre of each
+    // site.
     const Vec2 midpoint() const;
 
+    float area() const {
+        return (float)area_;
+    }
+
+    // Bounds of the land, from the bounds of each site kept in order.
+    Vec2 boundsMin() const;
+    Vec2 boundsMax() const;
+
+    // Where the name of the state goes, standing in for its pole of inaccessibility: the centre
+    // of the site furthest from the border, counted in sites, taking the lowest indexed of those
+    // furthest. Unlike the midpoint, this is always in the state. Distances are repaired outwards
+    // from each site which changes hands, only as far as they change.
+    Vec2 labelAnchor() const;
+
 	sf::Color colour() const;
 
 private:
+    World* world_;
+    int id_;
     sf::Color colour_;
     String name_;
-    HashSet<Map::Site*> land_;
-    Vec2 centre_;
+    Map::SiteSet land_;
+
+    // Sums of the area of each site, and of its centre weighted by area.
+    double area_;
+    double weighted_x_;
+    double weighted_y_;
+
+    // Bounds of each site, as (bound, site index), so the bounds of the land are at the ends.
+    OrderedSet<Pair<float, u32>> site_min_x_;
+    OrderedSet<Pair<float, u32>> site_min_y_;
+    OrderedSet<Pair<float, u32>> site_max_x_;
+    OrderedSet<Pair<float, u32>> site_max_y_;
+
+    // Distance of each site from the border in sites, where sites on the border are at 1, and
+    // the sites in order of (depth, site index).
+    HashMap<const Map::Site*, u32> site_depth_;
+    OrderedSet<Pair<u32, u32>> depth_order_;
+
+    // Each border edge, the edge which follows it along the border, and the loop it is part of.
+    struct BorderLink {
+        Map::GraphEdge* next;
+        u32 loop;
+    };
+    HashMap<Map::GraphEdge*, BorderLink> border_links_;
+    Vector<BorderLoop> border_loops_;
+
+    // Connectivity. Each site has a label, and the root of its label identifies its part. Sizes
+    // are kept for roots, and the slot of each root in 'components_'.
+    HashMap<const Map::Site*, u32> site_label_;
+    mutable Vector<u32> label_parent_;
+    Vector<u32> label_size_;
+    Vector<u32> label_slot_;
+    Vector<u32> components_;
+    Map::Site* capital_;
 
     // Rendering data.
     sf::Text gui_name_;
 	sf::RectangleShape capital_shape_;
 	sf::CircleShape city_shape_;
+
+    bool isBorderEdge(const Map::GraphEdge& edge) const;
+    Map::GraphEdge* nextBorderEdge(const Map::GraphEdge& edge) const;
+    void updateBorder(Map::Site* site);
+
+    u32 rootLabel(u32 label) const;
+    u32 addComponent(u32 size);
+    void removeComponent(u32 root);
+    void joinComponents(Map::Site* site);
+    void splitComponents(Map::Site* site);
+    void compactLabels();
+
+    void updateShape(const Map::Site* site, bool added);
+    u32 depthOf(const Map::Site* site) const;
+    void setDepth(const Map::Site* site, u32 depth);
+    void raiseDepths(Map::Site* site);
+    void lowerDepths(Map::Site* site);
 };
@@ -0,0 +1,220 @@
+#include "Common.h"
+#include "world/Terrain.h"
+#include "world/Map.h"
+#include "math/Noise.h"
+#include "core/Binary.h"
+#include "core/JobSystem.h"
+
+#include <fstream>
+
+const u32 Terrain::VERSION;
+
+namespace {
+const char MAGIC[4] = {'D', 'P', 'T', 'R'};
+
+// Sites sampled per job, and per batch of noise.
+const u32 SITES_PER_JOB = 4096;
+const u32 SITES_PER_BATCH = 256;
+
+// Noise fields, with frequencies in cycles per world unit.
+const uint FIELD_OCTAVES = 5;
+const float ELEVATION_FREQUENCY = 1.0f / 800.0f;
+const float MOISTURE_FREQUENCY = 1.0f / 500.0f;
+
+// fBm sums cluster around the middle of their range, so they're stretched by this much about 0.5
+// before clamping to [0, 1].
+const float FIELD_CONTRAST = 2.0f;
+
+// Extra movement cost at the top of the elevation and moisture ranges, rising linearly from the
+// thresholds.
+const float HIGH_GROUND_THRESHOLD = 0.6f;
+const float HIGH_GROUND_COST = 2.0f;
+const float WETLAND_THRESHOLD = 0.7f;
+const float WETLAND_COST = 1.0f;
+
+// Total amplitude of the octaves of a field, to bring its sums back into [0, 1].
+float amplitudeSum(const NoiseField& field) {
+    float amplitude_sum = 0.0f;
+    float amplitude = field.amplitude;
+    for (uint octave = 0; octave < field.octaves; ++octave) {
+        amplitude_sum += amplitude;
+        amplitude *= field.persistence;
+    }
+    return amplitude_sum;
+}
+
+float normaliseField(float value, float amplitude_sum) {
+    return glm::clamp((value / amplitude_sum - 0.5f) * FIELD_CONTRAST + 0.5f, 0.0f, 1.0f);
+}
+
+fBmSimplexNoise makeNoise(const NoiseField& field) {
+    return {field.seed, field.octaves, field.frequency, field.amplitude, field.lacunarity, field.persistence};
+}
+
+float excess(float value, float threshold) {
+    return std::max(value - threshold, 0.0f) / (1.0f - threshold);
+}
+}
+
+void Terrain::generate(const Map& map, u32 seed, JobSystem& jobs) {
+    PROFILE_SCOPE("Terrain::generate");
+    MEMORY_SCOPE(MemoryTag::Map);
+    const Vector<Map::Site>& sites = map.sites();
+    u32 site_count = (u32)sites.size();
+    elevation_.resize(site_count);
+    moisture_.resize(site_count);
+    movement_cost_.resize(site_count);
+
+    seed_ = seed;
+    fBmSimplexNoise elevation_field = makeNoise(elevationField());
+    fBmSimplexNoise moisture_field = makeNoise(moistureField());
+    float elevation_scale = amplitudeSum(elevationField());
+    float moisture_scale = amplitudeSum(moistureField());
+
+    jobs.parallelFor(0, site_count, SITES_PER_JOB, [&](u32 begin, u32 end) {
+        PROFILE_SCOPE("Terrain::generateRange");
+        float xs[SITES_PER_BATCH], ys[SITES_PER_BATCH];
+        for (u32 batch = begin; batch < end; batch += SITES_PER_BATCH) {
+            u32 count = std::min(SITES_PER_BATCH, end - batch);
+            for (u32 i = 0; i < count; ++i) {
+                xs[i] = sites[batch + i].centre.x;
+                ys[i] = sites[batch + i].centre.y;
+            }
+            elevation_field.noise(xs, ys, &elevation_[batch], count);
+            moisture_field.noise(xs, ys, &moisture_[batch], count);
+            for (u32 site = batch; site < batch + count; ++site) {
+                elevation_[site] = normaliseField(elevation_[site], elevation_scale);
+                moisture_[site] = normaliseField(moisture_[site], moisture_scale);
+                movement_cost_[site] = 1.0f + HIGH_GROUND_COST * excess(elevation_[site], HIGH_GROUND_THRESHOLD) +
+                                       WETLAND_COST * excess(moisture_[site], WETLAND_THRESHOLD);
+            }
+        }
+    });
+}
+
+NoiseField Terrain::elevationField() const {
+    return {seed_, FIELD_OCTAVES, ELEVATION_FREQUENCY, 1.0f, 2.0f, 0.5f};
+}
+
+NoiseField Terrain::moistureField() const {
+    return {seed_ + 1, FIELD_OCTAVES, MOISTURE_FREQUENCY, 1.0f, 2.0f, 0.5f};
+}
+
+float Terrain::elevationAt(NoiseTileCache& cache, const Vec2& position) const {
+    NoiseField field = elevationField();
+    return normaliseField(cache.sample(field, position), amplitudeSum(field));
+}
+
+float Terrain::moistureAt(NoiseTileCache& cache, const Vec2& position) const {
+    NoiseField field = moistureField();
+    return normaliseField(cache.sample(field, position), amplitudeSum(field));
+}
+
+void Terrain::elevationAt(NoiseTileCache& cache, const Vec2* positions, float* out, size_t count) const {
+    NoiseField field = elevationField();
+    float amplitude_sum = amplitudeSum(field);
+    cache.sample(field, positions, out, count);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = normaliseField(out[i], amplitude_sum);
+    }
+}
+
+void Terrain::moistureAt(NoiseTileCache& cache, const Vec2* positions, float* out, size_t count) const {
+    NoiseField field = moistureField();
+    float amplitude_sum = amplitudeSum(field);
+    cache.sample(field, positions, out, count);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = normaliseField(out[i], amplitude_sum);
+    }
+}
+
+u64 Terrain::cacheKey(const Map& map, u32 seed) {
+    // Everything which shapes the terrain goes into the key, so tuning any of it replaces caches
+    // without needing the version to be bumped.
+    Terrain terrain;
+    terrain.seed_ = seed;
+    u64 key = hashCombine(VERSION, seed);
+    key = hashCombine(key, terrain.elevationField().hash());
+    key = hashCombine(key, terrain.moistureField().hash());
+    for (float constant : {FIELD_CONTRAST, HIGH_GROUND_THRESHOLD, HIGH_GROUND_COST, WETLAND_THRESHOLD, WETLAND_COST}) {
+        key = hashCombine(key, hashFloat(constant));
+    }
+    for (const Map::Site& site : map.sites()) {
+        key = hashCombine(key, (hashFloat(site.centre.x) << 32) | hashFloat(site.centre.y));
+    }
+    return key;
+}
+
+bool Terrain::save(const String& path, u64 key) const {
+    PROFILE_SCOPE("Terrain::save");
+    Vector<u8> data;
+    BinaryWriter writer{data};
+    writer.writeBytes(MAGIC, sizeof(MAGIC));
+    writer.writeU32(VERSION);
+    writer.writeU64(key);
+    writer.writeU32(seed_);
+    writer.writeU64(siteCount());
+    writer.writeArray(elevation_);
+    writer.writeArray(moisture_);
+    writer.writeArray(movement_cost_);
+
+    // Write to a temporary file and rename it, so a half written cache is never read.
+    String temporary_path = path + ".tmp";
+    {
+        std::ofstream out{temporary_path, std::ios::binary};
+        if (!out) {
+            std::cerr << "Terrain: Unable to open " << temporary_path << " for writing." << std::endl;
+            return false;
+        }
+        out.write((const char*)data.data(), data.size());
+        if (!out) {
+            std::cerr << "Terrain: Unable to write " << temporary_path << "." << std::endl;
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Terrain: Unable to replace " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Terrain::load(const String& path, u64 key, size_t site_count) {
+    PROFILE_SCOPE("Terrain::load");
+    MEMORY_SCOPE(MemoryTag::Map);
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        return false;
+    }
+    Vector<u8> data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    BinaryReader reader{data};
+    char magic[sizeof(MAGIC)];
+    u32 version;
+    u64 stored_key, stored_count;
+    Terrain terrain;
+    if (!reader.readBytes(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !reader.readU32(version)) {
+        std::cerr << "Terrain: " << path << " is not a terrain cache." << std::endl;
+        return false;
+    }
+
+    // A cache for another map or version is expected, and silently replaced.
+    if (version != VERSION) {
+        return false;
+    }
+    if (!reader.readU64(stored_key) || !reader.readU32(terrain.seed_) || !reader.readU64(stored_count)) {
+        std::cerr << "Terrain: " << path << " is corrupt." << std::endl;
+        return false;
+    }
+    if (stored_key != key || stored_count != site_count) {
+        return false;
+    }
+    if (!reader.readArray(terrain.elevation_, site_count) || !reader.readArray(terrain.moisture_, site_count) ||
+        !reader.readArray(terrain.movement_cost_, site_count) || !reader.atEnd()) {
+        std::cerr << "Terrain: " << path << " is corrupt." << std::endl;
+        return false;
+    }
+    *this = std::move(terrain);
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "math/NoiseCache.h"
+
+class Map;
+class JobSystem;
+
+// Terrain of the map sites, as one array per attribute indexed by site.
+//
+// Elevation and moisture are sampled at each site centre from two fBm simplex noise fields, and
+// lie in [0, 1]. Movement cost multiplies the distance travelled through a site, and is derived
+// from the other two: 1 on low, dry land, rising on high ground and in wetland. It is never less
+// than 1, so straight line distance still never overestimates the cost of a path.
+class Terrain {
+public:
+    static const u32 VERSION = 2;
+
+    // Sample every site, in parallel.
+    void generate(const Map& map, u32 seed, JobSystem& jobs);
+
+    // Terrain is a function of the site centres, the seed, and the parameters of the fields and
+    // movement costs, hashed into a key which a cached copy must match. Loading returns false,
+    // leaving the terrain unchanged, if the file is missing, stale or corrupt.
+    static u64 cacheKey(const Map& map, u32 seed);
+    bool save(const String& path, u64 key) const;
+    bool load(const String& path, u64 key, size_t site_count);
+
+    // The noise fields elevation and moisture are sampled from, before they're normalised.
+    NoiseField elevationField() const;
+    NoiseField moistureField() const;
+
+    // Elevation and moisture anywhere on the map, rather than at site centres, read from the
+    // fields through a cache of noise tiles.
+    float elevationAt(NoiseTileCache& cache, const Vec2& position) const;
+    float moistureAt(NoiseTileCache& cache, const Vec2& position) const;
+
+    // As elevationAt and moistureAt, for 'count' positions at once. Positions close together
+    // should be next to each other, as for NoiseTileCache::sample.
+    void elevationAt(NoiseTileCache& cache, const Vec2* positions, float* out, size_t count) const;
+    void moistureAt(NoiseTileCache& cache, const Vec2* positions, float* out, size_t count) const;
+
+    size_t siteCount() const {
+        return elevation_.size();
+    }
+
+    float elevation(u32 site) const {
+        return elevation_[site];
+    }
+
+    float moisture(u32 site) const {
+        return moisture_[site];
+    }
+
+    float movementCost(u32 site) const {
+        return movement_cost_[site];
+    }
+
+private:
+    u32 seed_ = 0;
+    Vector<float> elevation_;
+    Vector<float> moisture_;
+    Vector<float> movement_cost_;
+};
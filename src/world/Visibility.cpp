@@ -0,0 +1,89 @@
+#include "Common.h"
+#include "world/Visibility.h"
+
+const u32 Visibility::VISION_RANGE;
+
+Visibility::Visibility(const Map& map, u32 player_count)
+    : map_(map), player_count_{player_count}, site_count_{(u32)map.sites().size()} {
+    MEMORY_SCOPE(MemoryTag::World);
+    word_count_ = (site_count_ + 63) / 64;
+    seen_by_.assign(player_count_ * site_count_, 0);
+    visible_.assign(player_count_ * word_count_, 0);
+    changed_sites_.resize(player_count_);
+    buildVision();
+}
+
+void Visibility::buildVision() {
+    PROFILE_SCOPE("Visibility::buildVision");
+    // Breadth first search out to VISION_RANGE from each site. Sites are stamped with the search
+    // they were last reached by, so nothing needs clearing between searches.
+    auto& sites = map_.sites();
+    Vector<u32> reached(site_count_, ~0u);
+    Vector<u32> frontier, next;
+    vision_start_.reserve(site_count_ + 1);
+    vision_start_.push_back(0);
+    for (u32 origin = 0; origin < site_count_; ++origin) {
+        reached[origin] = origin;
+        vision_sites_.push_back(origin);
+        frontier.assign(1, origin);
+        for (u32 step = 0; step < VISION_RANGE && !frontier.empty(); ++step) {
+            next.clear();
+            for (u32 site : frontier) {
+                for (auto& edge : sites[site].edges) {
+                    if (edge.neighbour && reached[edge.neighbour->index] != origin) {
+                        reached[edge.neighbour->index] = origin;
+                        vision_sites_.push_back(edge.neighbour->index);
+                        next.push_back(edge.neighbour->index);
+                    }
+                }
+            }
+            frontier.swap(next);
+        }
+        vision_start_.push_back((u32)vision_sites_.size());
+    }
+}
+
+void Visibility::addViewer(u32 player, u32 site) {
+    if (player >= player_count_) {
+        return;
+    }
+    u32* seen_by = &seen_by_[player * site_count_];
+    u64* visible = &visible_[player * word_count_];
+    for (u32 i = vision_start_[site]; i < vision_start_[site + 1]; ++i) {
+        u32 seen = vision_sites_[i];
+        if (seen_by[seen]++ == 0) {
+            visible[seen / 64] |= u64(1) << (seen % 64);
+            changed_sites_[player].push_back(seen);
+        }
+    }
+}
+
+void Visibility::removeViewer(u32 player, u32 site) {
+    if (player >= player_count_) {
+        return;
+    }
+    u32* seen_by = &seen_by_[player * site_count_];
+    u64* visible = &visible_[player * word_count_];
+    for (u32 i = vision_start_[site]; i < vision_start_[site + 1]; ++i) {
+        u32 seen = vision_sites_[i];
+        if (--seen_by[seen] == 0) {
+            visible[seen / 64] &= ~(u64(1) << (seen % 64));
+            changed_sites_[player].push_back(seen);
+        }
+    }
+}
+
+bool Visibility::isAnyVisible(u32 player, const Map::SiteSet& sites) const {
+    for (const Map::Site* site : sites) {
+        if (isVisible(player, site->index)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Visibility::clearChanges() {
+    for (auto& changed : changed_sites_) {
+        changed.clear();
+    }
+}
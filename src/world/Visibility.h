@@ -0,0 +1,81 @@
+#pragma once
+
+#include "world/Map.h"
+
+// Per-player fog of war over the map sites.
+//
+// Each player's units see the site they are in, and every site within VISION_RANGE neighbour
+// links of it. Every site keeps a count per player of the units which can see it, and a site is
+// visible to a player while that count is non-zero. Visibility is only touched when a unit
+// appears, disappears or crosses into another site, and then only for the sites around it, so
+// the cost per tick depends on how many units changed site rather than on the size of the map.
+//
+// Visible sites are also stored as a bitset per player, one bit per site, for cheap lookups
+// during rendering and to hand to replication.
+class Visibility {
+public:
+    // How far units can see, in neighbour links between sites.
+    static const u32 VISION_RANGE = 1;
+
+    Visibility(const Map& map, u32 player_count);
+
+    Visibility(const Visibility&) = delete;
+    Visibility& operator=(const Visibility&) = delete;
+
+    // A unit of 'player' has appeared in, or left, 'site'. Players outside of the player count
+    // have no visibility, and are ignored.
+    void addViewer(u32 player, u32 site);
+    void removeViewer(u32 player, u32 site);
+
+    void moveViewer(u32 player, u32 from_site, u32 to_site) {
+        if (from_site != to_site) {
+            removeViewer(player, from_site);
+            addViewer(player, to_site);
+        }
+    }
+
+    bool isVisible(u32 player, u32 site) const {
+        return (visible_[player * word_count_ + site / 64] >> (site % 64)) & 1;
+    }
+
+    // True if any of 'sites' is visible to 'player'.
+    bool isAnyVisible(u32 player, const Map::SiteSet& sites) const;
+
+    // Bitset of the sites visible to 'player', one bit per site index.
+    const u64* visibleSites(u32 player) const {
+        return &visible_[player * word_count_];
+    }
+
+    // Sites which have been revealed or hidden for 'player' since the last clearChanges, in the
+    // order they changed. A site which changed more than once is listed more than once.
+    const Vector<u32>& changedSites(u32 player) const {
+        return changed_sites_[player];
+    }
+
+    void clearChanges();
+
+    const Map& map() const {
+        return map_;
+    }
+
+    u32 playerCount() const {
+        return player_count_;
+    }
+
+private:
+    const Map& map_;
+    u32 player_count_;
+    u32 site_count_;
+    u32 word_count_;
+
+    // The sites seen from each site, as ranges of 'vision_sites_'.
+    Vector<u32> vision_start_;
+    Vector<u32> vision_sites_;
+
+    // Units which can see each site, indexed by player * site_count_ + site.
+    Vector<u32> seen_by_;
+    Vector<u64> visible_;
+    Vector<Vector<u32>> changed_sites_;
+
+    void buildVision();
+};
@@ -2,11 +2,130 @@
 #include "world/World.h"
 #include "world/Map.h"
 #include "world/State.h"
+#include "world/Visibility.h"
+#include "core/Binary.h"
+#include "core/JobSystem.h"
+
+namespace {
+const sf::Color TILE_COLOUR{40, 40, 40};
+const sf::Color HIDDEN_TILE_COLOUR{20, 20, 20};
+// Tiles are shaded between these fractions of their base colour by elevation, and tinted green by
+// moisture.
+const float LOWLAND_SHADE = 0.6f;
+const float HIGHLAND_SHADE = 1.6f;
+const float MOISTURE_TINT = 0.4f;
+const sf::Color TILE_EDGE_COLOUR{80, 80, 80, 80};
+const float TILE_EDGE_THICKNESS = 1.5f;
+const u8 STATE_TILE_ALPHA = 40;
+
+// Tiles are drawn with noisy edges from this scale up, choosing a level of detail for each edge
+// which gives segments of about NOISY_EDGE_SEGMENT_PIXELS on screen.
+const float NOISY_EDGE_MIN_SCALE = 1.5f;
+const float NOISY_EDGE_SEGMENT_PIXELS = 8.0f;
+
+// Sites with centres this far outside the view are still drawn, as they may overlap it.
+const float DETAIL_VIEW_MARGIN = 200.0f;
+
+// Distance between the samples of cached noise tiles.
+const float NOISE_CACHE_SPACING = 4.0f;
+
+// Saved in place of a state id for unowned sites.
+const u32 NO_OWNER = ~0u;
+
+sf::Color terrainColour(float elevation, float moisture, sf::Color base) {
+    float shade = LOWLAND_SHADE + (HIGHLAND_SHADE - LOWLAND_SHADE) * elevation;
+    float green = shade * (1.0f + MOISTURE_TINT * moisture);
+    return {(u8)std::min(base.r * shade, 255.0f), (u8)std::min(base.g * green, 255.0f),
+            (u8)std::min(base.b * shade, 255.0f)};
+}
+
+u32 tileVertexCount(const Map::Site& tile) {
+    u32 count = 0;
+    for (auto& edge : tile.edges) {
+        count += ((u32)edge.points.size() - 1) * 3;
+    }
+    return count;
+}
+
+void writeTile(const Map::Site& tile, sf::Color colour, sf::Vertex* out) {
+    for (int i = 0; i < tile.edges.size(); ++i) {
+        for (int p = 0; p < tile.edges[i].points.size() - 1; p++) {
+            *out++ = sf::Vertex(toSFML(tile.centre), colour);
+            *out++ = sf::Vertex(toSFML(tile.edges[i].points[p]), colour);
+            *out++ = sf::Vertex(toSFML(tile.edges[i].points[p + 1]), colour);
+        }
+    }
+}
+
+void tileRibbonPoints(const Map::Site& tile, Vector<Vec2>& ribbon_points) {
+    ribbon_points.clear();
+    for (auto& edge : tile.edges) {
+        for (int i = 0; i < edge.points.size() - 1; i++) {
+            ribbon_points.push_back(edge.points[i]);
+        }
+    }
+}
+
+u32 noisyEdgeLevel(const Map::Edge& edge, float pixels_per_unit) {
+    float segments = vecDistance(edge.v0(), edge.v1()) * pixels_per_unit / NOISY_EDGE_SEGMENT_PIXELS;
+    if (segments <= 1.0f) {
+        return 0;
+    }
+    return std::min((u32)std::ceil(std::log2(segments)), Map::NOISY_EDGE_LEVELS - 1);
+}
+
+u32 ribbonVertexCount(size_t num_points) {
+    return num_points > 2 ? (u32)num_points * 4 : 0;
+}
+
+// Writes ribbonVertexCount(points.size()) vertices, forming quads.
+void writeJoinedRibbon(const Vector<Vec2>& points, float inner_thickness, float outer_thickness,
+                       const sf::Color& colour, sf::Vertex* out) {
+    int num_points = (int)points.size();
+    if (num_points <= 2) {
+        return;
+    }
+
+    // Generate ribbon edges from the cycle of points.
+    auto ribbon_edge = [&](int i) -> Pair<Vec2, Vec2> {
+        // To generate pair of ribbon points about point i, we need to consider points: i-1 -> i -> i+1.
+        const Vec2& a = points[(i - 1 + num_points) % num_points];
+        const Vec2& b = points[i];
+        const Vec2& c = points[(i + 1) % num_points];
+        Vec2 t_ab = glm::normalize(Vec2{a.y - b.y, b.x - a.x});
+        Vec2 t_bc = glm::normalize(Vec2{b.y - c.y, c.x - b.x});
+        const Vec2 ribbon_first = intersection(
+                a + t_ab * outer_thickness, b + t_ab * outer_thickness,
+                b + t_bc * outer_thickness, c + t_bc * outer_thickness);
+        const Vec2 ribbon_second = intersection(
+                a - t_ab * inner_thickness, b - t_ab * inner_thickness,
+                b - t_bc * inner_thickness, c - t_bc * inner_thickness);
+        return {ribbon_first, ribbon_second};
+    };
+
+    // Join ribbon edges with quads.
+    Pair<Vec2, Vec2> first_edge = ribbon_edge(0);
+    Pair<Vec2, Vec2> current_edge = first_edge;
+    for (int i = 0; i < num_points; ++i) {
+        Pair<Vec2, Vec2> next_edge = i + 1 < num_points ? ribbon_edge(i + 1) : first_edge;
+        *out++ = sf::Vertex(toSFML(current_edge.first), colour);
+        *out++ = sf::Vertex(toSFML(next_edge.first), colour);
+        *out++ = sf::Vertex(toSFML(next_edge.second), colour);
+        *out++ = sf::Vertex(toSFML(current_edge.second), colour);
+        current_edge = next_edge;
+    }
+}
+}
+
+World::World(int num_points, const Vec2& min, const Vec2& max, JobSystem& jobs, const String& terrain_cache_path)
+    : jobs_(jobs), noise_cache_{NOISE_CACHE_SPACING}, ownership_checksum_{0} {
+    MEMORY_SCOPE(MemoryTag::World);
 
-World::World(int num_points, const Vec2& min, const Vec2& max) {
     // Create map.
-    map_ = make_unique<Map>(num_points, min, max, rng_);
-    unclaimed_tiles_.reserve(map_->sites().size());
+    map_ = make_unique<Map>(num_points, min, max, rng_, jobs_, terrain_cache_path);
+    pathfinder_ = make_unique<Pathfinder>(*map_, jobs_);
+    site_ownership_hash_.assign(map_->sites().size(), 0);
+    site_owners_.assign(map_->sites().size(), nullptr);
     for (auto& tile : map_->sites()) {
         if (tile.usable) {
             unclaimed_tiles_.insert(&tile);
@@ -16,17 +135,18 @@ World::World(int num_points, const Vec2& min, const Vec2& max) {
 
 
 void World::generateStates(int count, int max_size) {
+    MEMORY_SCOPE(MemoryTag::States);
     for (int i = 0; i < count; ++i) {
         std::uniform_int_distribution<> tile_id_dist(0, (int) map_->sites().size() - 1);
 
         // Take a tile as the starting land.
-        HashSet<Map::Site*> starting_land = {&map_->sites()[tile_id_dist(rng_)]};
+        Map::SiteSet starting_land = {&map_->sites()[tile_id_dist(rng_)]};
         unclaimed_tiles_.erase(*starting_land.begin());
 
         // Form a state here.
         std::uniform_real_distribution<float> hue_dist(0.0f, 360.0f);
         HSVColour country_colour{hue_dist(rng_), 0.8f, 0.7f, 0.8f};
-        states_[i] = make_unique<State>(country_colour, "Generated State " + std::to_string(i), starting_land);
+        states_[i] = make_unique<State>(this, i, country_colour, "Generated State " + std::to_string(i), starting_land);
 
         // Try and take up to 'start_size' sites.
         for (int j = 0; j < max_size; ++j) {
@@ -35,22 +155,25 @@ void World::generateStates(int count, int max_size) {
             }
         }
     }
+    pathfinder_->refresh();
 }
 
 void World::fillStates(int count) {
+    PROFILE_SCOPE("World::fillStates");
+    MEMORY_SCOPE(MemoryTag::States);
     const int start_size = 40;
     for (int i = 0; i < count; ++i) {
         std::uniform_int_distribution<> tile_id_dist(0, (int)unclaimed_tiles_.size() - 1);
 
         // Take a tile as the starting land.
         int starting_tile_index = tile_id_dist(rng_);
-        HashSet<Map::Site*> starting_land = {*std::next(unclaimed_tiles_.begin(), starting_tile_index)};
+        Map::SiteSet starting_land = {*std::next(unclaimed_tiles_.begin(), starting_tile_index)};
         unclaimed_tiles_.erase(*starting_land.begin());
 
         // Form a state here.
         std::uniform_real_distribution<float> hue_dist(0.0f, 360.0f);
         HSVColour country_colour{hue_dist(rng_), 0.6f, 0.8f, 0.5f};
-        states_[i] = make_unique<State>(country_colour, "Generated State " + std::to_string(i), starting_land);
+        states_[i] = make_unique<State>(this, i, country_colour, "Generated State " + std::to_string(i), starting_land);
     }
 
     // Grow each state until none can grow any longer.
@@ -64,53 +187,158 @@ void World::fillStates(int count) {
             should_grow_states = false;
         }
     }
+    pathfinder_->refresh();
+}
+
+void World::tick() {
+    PROFILE_SCOPE("World::tick");
+
+    // Bring the navigation clusters up to date with any changes in ownership.
+    pathfinder_->refresh();
+}
+
+void World::saveState(BinaryWriter& writer) const {
+    writer.writeU32((u32)map_->sites().size());
+    for (auto& site : map_->sites()) {
+        writer.writeU32(site.owning_state ? (u32)site.owning_state->id() : NO_OWNER);
+    }
+}
+
+bool World::loadState(BinaryReader& reader) {
+    u32 site_count;
+    Vector<u32> owners;
+    if (!reader.readU32(site_count) || site_count != map_->sites().size() || !reader.readArray(owners, site_count)) {
+        return false;
+    }
+    for (u32 owner : owners) {
+        if (owner != NO_OWNER && states_.count((int)owner) == 0) {
+            return false;
+        }
+    }
+    for (auto& site : map_->sites()) {
+        u32 owner = owners[site.index];
+        if (owner != NO_OWNER) {
+            states_[(int)owner]->addLandTile(&site);
+            unclaimed_tiles_.erase(&site);
+        } else if (site.owning_state) {
+            site.owning_state->removeLandTile(&site);
+            if (site.usable) {
+                unclaimed_tiles_.insert(&site);
+            }
+        }
+    }
+    return true;
+}
+
+void World::onSiteOwnerChanged(Map::Site* site) {
+    pathfinder_->onSiteOwnerChanged(*site);
+
+    u64& hash = site_ownership_hash_[site->index];
+    ownership_checksum_ -= hash;
+    hash = site->owning_state ? hashCombine(site->index, (u64)site->owning_state->id()) : 0;
+    ownership_checksum_ += hash;
+
+    // Move the edges of the site from the borders of its previous owner to those of its new one.
+    const State* previous = site_owners_[site->index];
+    const State* owner = site->owning_state;
+    if (previous == owner) {
+        return;
+    }
+    for (auto& edge : site->edges) {
+        const State* other = edge.neighbour ? edge.neighbour->owning_state : nullptr;
+        if (!other) {
+            continue;
+        }
+        float length = vecDistance(edge.v0(), edge.v1());
+        if (previous && previous != other) {
+            addStateBorder(previous->id(), other->id(), -1, -length);
+        }
+        if (owner && owner != other) {
+            addStateBorder(owner->id(), other->id(), 1, length);
+        }
+    }
+    site_owners_[site->index] = owner;
+}
+
+const Vector<World::StateBorder>& World::stateNeighbours(int state) const {
+    static const Vector<StateBorder> no_neighbours;
+    auto borders = state_borders_.find(state);
+    return borders != state_borders_.end() ? borders->second : no_neighbours;
+}
+
+World::StateBorder World::stateBorder(int a, int b) const {
+    for (auto& border : stateNeighbours(a)) {
+        if (border.state == b) {
+            return border;
+        }
+    }
+    return {b, 0, 0.0f};
+}
+
+void World::addStateBorder(int a, int b, int edge_count, float length) {
+    MEMORY_SCOPE(MemoryTag::States);
+    for (int side = 0; side < 2; ++side) {
+        Vector<StateBorder>& borders = state_borders_[side == 0 ? a : b];
+        int other = side == 0 ? b : a;
+        auto border = std::find_if(borders.begin(), borders.end(), [other](const StateBorder& border) {
+            return border.state == other;
+        });
+        if (border == borders.end()) {
+            borders.push_back({other, 0, 0.0f});
+            border = borders.end() - 1;
+        }
+        border->edge_count += edge_count;
+        border->length += length;
+        if (border->edge_count == 0) {
+            *border = borders.back();
+            borders.pop_back();
+        }
+    }
 }
 
 void World::draw(RenderContext& ctx) {
-    // Draw map.
-    for (auto& tile : map_->sites()) {
-        drawTile(ctx, tile, sf::Color(40, 40, 40));
-        drawTileEdge(ctx, tile, sf::Color(80, 80, 80, 80));
+    PROFILE_SCOPE("World::draw");
+    MEMORY_SCOPE(MemoryTag::Render);
+    // Draw map, with each tile tinted by the state which owns it. Zoomed in, only the tiles in
+    // view are drawn, with noisy edges.
+    if (ctx.pixels_per_unit >= NOISY_EDGE_MIN_SCALE) {
+        buildDetailBatch(ctx);
+        ctx.window->draw(detail_tile_vertices_.data(), detail_tile_vertices_.size(), sf::Triangles);
+        ctx.window->draw(detail_edge_vertices_.data(), detail_edge_vertices_.size(), sf::Quads);
+    } else {
+        buildMapBatch(ctx);
+        ctx.window->draw(tile_vertices_.data(), tile_vertices_.size(), sf::Triangles);
+        ctx.window->draw(edge_vertices_.data(), edge_vertices_.size(), sf::Quads);
     }
 
     // Draw states.
-    for (auto& state_pair : states_) {
-        state_pair.second->draw(ctx, false);
-    }
     /*
     for (auto& state_pair : states_) {
         state_pair.second->drawBorders(ctx);
     }
      */
+    // States which the viewer can't see any of aren't drawn.
     for (auto& state_pair : states_) {
-        state_pair.second->drawOverlays(ctx);
+        if (!ctx.visibility || ctx.visibility->isAnyVisible(ctx.viewer, state_pair.second->land())) {
+            state_pair.second->drawOverlays(ctx);
+        }
     }
 }
 
 void World::drawTile(RenderContext& ctx, const Map::Site& tile, sf::Color colour) {
-    sf::VertexArray tile_geometry(sf::Triangles);
-    for (int i = 0; i < tile.edges.size(); ++i) {
-        for (int p = 0; p < tile.edges[i].points.size() - 1; p++) {
-            tile_geometry.append(sf::Vertex(toSFML(tile.centre), colour));
-            tile_geometry.append(sf::Vertex(toSFML(tile.edges[i].points[p]), colour));
-            tile_geometry.append(sf::Vertex(toSFML(tile.edges[i].points[p + 1]), colour));
-        }
-    }
-    ctx.window->draw(tile_geometry);
+    Vector<sf::Vertex> tile_geometry(tileVertexCount(tile));
+    writeTile(tile, colour, tile_geometry.data());
+    ctx.window->draw(tile_geometry.data(), tile_geometry.size(), sf::Triangles);
 }
 
 void World::drawTileEdge(RenderContext& ctx, const Map::Site &tile, sf::Color colour) {
     // Convert into list of points.
     Vector<Vec2> ribbon_points;
     ribbon_points.reserve(tile.edges.size());
-    for (auto &edge : tile.edges) {
-        for (int i = 0; i < edge.points.size() - 1; i++) {
-            ribbon_points.push_back(edge.points[i]);
-        }
-    }
+    tileRibbonPoints(tile, ribbon_points);
 
     // Draw ribbon.
-    drawJoinedRibbon(ctx, ribbon_points, 0.0f, 1.5f, colour);
+    drawJoinedRibbon(ctx, ribbon_points, 0.0f, TILE_EDGE_THICKNESS, colour);
 }
 
 void World::drawLineList(RenderContext& ctx, const Vector<Vec2>& points, const sf::Color & colour)
@@ -129,68 +357,45 @@ void World::drawLineList(RenderContext& ctx, const Vector<Vec2>& points, const s
 void World::drawJoinedRibbon(RenderContext& ctx, const Vector<Vec2>& points, float inner_thickness,
                              float outer_thickness, const sf::Color& colour) {
     // Draw border using a ribbon.
-    if (points.size() > 2) {
-        sf::VertexArray border(sf::Quads, points.size() * 4);
-
-        // Generate ribbon edges from the cycle of points.
-        Vector<Pair<Vec2, Vec2>> ribbon_edges;
-        int num_points = (int)points.size();
-        for (int i = 0; i < num_points; ++i) {
-            // To generate pair of ribbon points about point i, we need to consider points: i-1 -> i -> i+1.
-            const Vec2& a = points[(i - 1 + num_points) % num_points];
-            const Vec2& b = points[i];
-            const Vec2& c = points[(i + 1) % num_points];
-            Vec2 t_ab = glm::normalize(Vec2{a.y - b.y, b.x - a.x});
-            Vec2 t_bc = glm::normalize(Vec2{b.y - c.y, c.x - b.x});
-            const Vec2 ribbon_first = intersection(
-                    a + t_ab * outer_thickness, b + t_ab * outer_thickness,
-                    b + t_bc * outer_thickness, c + t_bc * outer_thickness);
-            const Vec2 ribbon_second = intersection(
-                    a - t_ab * inner_thickness, b - t_ab * inner_thickness,
-                    b - t_bc * inner_thickness, c - t_bc * inner_thickness);
-            ribbon_edges.emplace_back(ribbon_first, ribbon_second);
-        }
-
-        // Join ribbon edges with quads.
-        for (int i = 0; i < ribbon_edges.size(); ++i) {
-            border[i * 4].position = toSFML(ribbon_edges[i].first);
-            border[i * 4].color = colour;
-            border[i * 4 + 1].position = toSFML(ribbon_edges[(i + 1) % ribbon_edges.size()].first);
-            border[i * 4 + 1].color = colour;
-            border[i * 4 + 2].position = toSFML(ribbon_edges[(i + 1) % ribbon_edges.size()].second);
-            border[i * 4 + 2].color = colour;
-            border[i * 4 + 3].position = toSFML(ribbon_edges[i].second);
-            border[i * 4 + 3].color = colour;
-        }
-        ctx.window->draw(border);
-    }
-}
-
-void World::drawBorder(RenderContext& ctx, Vector<Vector<Map::GraphEdge*>> list_of_boundaries, sf::Color colour)
+    Vector<sf::Vertex> border(ribbonVertexCount(points.size()));
+    writeJoinedRibbon(points, inner_thickness, outer_thickness, colour, border.data());
+    ctx.window->draw(border.data(), border.size(), sf::Quads);
+}
+
+void World::drawBorder(RenderContext& ctx, const Vector<Vector<Map::GraphEdge*>>& list_of_boundaries, sf::Color colour)
 {
-	// Sort boundaries by joining vertices together.
 	for (auto& boundaries : list_of_boundaries)
 	{
-		Vector<Vec2> points;
-		for (auto& edge : boundaries)
+		drawBorder(ctx, boundaries, colour);
+	}
+}
+
+void World::drawBorder(RenderContext& ctx, const Vector<Map::GraphEdge*>& boundary, sf::Color colour)
+{
+	// Sort boundaries by joining vertices together.
+	Vector<Vec2> points;
+	for (auto& edge : boundary)
+	{
+		points.emplace_back(edge->points.front());
+		for (int p = 1; p < (edge->points.size() - 1); ++p)
 		{
-			points.emplace_back(edge->points.front());
-			for (int p = 1; p < (edge->points.size() - 1); ++p)
-			{
-				points.emplace_back(edge->points[p]);
-				points.emplace_back(edge->points[p]);
-			}
-			points.emplace_back(edge->points.back());
+			points.emplace_back(edge->points[p]);
+			points.emplace_back(edge->points[p]);
 		}
+		points.emplace_back(edge->points.back());
+	}
 
-		// Draw border.
-		HSVColour border_colour = colour;
-		border_colour.s = 0.1f;
-		border_colour.v = 1.0f;
-		border_colour.a = 1.0f;
+	// Draw border.
+	HSVColour border_colour = colour;
+	border_colour.s = 0.1f;
+	border_colour.v = 1.0f;
+	border_colour.a = 1.0f;
 
-		drawLineList(ctx, points, border_colour);
-	}
+	drawLineList(ctx, points, border_colour);
+}
+
+const Map& World::map() const {
+    return *map_;
 }
 
 Vector<Map::Site>& World::mapSites() {
@@ -201,7 +406,11 @@ const Vector<Map::Site>& World::mapSites() const {
     return map_->sites();
 }
 
-const HashMap<int, SharedPtr<State>> &World::states() const {
+Pathfinder& World::pathfinder() {
+    return *pathfinder_;
+}
+
+const OrderedMap<int, SharedPtr<State>> &World::states() const {
     return states_;
 }
 
@@ -214,11 +423,21 @@ WeakPtr<State> World::getStateById(int id) const {
 }
 
 bool World::growState(State *state) {
-    auto border = state->unorderedBoundary(); // This will always contain a single exclave, the mainland.
+    // Gather the border of every part of the state, in site order, so the tile claimed doesn't
+    // depend on how the border loops happen to be laid out.
+    Vector<Map::GraphEdge*> border;
+    for (auto& loop : state->borderLoops()) {
+        border.insert(border.end(), loop.edges.begin(), loop.edges.end());
+    }
+    std::sort(border.begin(), border.end(), [](const Map::GraphEdge* a, const Map::GraphEdge* b) {
+        u32 site_a = Map::edgeSite(*a)->index;
+        u32 site_b = Map::edgeSite(*b)->index;
+        return site_a != site_b ? site_a < site_b : std::less<const Map::GraphEdge*>()(a, b);
+    });
 
     // Map border points to unclaimed land.
     Vector<Map::Site*> unclaimed_border_tiles;
-    for (auto& e : border[0]) {
+    for (auto& e : border) {
         if (unclaimed_tiles_.count(e->edge->d[0]) == 1) {
             unclaimed_border_tiles.push_back(e->edge->d[0]);
         }
@@ -239,3 +458,126 @@ bool World::growState(State *state) {
     unclaimed_tiles_.erase(next_tile);
     return true;
 }
+
+void World::buildMapBatch(const RenderContext& ctx) {
+    PROFILE_SCOPE("World::buildMapBatch");
+    auto& sites = map_->sites();
+    u32 num_sites = (u32)sites.size();
+
+    // The geometry of each site doesn't change, so the offsets are only computed once.
+    if (tile_vertex_offsets_.size() != num_sites + 1) {
+        tile_vertex_offsets_.assign(num_sites + 1, 0);
+        edge_vertex_offsets_.assign(num_sites + 1, 0);
+        Vector<Vec2> ribbon_points;
+        for (u32 i = 0; i < num_sites; ++i) {
+            tileRibbonPoints(sites[i], ribbon_points);
+            tile_vertex_offsets_[i + 1] = tile_vertex_offsets_[i] + tileVertexCount(sites[i]);
+            edge_vertex_offsets_[i + 1] = edge_vertex_offsets_[i] + ribbonVertexCount(ribbon_points.size());
+        }
+        tile_vertices_.resize(tile_vertex_offsets_.back());
+        edge_vertices_.resize(edge_vertex_offsets_.back());
+    }
+
+    jobs_.parallelFor(0, num_sites, 512, [this, &sites, &ctx](u32 begin, u32 end) {
+        PROFILE_SCOPE("World::buildMapBatchRange");
+        Vector<Vec2> ribbon_points;
+        for (u32 i = begin; i < end; ++i) {
+            const Map::Site& tile = sites[i];
+            writeTile(tile, tileColour(ctx, i), &tile_vertices_[tile_vertex_offsets_[i]]);
+
+            tileRibbonPoints(tile, ribbon_points);
+            writeJoinedRibbon(ribbon_points, 0.0f, TILE_EDGE_THICKNESS, TILE_EDGE_COLOUR,
+                              edge_vertices_.data() + edge_vertex_offsets_[i]);
+        }
+    });
+}
+
+sf::Color World::tileColour(const RenderContext& ctx, u32 site) const {
+    return tileColour(ctx, site, map_->terrain().elevation(site), map_->terrain().moisture(site));
+}
+
+sf::Color World::tileColour(const RenderContext& ctx, u32 site, float elevation, float moisture) const {
+    // Blend the state colour over the base tile colour. Tiles the viewer can't see are darkened,
+    // and don't show who owns them.
+    bool hidden = ctx.visibility && !ctx.visibility->isVisible(ctx.viewer, site);
+    sf::Color colour = terrainColour(elevation, moisture, hidden ? HIDDEN_TILE_COLOUR : TILE_COLOUR);
+    const State* owner = map_->sites()[site].owning_state;
+    if (owner && !hidden) {
+        sf::Color state_colour = owner->colour();
+        auto blend = [](u8 base, u8 over) {
+            return (u8)((base * (255 - STATE_TILE_ALPHA) + over * STATE_TILE_ALPHA) / 255);
+        };
+        colour = {blend(colour.r, state_colour.r), blend(colour.g, state_colour.g), blend(colour.b, state_colour.b)};
+    }
+    return colour;
+}
+
+void World::buildDetailBatch(const RenderContext& ctx) {
+    PROFILE_SCOPE("World::buildDetailBatch");
+    auto& sites = map_->sites();
+    Vec2 view_min = ctx.view_min - Vec2{DETAIL_VIEW_MARGIN, DETAIL_VIEW_MARGIN};
+    Vec2 view_max = ctx.view_max + Vec2{DETAIL_VIEW_MARGIN, DETAIL_VIEW_MARGIN};
+    detail_sites_.clear();
+    for (auto& site : sites) {
+        if (site.centre.x >= view_min.x && site.centre.y >= view_min.y && site.centre.x <= view_max.x &&
+            site.centre.y <= view_max.y) {
+            detail_sites_.push_back(site.index);
+        }
+    }
+
+    // Build the noisy edges which haven't been needed at this level of detail before, in
+    // parallel. Each is shared by two sites, so duplicates are removed first.
+    Vector<Pair<const Map::Edge*, u32>> missing_edges;
+    for (u32 site : detail_sites_) {
+        for (auto& edge : sites[site].edges) {
+            u32 level = noisyEdgeLevel(*edge.edge, ctx.pixels_per_unit);
+            if (!map_->hasNoisyEdgePoints(*edge.edge, level)) {
+                missing_edges.emplace_back(edge.edge.get(), level);
+            }
+        }
+    }
+    std::sort(missing_edges.begin(), missing_edges.end());
+    missing_edges.erase(std::unique(missing_edges.begin(), missing_edges.end()), missing_edges.end());
+    jobs_.parallelFor(0, (u32)missing_edges.size(), 64, [this, &missing_edges](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i) {
+            map_->noisyEdgePoints(*missing_edges[i].first, missing_edges[i].second);
+        }
+    });
+
+    // Join the edges of each site into an outline, following the site's own winding, and fill it
+    // as a fan around the centre. The outline is shaded by the terrain under each point, read
+    // through the noise cache, so terrain varies across tiles rather than stepping between them.
+    detail_tile_vertices_.clear();
+    detail_edge_vertices_.clear();
+    Vector<Vec2> outline;
+    Vector<float> outline_elevation, outline_moisture;
+    for (u32 site : detail_sites_) {
+        const Map::Site& tile = sites[site];
+        outline.clear();
+        for (auto& edge : tile.edges) {
+            const Vector<Vec2>& points =
+                map_->noisyEdgePoints(*edge.edge, noisyEdgeLevel(*edge.edge, ctx.pixels_per_unit));
+            bool reversed = glm::distance2(edge.v0(), points.back()) < glm::distance2(edge.v0(), points.front());
+            for (size_t p = 0; p + 1 < points.size(); ++p) {
+                outline.push_back(reversed ? points[points.size() - 1 - p] : points[p]);
+            }
+        }
+        outline_elevation.resize(outline.size());
+        outline_moisture.resize(outline.size());
+        map_->terrain().elevationAt(noise_cache_, outline.data(), outline_elevation.data(), outline.size());
+        map_->terrain().moistureAt(noise_cache_, outline.data(), outline_moisture.data(), outline.size());
+        sf::Color colour = tileColour(ctx, site);
+        for (size_t p = 0; p < outline.size(); ++p) {
+            size_t q = (p + 1) % outline.size();
+            detail_tile_vertices_.emplace_back(toSFML(tile.centre), colour);
+            detail_tile_vertices_.emplace_back(toSFML(outline[p]),
+                                               tileColour(ctx, site, outline_elevation[p], outline_moisture[p]));
+            detail_tile_vertices_.emplace_back(toSFML(outline[q]),
+                                               tileColour(ctx, site, outline_elevation[q], outline_moisture[q]));
+        }
+        size_t first_edge_vertex = detail_edge_vertices_.size();
+        detail_edge_vertices_.resize(first_edge_vertex + ribbonVertexCount(outline.size()));
+        writeJoinedRibbon(outline, 0.0f, TILE_EDGE_THICKNESS, TILE_EDGE_COLOUR,
+                          detail_edge_vertices_.data() + first_edge_vertex);
+    }
+}
@@ -2,18 +2,39 @@
 
 #include "world/Map.h"
 #include "world/State.h"
+#include "world/Pathfinder.h"
 #include "gameplay/Unit.h"
 
 #include "RenderContext.h"
 
+class JobSystem;
+class BinaryWriter;
+class BinaryReader;
+
 class World {
 public:
-    World(int num_points, const Vec2& min, const Vec2& max);
+    // The stretch of border between a state and one of its neighbours.
+    struct StateBorder {
+        int state;
+        u32 edge_count;
+        float length;
+    };
+
+    // See Map for 'terrain_cache_path'.
+    World(int num_points, const Vec2& min, const Vec2& max, JobSystem& jobs, const String& terrain_cache_path = "");
 
     // Map generation.
     void generateStates(int count, int max_size);
     void fillStates(int count);
 
+    void tick();
+
+    // Snapshots. Only site ownership is saved, as a state id per site, since the map and the
+    // states themselves are generated the same way from the same settings. Loading moves sites
+    // into their saved owners.
+    void saveState(BinaryWriter& writer) const;
+    bool loadState(BinaryReader& reader);
+
     // Drawing.
     void draw(RenderContext& ctx);
     void drawTile(RenderContext& ctx, const Map::Site& tile, sf::Color colour);
@@ -21,23 +42,80 @@ public:
 	void drawLineList(RenderContext& ctx, const Vector<Vec2>& points, const sf::Color& colour);
 	void drawJoinedRibbon(RenderContext& ctx, const Vector<Vec2>& points, float inner_thickness, float outer_thickness, const sf::Color& colour);
 
-	void drawBorder(RenderContext& ctx, Vector<Vector<Map::GraphEdge*>> list_of_boundaries, sf::Color colour);
+	void drawBorder(RenderContext& ctx, const Vector<Vector<Map::GraphEdge*>>& list_of_boundaries, sf::Color colour);
+    void drawBorder(RenderContext& ctx, const Vector<Map::GraphEdge*>& boundary, sf::Color colour);
 
     // States.
-    const HashMap<int, SharedPtr<State>>& states() const;
+    const OrderedMap<int, SharedPtr<State>>& states() const;
     WeakPtr<State> getStateById(int id) const;
 
+    // Called by a state whenever it gains or loses a site.
+    void onSiteOwnerChanged(Map::Site* site);
+
+    // The states bordering 'state', each with the number of edges and the length of border they
+    // share with it. Kept up to date from the edges of each site which changes hands, so reading
+    // it costs nothing beyond the number of neighbours.
+    const Vector<StateBorder>& stateNeighbours(int state) const;
+
+    // The border between two states, with no edges if they don't share one.
+    StateBorder stateBorder(int a, int b) const;
+
+    // Hash of which state owns each site, updated as sites change hands.
+    u64 checksum() const {
+        return ownership_checksum_;
+    }
+
     // Tiles.
+    const Map& map() const;
     Vector<Map::Site>& mapSites();
     const Vector<Map::Site>& mapSites() const;
 
+    // Navigation.
+    Pathfinder& pathfinder();
+
+    // Shared cache of noise tiles, for sampling terrain between site centres. See
+    // Terrain::elevationAt.
+    NoiseTileCache& noiseCache() {
+        return noise_cache_;
+    }
+
 private:
-    HashMap<int, SharedPtr<State>> states_;
+    JobSystem& jobs_;
+
+    OrderedMap<int, SharedPtr<State>> states_;
 
     std::mt19937 rng_;
     UniquePtr<Map> map_;
-    HashSet<Map::Site*> unclaimed_tiles_;
+    Map::SiteSet unclaimed_tiles_;
+    UniquePtr<Pathfinder> pathfinder_;
+    NoiseTileCache noise_cache_;
+
+    // The checksum is the sum of a hash of each owned site and its owner, so it can be updated
+    // as single sites change hands.
+    u64 ownership_checksum_;
+    Vector<u64> site_ownership_hash_;
+
+    // Who owned each site as of the last onSiteOwnerChanged, and the borders between states.
+    Vector<const State*> site_owners_;
+    HashMap<int, Vector<StateBorder>> state_borders_;
+
+    // Rendering data. Every tile is batched into these vertex arrays each frame. The offsets give
+    // the first vertex of each site, so sites can be written in parallel.
+    Vector<u32> tile_vertex_offsets_;
+    Vector<u32> edge_vertex_offsets_;
+    Vector<sf::Vertex> tile_vertices_;
+    Vector<sf::Vertex> edge_vertices_;
+
+    // Zoomed in, just the sites in view are batched each frame, with noisy edges.
+    Vector<u32> detail_sites_;
+    Vector<sf::Vertex> detail_tile_vertices_;
+    Vector<sf::Vertex> detail_edge_vertices_;
 
 private:
     bool growState(State* state);
+    void addStateBorder(int a, int b, int edge_count, float length);
+    void buildMapBatch(const RenderContext& ctx);
+    void buildDetailBatch(const RenderContext& ctx);
+    sf::Color tileColour(const RenderContext& ctx, u32 site) const;
+    sf::Color tileColour(const RenderContext& ctx, u32 site, float elevation, float moisture) const;
 };